@@ -0,0 +1,35 @@
+#pragma once
+
+#include "optimizer.hpp"
+
+#include <atomic>
+
+// Adam with decoupled weight decay: running averages m of g and v of g^2, both corrected for starting
+// at zero, give the step learningRate * m / (sqrt(v) + epsilon), and every weight also shrinks by
+// learningRate * weightDecay * w regardless of its gradient. The step count is saved with the model
+class AdamWOptimizer : public Optimizer
+{
+friend class NeuralNetwork;
+public:
+    explicit AdamWOptimizer(float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-8f, float weightDecay = 0.01f);
+
+    float getBeta1() const { return beta1_; }
+    float getBeta2() const { return beta2_; }
+    float getEpsilon() const { return epsilon_; }
+    float getWeightDecay() const { return weightDecay_; }
+    unsigned int getSteps() const { return steps_; }
+
+    virtual unsigned int getStateCount() const { return 2; }
+    virtual void beginStep();
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual void step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                      float learningRate, size_t n) const;
+private:
+    float beta1_;
+    float beta2_;
+    float epsilon_;
+    float weightDecay_;
+    // Counted atomically, threads of NeuralNetwork::trainAsync take steps at the same time
+    std::atomic<unsigned int> steps_;
+};
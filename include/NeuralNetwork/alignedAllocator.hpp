@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Standard-conforming allocator returning blocks aligned to Alignment bytes (a cache line and
+// an AVX-512 register by default). Sizes are rounded up to a multiple of the alignment, so two
+// small matrices never share a cache line and vector loads past the last entry stay inside
+// the block.
+template<typename T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    static constexpr size_t ALIGNMENT = Alignment;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        const size_t bytes = (n*sizeof(T) + Alignment - 1)/Alignment*Alignment;
+        return static_cast<T*>(::operator new(bytes, std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "alignedAllocator.hpp"
+
+// Bump allocator for short-lived matrices. Allocating moves a pointer forward, freeing does
+// nothing, and rewind() releases everything at once. When a round of allocations does not fit,
+// the excess is taken from the heap and the arena grows to the whole round's size on the next
+// rewind, so a repeated workload (e.g. one training step) stops touching the heap after the
+// first round.
+class Arena
+{
+public:
+    // Every allocation starts on a cache line, like the blocks of AlignedAllocator
+    static constexpr size_t ALIGNMENT = 64;
+
+    explicit Arena(size_t capacity = 0);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& o);
+    Arena& operator=(Arena&& o);
+
+    void* allocate(size_t bytes);
+
+    // Invalidates everything allocated from the arena
+    void rewind();
+
+    // Grows the arena to at least capacity bytes between rounds, e.g. to a size known in advance
+    void reserve(size_t capacity);
+
+    size_t getCapacity() const;
+    size_t getUsed() const;
+
+    // Arena of the innermost ArenaScope on this thread, nullptr if there is none
+    static Arena* current();
+private:
+    friend class ArenaScope;
+
+    void release();
+
+    char* data_;
+    size_t capacity_;
+    size_t used_;
+
+    // Heap blocks taken after the arena filled up, freed on rewind
+    std::vector<void*> overflow_;
+    size_t overflowBytes_;
+
+    static thread_local Arena* current_;
+};
+
+// Makes an arena the current one on this thread for the lifetime of the scope and rewinds it
+// at the end, so everything ArenaAllocator handed out inside the scope must be destroyed by then.
+// Scopes of the same arena must not nest.
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena& arena);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+private:
+    Arena& arena_;
+    Arena* previous_;
+};
+
+// Allocator taking memory from the arena that was current when it was created,
+// or from the heap (64-byte aligned) when no arena was current
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator(): arena_(Arena::current()) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& o): arena_(o.getArena()) {}
+
+    T* allocate(size_t n)
+    {
+        if(arena_)
+        {
+            return static_cast<T*>(arena_->allocate(n*sizeof(T)));
+        }
+        return AlignedAllocator<T, Arena::ALIGNMENT>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if(!arena_)
+        {
+            AlignedAllocator<T, Arena::ALIGNMENT>().deallocate(p, n);
+        }
+    }
+
+    Arena* getArena() const { return arena_; }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& o) const { return arena_ == o.getArena(); }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& o) const { return arena_ != o.getArena(); }
+private:
+    Arena* arena_;
+};
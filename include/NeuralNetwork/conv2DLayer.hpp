@@ -0,0 +1,76 @@
+#pragma once
+
+#include "layer.hpp"
+#include "reluLayer.hpp"
+#include "sigmoidLayer.hpp"
+#include "tensorShape.hpp"
+
+// 2-D convolution with square kernels, stride 1 and zero padding, followed by an activation
+// policy (see DenseLayer). Row f of the weights holds filter f over all input channels (c, ky, kx).
+// Both passes are lowered to the blocked GEMM through im2col: the receptive fields of the whole
+// batch become the columns of one matrix, ordered pixel by pixel with the samples innermost, so the
+// product W * columns already is the output in the batch layout of TensorShape. Small 3x3
+// convolutions (the first layer of an image network) skip the im2col copy and run directly,
+// and a 1x1 (pointwise) convolution is a plain GEMM over the input, which is its own im2col matrix.
+template<typename Activation>
+class Conv2DLayer : public Layer
+{
+friend class NeuralNetwork;
+public:
+    Conv2DLayer(TensorShape input, unsigned int filters, unsigned int kernelSize, unsigned int padding = 0);
+
+    // Leaves weights and biases unset, see Layer
+    Conv2DLayer(TensorShape input, unsigned int filters, unsigned int kernelSize, unsigned int padding,
+                MatrixUninitializedTag);
+
+    TensorShape getInputShape() const { return input_; }
+    TensorShape getOutputShape() const { return output_; }
+    unsigned int getKernelSize() const { return kernelSize_; }
+    unsigned int getPadding() const { return padding_; }
+
+    virtual unsigned int getInputNodesCount() const { return input_.size(); }
+
+    // Adds the im2col columns of both passes and the repacked delta
+    virtual size_t getWorkspaceSize(unsigned int samples) const;
+
+    virtual ActivationKernel getActivationKernel() const { return Activation::forwardKernel(accuracy_); }
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual bool derivativeFromOutput() const { return Activation::DERIVATIVE_FROM_OUTPUT; }
+
+    virtual NNMatrixType feedforward(NNMatrixViewType input, NNMatrixType& weightedInput);
+    virtual NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // Writes the activation tag and the shape ahead of the matrices
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual NNMatrixType propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                        NNMatrixType& nablaW, NNMatrixType& nablaB);
+private:
+    // Largest channels*3*3 convolved directly, deeper inputs are faster through the GEMM
+    static constexpr unsigned int DIRECT_MAX_DEPTH = 18;
+
+    bool isPointwise() const { return kernelSize_ == 1 && padding_ == 0; }
+
+    // weights * input + bias with activation applied to it (none when activation is null)
+    NNMatrixType convolve(NNMatrixViewType input, ActivationKernel activation) const;
+
+    // Writes the products into z, which is filters x (pixels * samples)
+    void convolveDirect(NNMatrixViewType input, MatrixView<NNDataType> z) const;
+
+    // Receptive fields of every output pixel of every sample, (channels * k * k) x (pixels * samples)
+    NNMatrixType im2col(NNMatrixViewType input) const;
+
+    // Adds every entry of the receptive field matrix back to the input entry it was copied from
+    void col2im(NNMatrixViewType columns, NNMatrixType& input) const;
+
+    TensorShape input_;
+    TensorShape output_;
+    unsigned int kernelSize_;
+    unsigned int padding_;
+};
+
+typedef Conv2DLayer<SigmoidActivation> SigmoidConv2DLayer;
+typedef Conv2DLayer<ReLUActivation> ReLUConv2DLayer;
+
+extern template class Conv2DLayer<SigmoidActivation>;
+extern template class Conv2DLayer<ReLUActivation>;
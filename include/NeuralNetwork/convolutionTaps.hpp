@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+
+#include "neuralnetwork.hpp"
+#include "tensorShape.hpp"
+
+// Single kernel entries (taps) of stride-1 convolutions with zero padding. Tap (ky, kx) connects
+// every output pixel with the input pixel shifted by (ky - padding, kx - padding). Maps are stored
+// pixel after pixel with the samples of a pixel adjacent, i.e. rows of a batch matrix.
+class ConvolutionTaps
+{
+public:
+    // Calls op(input pixel, output pixel, count) for every row of the output map, with the run of
+    // count output pixels whose tap input lies inside the input map. Pixels are indices within a map
+    // (y*width + x), and the pixels of a run are consecutive in both maps. The remaining output
+    // pixels only see padding
+    template<typename Op>
+    static void forEachRun(TensorShape input, TensorShape output, unsigned int ky, unsigned int kx,
+                           unsigned int padding, Op op);
+
+    // Values of scratch needed by accumulate
+    static unsigned int scratchSize(TensorShape output, unsigned int kernelSize, unsigned int samples);
+
+    // out map += weight * tap of in map, both maps without padding between rows. When input and output
+    // rows are equally long ("same" padding) all runs have one offset, so a single axpy spans them;
+    // the pixels between runs, which it adds from across the map edge, are saved to scratch and restored
+    static void accumulate(TensorShape input, TensorShape output, unsigned int ky, unsigned int kx,
+                           unsigned int padding, NNDataType weight, const NNDataType* in, NNDataType* out,
+                           unsigned int samples, NNDataType* scratch);
+private:
+    ConvolutionTaps();
+};
+
+template<typename Op>
+void ConvolutionTaps::forEachRun(TensorShape input, TensorShape output, unsigned int ky, unsigned int kx,
+                                 unsigned int padding, Op op)
+{
+    const int pad = padding;
+    const int oyBegin = std::max(0, pad - (int)ky);
+    const int oyEnd = std::min((int)output.height, (int)(input.height + padding) - (int)ky);
+    const int oxBegin = std::max(0, pad - (int)kx);
+    const int oxEnd = std::min((int)output.width, (int)(input.width + padding) - (int)kx);
+    if(oxEnd <= oxBegin)
+    {
+        return;
+    }
+
+    for(int oy = oyBegin; oy < oyEnd; ++oy)
+    {
+        op((oy + (int)ky - pad)*input.width + oxBegin + kx - pad, oy*output.width + oxBegin, oxEnd - oxBegin);
+    }
+}
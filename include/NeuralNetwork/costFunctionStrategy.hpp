@@ -9,10 +9,14 @@ class CostFunctionStrategy
 {
 public:
     // Abstract cost function
-    virtual NNDataType calculateCost(const NNMatrixType& output, const NNMatrixType& target) const = 0;
+    virtual NNDataType calculateCost(NNMatrixViewType output, NNMatrixViewType target) const = 0;
     
     // Derivative of abstract cost function 
-    virtual NNMatrixType calculateCostDerivative(const NNMatrixType& output, const NNMatrixType& target) const = 0;
+    virtual NNMatrixType calculateCostDerivative(NNMatrixViewType output, NNMatrixViewType target) const = 0;
+
+    // True when the cost's derivative and softmax's Jacobian cancel, so that dC/dz of a softmax
+    // output layer is simply a - y
+    virtual bool simplifiesWithSoftmax() const { return false; }
 
     // Abstract serialization method
     virtual void serialize(std::ofstream& ofile) const = 0;
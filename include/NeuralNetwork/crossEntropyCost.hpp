@@ -5,7 +5,11 @@
 class CrossEntropyCost : public CostFunctionStrategy
 {
 public:
-    virtual NNDataType calculateCost(const NNMatrixType& output, const NNMatrixType& target) const;
-    virtual NNMatrixType calculateCostDerivative(const NNMatrixType& output, const NNMatrixType& target) const;
+    virtual NNDataType calculateCost(NNMatrixViewType output, NNMatrixViewType target) const;
+    virtual NNMatrixType calculateCostDerivative(NNMatrixViewType output, NNMatrixViewType target) const;
+
+    // On top of softmax outputs cross-entropy is taken over the whole distribution, -sum(y*log(a)),
+    // whose gradient w.r.t. z is a - y
+    virtual bool simplifiesWithSoftmax() const { return true; }
     virtual void serialize(std::ofstream& ofile) const;
 };
\ No newline at end of file
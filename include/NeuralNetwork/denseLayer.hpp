@@ -0,0 +1,49 @@
+#pragma once
+
+#include "layer.hpp"
+#include "threadPool.hpp"
+
+// Fully connected layer whose activation function is given by a policy class providing
+//   static constexpr bool DERIVATIVE_FROM_OUTPUT   - derivative takes a = f(z) instead of z
+//   static NNDataType value(NNDataType z), derivative(NNDataType x)   - single values
+//   static Layer::ActivationKernel forwardKernel(ActivationAccuracy)   - whole buffers
+//   static void backward(const NNDataType* x, NNDataType* out, size_t n)
+//   static constexpr char ID[]   - 3-letter tag of model files
+// The buffer kernels are called directly, so a pass through the layer costs one virtual call
+// no matter how many values it activates.
+template<typename Activation>
+class DenseLayer : public Layer
+{
+friend class NeuralNetwork;
+public:
+    DenseLayer(unsigned int nodes, unsigned int prevNodes) : Layer(nodes, prevNodes) {}
+    DenseLayer(unsigned int nodes, unsigned int prevNodes, MatrixUninitializedTag) : Layer(nodes, prevNodes, uninitialized) {}
+
+    NNDataType activationFunction(NNDataType value) const { return Activation::value(value); }
+    NNDataType activationDerivative(NNDataType value) const { return Activation::derivative(value); }
+
+    virtual ActivationKernel getActivationKernel() const { return Activation::forwardKernel(accuracy_); }
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual bool derivativeFromOutput() const { return Activation::DERIVATIVE_FROM_OUTPUT; }
+
+    virtual void serialize(std::ofstream& ofile) const;
+};
+
+template<typename Activation>
+void DenseLayer<Activation>::activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const
+{
+    ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+    {
+        Activation::backward(in + begin, out + begin, end - begin);
+    });
+}
+
+template<typename Activation>
+void DenseLayer<Activation>::serialize(std::ofstream& ofile) const
+{
+    const unsigned int ID_LEN = 3;
+    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
+    ofile.write(Activation::ID, ID_LEN*sizeof(char));
+
+    serializeMatricies(ofile);
+}
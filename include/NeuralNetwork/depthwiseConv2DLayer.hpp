@@ -0,0 +1,64 @@
+#pragma once
+
+#include "layer.hpp"
+#include "reluLayer.hpp"
+#include "sigmoidLayer.hpp"
+#include "tensorShape.hpp"
+
+// Convolution of every channel with its own square kernel (stride 1, zero padding), followed by an
+// activation policy (see DenseLayer). Row c of the weights is the k x k kernel of channel c.
+// Together with a 1x1 Conv2DLayer mixing the channels it forms a depthwise-separable convolution,
+// which needs about 1/k^2 + 1/filters of the multiplications of a full k x k convolution.
+// With a filter per channel there is no product to hand to the GEMM: every weight scales a
+// shifted window of one map, which is a run of SIMD axpy (or dot for the weight gradient)
+// along map rows, the samples of a pixel being adjacent.
+template<typename Activation>
+class DepthwiseConv2DLayer : public Layer
+{
+friend class NeuralNetwork;
+public:
+    DepthwiseConv2DLayer(TensorShape input, unsigned int kernelSize, unsigned int padding = 0);
+
+    // Leaves weights and biases unset, see Layer
+    DepthwiseConv2DLayer(TensorShape input, unsigned int kernelSize, unsigned int padding, MatrixUninitializedTag);
+
+    TensorShape getInputShape() const { return input_; }
+    TensorShape getOutputShape() const { return output_; }
+    unsigned int getKernelSize() const { return kernelSize_; }
+    unsigned int getPadding() const { return padding_; }
+
+    virtual unsigned int getInputNodesCount() const { return input_.size(); }
+
+    virtual ActivationKernel getActivationKernel() const { return Activation::forwardKernel(accuracy_); }
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual bool derivativeFromOutput() const { return Activation::DERIVATIVE_FROM_OUTPUT; }
+
+    virtual NNMatrixType feedforward(NNMatrixViewType input, NNMatrixType& weightedInput);
+    virtual NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // Writes the activation tag and the shape ahead of the matrices
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual NNMatrixType propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                        NNMatrixType& nablaW, NNMatrixType& nablaB);
+private:
+    // weights * input + bias of every channel, without activation
+    NNMatrixType convolve(NNMatrixViewType input) const;
+
+    // Calls op(input row, output row, pixels) for the runs of pixels of map c that kernel entry
+    // (ky, kx) connects, rows being those of the batch matrices. A run spans a map row when the
+    // batch rows are contiguous and is a single pixel otherwise
+    template<typename Op>
+    void forEachRun(unsigned int c, unsigned int ky, unsigned int kx, bool contiguous, Op op) const;
+
+    TensorShape input_;
+    TensorShape output_;
+    unsigned int kernelSize_;
+    unsigned int padding_;
+};
+
+typedef DepthwiseConv2DLayer<SigmoidActivation> SigmoidDepthwiseConv2DLayer;
+typedef DepthwiseConv2DLayer<ReLUActivation> ReLUDepthwiseConv2DLayer;
+
+extern template class DepthwiseConv2DLayer<SigmoidActivation>;
+extern template class DepthwiseConv2DLayer<ReLUActivation>;
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "simdKernels.hpp"
+#include "threadPool.hpp"
+
+// How an operand of a product is read: as stored, or transposed
+enum class MatrixOp
+{
+    Normal,
+    Transpose
+};
+
+// Work done on every tile of C as soon as its product is complete, while the tile is still
+// in cache: adds bias[i] to row i of C and then, when an activation kernel is set, writes
+// activation(C) to out (out may be C itself). Fuses a dense layer's forward pass into the GEMM
+template<typename T>
+struct GemmEpilogue
+{
+    const T* bias;
+    void (*activation)(const T* in, T* out, size_t n);
+    T* out;
+    unsigned int ldOut;
+
+    GemmEpilogue(): bias(nullptr), activation(nullptr), out(nullptr), ldOut(0) {}
+    GemmEpilogue(const T* bias, void (*activation)(const T*, T*, size_t), T* out, unsigned int ldOut):
+        bias(bias), activation(activation), out(out), ldOut(ldOut) {}
+
+    bool empty() const { return !bias && !activation; }
+
+    // Epilogue of the tile starting at entry (i, j) of C
+    GemmEpilogue block(unsigned int i, unsigned int j) const;
+
+    // Applies the epilogue to m x n tile c, for which block() must have been called
+    void apply(T* c, unsigned int ldc, unsigned int m, unsigned int n) const;
+};
+
+template<typename T>
+GemmEpilogue<T> GemmEpilogue<T>::block(unsigned int i, unsigned int j) const
+{
+    return GemmEpilogue(bias ? bias + i : nullptr, activation, out ? out + i*ldOut + j : nullptr, ldOut);
+}
+
+template<typename T>
+void GemmEpilogue<T>::apply(T* c, unsigned int ldc, unsigned int m, unsigned int n) const
+{
+    if(empty()) return;
+
+    // A contiguous column (a batch of one) goes through the activation in one call
+    if(n == 1 && ldc == 1 && (!activation || ldOut == 1))
+    {
+        if(bias)
+        {
+            for(unsigned int i = 0; i < m; ++i) c[i] += bias[i];
+        }
+        if(activation) activation(c, out, m);
+        return;
+    }
+
+    for(unsigned int i = 0; i < m; ++i)
+    {
+        T* ci = c + i*ldc;
+        if(bias)
+        {
+            for(unsigned int j = 0; j < n; ++j) ci[j] += bias[i];
+        }
+        if(activation) activation(ci, out + i*ldOut, n);
+    }
+}
+
+// Cache-blocked matrix multiplication engine used by Matrix::operator*.
+// Follows the GotoBLAS/BLIS scheme: B is packed into KC x NC panels that live in L3,
+// A is packed into MC x KC blocks that live in L2, and every MR x NR tile of C
+// is computed by a micro-kernel that keeps its accumulators in registers
+// while streaming KC x NR slivers of B from L1. Transposed operands are handled by the packing
+// routines, which read them through swapped strides, so no transpose is ever materialized.
+// Large products are split into 2-D tiles of C computed on the threads of the ThreadPool. The algorithm
+// is chosen once from the shape of the whole product and every tile runs it, so each entry of C is
+// summed in the same order and results do not depend on the thread count.
+template<typename T>
+class Gemm
+{
+public:
+    // C = A * B, where A is m x k, B is k x n and C is m x n. All matrices are row-major,
+    // ld* is the distance (in elements) between the starts of two consecutive rows
+    static void multiply(unsigned int m, unsigned int n, unsigned int k,
+                         const T* a, unsigned int lda,
+                         const T* b, unsigned int ldb,
+                         T* c, unsigned int ldc);
+
+    // C = alpha * op(A) * op(B) + beta * C, where op(A) is m x k and op(B) is k x n.
+    // lda and ldb describe the stored (not transposed) matrices. When beta is zero
+    // C is only written, so it may be uninitialized. The epilogue runs on every finished tile
+    static void multiply(unsigned int m, unsigned int n, unsigned int k,
+                         T alpha,
+                         const T* a, unsigned int lda, MatrixOp opA,
+                         const T* b, unsigned int ldb, MatrixOp opB,
+                         T beta,
+                         T* c, unsigned int ldc,
+                         const GemmEpilogue<T>& epilogue = GemmEpilogue<T>());
+
+    // Register tile of C updated by a single micro-kernel call
+    static constexpr unsigned int MR = 6;
+    static constexpr unsigned int NR = 16;
+
+private:
+    // Entry (i, j) of an operand is at data[i*rowStride + j*columnStride]
+    struct Operand
+    {
+        const T* data;
+        unsigned int rowStride;
+        unsigned int columnStride;
+
+        Operand(const T* data, unsigned int ld, MatrixOp op):
+            data(data),
+            rowStride(op == MatrixOp::Normal ? ld : 1),
+            columnStride(op == MatrixOp::Normal ? 1 : ld) {}
+
+        T operator()(unsigned int i, unsigned int j) const { return data[i*rowStride + j*columnStride]; }
+        Operand block(unsigned int i, unsigned int j) const { Operand o = *this; o.data += i*rowStride + j*columnStride; return o; }
+    };
+
+    // Cache blocking parameters (in elements), chosen so that a KC x NR sliver of B fits in L1,
+    // a MC x KC block of A fits in L2 and a KC x NC panel of B fits in L3
+    static constexpr unsigned int KC = 256;
+    static constexpr unsigned int MC = 96;
+    static constexpr unsigned int NC = 4080;
+
+    // Below this amount of multiply-adds packing costs more than it saves
+    static constexpr unsigned long SMALL_PRODUCT = 32*32*32;
+
+    // Products this thin are a few rank-1 updates, which stream C row by row faster than
+    // packed tiles (e.g. the weight gradient of a batch of one)
+    static constexpr unsigned int SMALL_DEPTH = 4;
+
+    // Products with fewer multiply-adds run on the calling thread only
+    static constexpr unsigned long PARALLEL_PRODUCT = 1 << 20;
+
+    // Tiles per thread, more than one evens out tiles of different cost
+    static constexpr unsigned int TASKS_PER_THREAD = 2;
+
+    enum class Algorithm { Vector, Small, Blocked };
+
+    // Algorithm of a whole m x n x k product, its tiles must not choose their own: the kernels round differently
+    static Algorithm chooseAlgorithm(unsigned int m, unsigned int n, unsigned int k);
+
+    // The routines below compute C = alpha * A * B, or C += alpha * A * B when accumulate is set,
+    // and apply the epilogue to C
+
+    // Runs the algorithm on a single tile of C
+    static void multiplyTile(Algorithm algorithm, unsigned int m, unsigned int n, unsigned int k, T alpha,
+                             Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                             const GemmEpilogue<T>& epilogue);
+
+    static void multiplyParallel(Algorithm algorithm, unsigned int m, unsigned int n, unsigned int k, T alpha,
+                                 Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                                 const GemmEpilogue<T>& epilogue, unsigned int threads);
+    static void multiplySmall(unsigned int m, unsigned int n, unsigned int k, T alpha,
+                              Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                              const GemmEpilogue<T>& epilogue);
+
+    // Matrix-vector product, used when B is a single column
+    static void multiplyVector(unsigned int m, unsigned int k, T alpha,
+                               Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                               const GemmEpilogue<T>& epilogue);
+
+    static void multiplyBlocked(unsigned int m, unsigned int n, unsigned int k, T alpha,
+                                Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                                const GemmEpilogue<T>& epilogue);
+
+    // C = beta * C
+    static void scale(unsigned int m, unsigned int n, T beta, T* c, unsigned int ldc);
+
+    // A is scaled by alpha while it is packed
+    static void packA(unsigned int mc, unsigned int kc, T alpha, Operand a, T* buffer);
+    static void packB(unsigned int kc, unsigned int nc, Operand b, T* buffer);
+
+    static void microKernel(unsigned int kc, const T* a, const T* b,
+                            T* c, unsigned int ldc,
+                            unsigned int mr, unsigned int nr, bool accumulate);
+};
+
+template<typename T>
+void Gemm<T>::multiply(unsigned int m, unsigned int n, unsigned int k,
+                       const T* a, unsigned int lda,
+                       const T* b, unsigned int ldb,
+                       T* c, unsigned int ldc)
+{
+    multiply(m, n, k, T(1), a, lda, MatrixOp::Normal, b, ldb, MatrixOp::Normal, T(0), c, ldc);
+}
+
+template<typename T>
+void Gemm<T>::multiply(unsigned int m, unsigned int n, unsigned int k,
+                       T alpha,
+                       const T* a, unsigned int lda, MatrixOp opA,
+                       const T* b, unsigned int ldb, MatrixOp opB,
+                       T beta,
+                       T* c, unsigned int ldc,
+                       const GemmEpilogue<T>& epilogue)
+{
+    if(m == 0 || n == 0) return;
+
+    // beta == 0 overwrites C, beta == 1 accumulates into it, anything else scales it first
+    const bool accumulate = beta != T(0);
+    if(accumulate && beta != T(1))
+    {
+        scale(m, n, beta, c, ldc);
+    }
+
+    if(k == 0 || alpha == T(0))
+    {
+        if(!accumulate) scale(m, n, T(0), c, ldc);
+        epilogue.apply(c, ldc, m, n);
+        return;
+    }
+
+    const Operand opa(a, lda, opA);
+    const Operand opb(b, ldb, opB);
+
+    const Algorithm algorithm = chooseAlgorithm(m, n, k);
+
+    // a product inside a parallel task runs on its thread alone, tiled as for a single thread
+    const unsigned int threads = ThreadPool::insideTask() ? 1 : ThreadPool::getThreadCount();
+    if(threads > 1 && (unsigned long)m*n*k >= PARALLEL_PRODUCT)
+    {
+        multiplyParallel(algorithm, m, n, k, alpha, opa, opb, c, ldc, accumulate, epilogue, threads);
+        return;
+    }
+    multiplyTile(algorithm, m, n, k, alpha, opa, opb, c, ldc, accumulate, epilogue);
+}
+
+template<typename T>
+typename Gemm<T>::Algorithm Gemm<T>::chooseAlgorithm(unsigned int m, unsigned int n, unsigned int k)
+{
+    if(n == 1)
+    {
+        return Algorithm::Vector;
+    }
+    if(k <= SMALL_DEPTH || (unsigned long)m*n*k <= SMALL_PRODUCT)
+    {
+        return Algorithm::Small;
+    }
+    return Algorithm::Blocked;
+}
+
+template<typename T>
+void Gemm<T>::multiplyTile(Algorithm algorithm, unsigned int m, unsigned int n, unsigned int k, T alpha,
+                           Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                           const GemmEpilogue<T>& epilogue)
+{
+    switch(algorithm)
+    {
+        case Algorithm::Vector:
+            multiplyVector(m, k, alpha, a, b, c, ldc, accumulate, epilogue);
+            break;
+        case Algorithm::Small:
+            multiplySmall(m, n, k, alpha, a, b, c, ldc, accumulate, epilogue);
+            break;
+        case Algorithm::Blocked:
+            multiplyBlocked(m, n, k, alpha, a, b, c, ldc, accumulate, epilogue);
+    }
+}
+
+template<typename T>
+void Gemm<T>::multiplyParallel(Algorithm algorithm, unsigned int m, unsigned int n, unsigned int k, T alpha,
+                               Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                               const GemmEpilogue<T>& epilogue, unsigned int threads)
+{
+    // Grows the grid along the longer side of the tiles, which stay at least one register tile big
+    const unsigned int targetTasks = threads*TASKS_PER_THREAD;
+    unsigned int gridM = 1, gridN = 1;
+    while(gridM*gridN < targetTasks)
+    {
+        const bool canSplitM = m/(gridM + 1) >= MR;
+        const bool canSplitN = n/(gridN + 1) >= NR;
+        if(canSplitM && (!canSplitN || m/gridM >= n/gridN)) ++gridM;
+        else if(canSplitN) ++gridN;
+        else break;
+    }
+
+    // Tile edges fall on register tile boundaries
+    const unsigned int tileM = ((m + gridM - 1)/gridM + MR - 1)/MR*MR;
+    const unsigned int tileN = n == 1 ? 1 : ((n + gridN - 1)/gridN + NR - 1)/NR*NR;
+    const unsigned int tilesM = (m + tileM - 1)/tileM;
+    const unsigned int tilesN = (n + tileN - 1)/tileN;
+
+    ThreadPool::parallelFor(tilesM*tilesN, [&](unsigned int task)
+    {
+        const unsigned int i0 = (task/tilesN)*tileM;
+        const unsigned int j0 = (task%tilesN)*tileN;
+        multiplyTile(algorithm, std::min(tileM, m - i0), std::min(tileN, n - j0), k, alpha,
+                     a.block(i0, 0), b.block(0, j0), c + i0*ldc + j0, ldc, accumulate, epilogue.block(i0, j0));
+    });
+}
+
+template<typename T>
+void Gemm<T>::scale(unsigned int m, unsigned int n, T beta, T* c, unsigned int ldc)
+{
+    for(unsigned int i = 0; i < m; ++i)
+    {
+        T* ci = c + i*ldc;
+        if(beta == T(0))
+        {
+            std::fill(ci, ci + n, T(0));
+            continue;
+        }
+        for(unsigned int j = 0; j < n; ++j)
+        {
+            ci[j] *= beta;
+        }
+    }
+}
+
+template<typename T>
+void Gemm<T>::multiplyBlocked(unsigned int m, unsigned int n, unsigned int k, T alpha,
+                              Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                              const GemmEpilogue<T>& epilogue)
+{
+    // Packing buffers are reused between calls so that steady-state multiplication does not allocate
+    thread_local std::vector<T> bufferA;
+    thread_local std::vector<T> bufferB;
+    bufferA.resize(MC*KC);
+    bufferB.resize(KC*((std::min(n, NC) + NR - 1)/NR)*NR);
+
+    auto kernel = &Gemm::microKernel;
+    if constexpr(std::is_same<T, float>::value)
+    {
+        kernel = SimdKernels::get().gemmMicroKernel;
+    }
+
+    for(unsigned int jc = 0; jc < n; jc += NC)
+    {
+        const unsigned int nc = std::min(NC, n - jc);
+        for(unsigned int pc = 0; pc < k; pc += KC)
+        {
+            const unsigned int kc = std::min(KC, k - pc);
+            const bool lastBlock = pc + kc == k;
+            packB(kc, nc, b.block(pc, jc), bufferB.data());
+
+            for(unsigned int ic = 0; ic < m; ic += MC)
+            {
+                const unsigned int mc = std::min(MC, m - ic);
+                packA(mc, kc, alpha, a.block(ic, pc), bufferA.data());
+
+                for(unsigned int jr = 0; jr < nc; jr += NR)
+                {
+                    const unsigned int nr = std::min(NR, nc - jr);
+                    for(unsigned int ir = 0; ir < mc; ir += MR)
+                    {
+                        const unsigned int mr = std::min(MR, mc - ir);
+                        T* tile = c + (ic + ir)*ldc + jc + jr;
+                        kernel(kc, bufferA.data() + ir*kc, bufferB.data() + jr*kc,
+                               tile, ldc, mr, nr, accumulate || pc > 0);
+                        // the tile is complete after its last block of k, and still in L1
+                        if(lastBlock) epilogue.block(ic + ir, jc + jr).apply(tile, ldc, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<typename T>
+void Gemm<T>::multiplySmall(unsigned int m, unsigned int n, unsigned int k, T alpha,
+                            Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                            const GemmEpilogue<T>& epilogue)
+{
+    // i-p-j order walks both B and C along rows
+    for(unsigned int i = 0; i < m; ++i)
+    {
+        T* ci = c + i*ldc;
+        if(!accumulate) std::fill(ci, ci + n, T(0));
+        for(unsigned int p = 0; p < k; ++p)
+        {
+            const T aip = alpha*a(i, p);
+            const Operand bp = b.block(p, 0);
+            if(bp.columnStride == 1)
+            {
+                for(unsigned int j = 0; j < n; ++j)
+                {
+                    ci[j] += aip*bp.data[j];
+                }
+            }
+            else
+            {
+                for(unsigned int j = 0; j < n; ++j)
+                {
+                    ci[j] += aip*bp(0, j);
+                }
+            }
+        }
+        epilogue.block(i, 0).apply(ci, ldc, 1, n);
+    }
+}
+
+template<typename T>
+void Gemm<T>::multiplyVector(unsigned int m, unsigned int k, T alpha,
+                             Operand a, Operand b, T* c, unsigned int ldc, bool accumulate,
+                             const GemmEpilogue<T>& epilogue)
+{
+    if(a.columnStride != 1)
+    {
+        // Transposed A: columns of op(A) are stored rows, so c is accumulated from whole rows
+        // (an AXPY per entry of b) instead of strided dot products
+        if(!accumulate) scale(m, 1, T(0), c, ldc);
+        for(unsigned int p = 0; p < k; ++p)
+        {
+            const T factor = alpha*b(p, 0);
+            const T* ap = a.data + p*a.columnStride;
+            if constexpr(std::is_same<T, float>::value)
+            {
+                if(ldc == 1)
+                {
+                    SimdKernels::get().axpy(factor, ap, c, m);
+                    continue;
+                }
+            }
+            for(unsigned int i = 0; i < m; ++i)
+            {
+                c[i*ldc] += factor*ap[i];
+            }
+        }
+        epilogue.apply(c, ldc, m, 1);
+        return;
+    }
+
+    // Independent partial sums let the compiler keep several vector accumulators in flight
+    const unsigned int LANES = 16;
+    const unsigned int kBlocked = k - k%LANES;
+    for(unsigned int i = 0; i < m; ++i)
+    {
+        const T* ai = a.data + i*a.rowStride;
+        T partial[LANES] = {};
+        unsigned int p = 0;
+        if(b.rowStride == 1)
+        {
+            for(; p < kBlocked; p += LANES)
+            {
+                for(unsigned int l = 0; l < LANES; ++l)
+                {
+                    partial[l] += ai[p + l]*b.data[p + l];
+                }
+            }
+        }
+        T s = 0;
+        for(unsigned int l = 0; l < LANES; ++l)
+        {
+            s += partial[l];
+        }
+        for(; p < k; ++p)
+        {
+            s += ai[p]*b(p, 0);
+        }
+        c[i*ldc] = accumulate ? c[i*ldc] + alpha*s : alpha*s;
+    }
+    epilogue.apply(c, ldc, m, 1);
+}
+
+template<typename T>
+void Gemm<T>::packA(unsigned int mc, unsigned int kc, T alpha, Operand a, T* buffer)
+{
+    // Every MR-row sliver is stored column by column, padded with zeros to full MR height
+    for(unsigned int ir = 0; ir < mc; ir += MR)
+    {
+        const unsigned int mr = std::min(MR, mc - ir);
+        for(unsigned int p = 0; p < kc; ++p)
+        {
+            unsigned int i = 0;
+            for(; i < mr; ++i)
+            {
+                buffer[i] = alpha*a(ir + i, p);
+            }
+            for(; i < MR; ++i)
+            {
+                buffer[i] = 0;
+            }
+            buffer += MR;
+        }
+    }
+}
+
+template<typename T>
+void Gemm<T>::packB(unsigned int kc, unsigned int nc, Operand b, T* buffer)
+{
+    // Every NR-column sliver is stored row by row, padded with zeros to full NR width
+    for(unsigned int jr = 0; jr < nc; jr += NR)
+    {
+        const unsigned int nr = std::min(NR, nc - jr);
+        for(unsigned int p = 0; p < kc; ++p)
+        {
+            const Operand bp = b.block(p, jr);
+            unsigned int j = 0;
+            if(bp.columnStride == 1)
+            {
+                for(; j < nr; ++j)
+                {
+                    buffer[j] = bp.data[j];
+                }
+            }
+            else
+            {
+                for(; j < nr; ++j)
+                {
+                    buffer[j] = bp(0, j);
+                }
+            }
+            for(; j < NR; ++j)
+            {
+                buffer[j] = 0;
+            }
+            buffer += NR;
+        }
+    }
+}
+
+template<typename T>
+void Gemm<T>::microKernel(unsigned int kc, const T* a, const T* b,
+                          T* c, unsigned int ldc,
+                          unsigned int mr, unsigned int nr, bool accumulate)
+{
+    // A whole NR-wide row of the tile is one vector, so the accumulators stay in registers
+    typedef T Row __attribute__((vector_size(NR*sizeof(T))));
+
+    Row acc[MR] = {};
+    for(unsigned int p = 0; p < kc; ++p, a += MR, b += NR)
+    {
+        Row bp;
+        std::memcpy(&bp, b, sizeof(Row));
+        for(unsigned int i = 0; i < MR; ++i)
+        {
+            acc[i] += a[i]*bp;
+        }
+    }
+
+    for(unsigned int i = 0; i < mr; ++i)
+    {
+        T* ci = c + i*ldc;
+        if(accumulate)
+        {
+            for(unsigned int j = 0; j < nr; ++j) ci[j] += acc[i][j];
+        }
+        else
+        {
+            for(unsigned int j = 0; j < nr; ++j) ci[j] = acc[i][j];
+        }
+    }
+}
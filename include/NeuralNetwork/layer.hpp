@@ -3,48 +3,140 @@
 #include "neuralnetwork.hpp"
 
 #include <fstream>
+#include <vector>
+
+class Optimizer;
 
 class Layer
 {
 friend class NeuralNetwork;
 public:
+    // Element-wise activation of n values, out = f(in). out may alias in
+    typedef void (*ActivationKernel)(const NNDataType* in, NNDataType* out, size_t n);
+
     Layer(unsigned int nodes, unsigned int prevNodes);
 
+    // Leaves weights and biases unset, for a caller that fills them (e.g. NeuralNetwork::load)
+    Layer(unsigned int nodes, unsigned int prevNodes, MatrixUninitializedTag);
+
     // Getter for nodes_
     virtual unsigned int getNodesCount() const;
 
-    // Layer's abstract activation function
-    virtual NNDataType activationFunction(NNDataType value) const = 0;
+    // Number of values of a sample the layer reads
+    virtual unsigned int getInputNodesCount() const;
+
+    // Bytes of workspace a training step through the layer takes for a batch of samples
+    virtual size_t getWorkspaceSize(unsigned int samples) const;
+
+    void setActivationAccuracy(ActivationAccuracy accuracy);
+
+    // Kernel of the activation function, the forward pass applies it in the GEMM epilogue
+    virtual ActivationKernel getActivationKernel() const = 0;
 
-    // Derivative of layer's abstract activation function
-    virtual NNDataType activationDerivative(NNDataType value) const = 0;
+    // Batch activation function and its derivative for n values. Every pass through a layer
+    // makes a single virtual call for them, see DenseLayer. The derivative takes the weighted
+    // input z or the output a = f(z), as stated by derivativeFromOutput
+    void activate(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const = 0;
+    virtual bool derivativeFromOutput() const = 0;
 
-    // Calculates f(weights * input + bias), where f is an activation function and sets weightedInput to calculated value
-    virtual NNMatrixType feedforward(const NNMatrixType& input, NNMatrixType& weightedInput);
+    // Inputs, outputs and errors hold one sample per column, so a whole batch goes through a layer at once.
+    // Both feedforward versions are a single GEMM, which adds the bias and applies f to each tile of the product
+    // as soon as it is complete
 
-    // Calculates f(weights * input + bias), where f is an activation function
-    virtual NNMatrixType feedforward(const NNMatrixType& input) const;
+    // Calculates f(weights * input + bias), where f is an activation function and sets weightedInput to calculated value.
+    // Layers taking the derivative from the output leave weightedInput empty, backpropagation does not need it
+    virtual NNMatrixType feedforward(NNMatrixViewType input, NNMatrixType& weightedInput);
 
-    // Caclulates cost derivatives with respect to weights and biases and returns error (derivative of cost w.r.t this layer nodes) to be used in next layer
+    // Calculates f(weights * input + bias), where f is an activation function. Only f(z) is written to memory
+    virtual NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // Caclulates cost derivatives with respect to weights and biases and returns error (derivative of cost w.r.t this layer nodes) to be used in next layer.
+    // Derivatives of all samples of the batch are summed into the accumulated gradient
+    NNMatrixType backpropagate(const NNMatrixType& error,
+                               const NNMatrixType& weightedInput,
+                               const NNMatrixType& output,
+                               NNMatrixViewType prevOutput);
+
+    // Same, summing the derivatives into nablaW and nablaB (shaped like weights and biases) instead of the
+    // layer's own gradients, so threads backpropagating through the same layer at once keep separate sums
     virtual NNMatrixType backpropagate(const NNMatrixType& error,
                                        const NNMatrixType& weightedInput,
-                                       const NNMatrixType& prevOutput);
+                                       const NNMatrixType& output,
+                                       NNMatrixViewType prevOutput,
+                                       NNMatrixType& nablaW,
+                                       NNMatrixType& nablaB);
+
+    // dC/dz of an output layer computed straight from the cost, for activations whose derivative cancels
+    // with the cost's (softmax with cross-entropy). Returns false when delta has to come from backpropagate
+    virtual bool outputDelta(const CostFunctionStrategy& cost, NNMatrixViewType output, NNMatrixViewType target,
+                             NNMatrixType& delta) const;
+
+    // Moves weights and biases by the accumulated gradients as the optimizer prescribes, which clears the gradients
+    void applyGradients(const Optimizer& optimizer, float learningRate);
+
+    // Same with gradients accumulated outside of the layer, see backpropagate
+    void applyGradients(const Optimizer& optimizer, float learningRate, NNMatrixType& nablaW, NNMatrixType& nablaB);
 
-    // Nudges weights and biases in direction of steepest descent
-    virtual void performSDGStep(float learingRate);
+    // Same while other threads update the same weights, see Optimizer::updateShared
+    void applySharedGradients(const Optimizer& optimizer, float learningRate, NNMatrixType& nablaW, NNMatrixType& nablaB);
+
+    // Gradient accumulators are training state, a layer that only runs feedforward never creates them.
+    // Allocates them zeroed when they do not exist yet; NeuralNetwork::train calls it before the first
+    // batch, outside of the step arena. Backpropagation throws without them
+    void allocateGradients();
+    bool hasGradients() const;
+
+    // Moments of the optimizer, count matrices per parameter matrix. Allocated zeroed when there is
+    // not that many yet, released when the network switches optimizers
+    void allocateOptimizerState(unsigned int count);
+    void releaseOptimizerState();
+    unsigned int getOptimizerStateCount() const;
 
     virtual void serialize(std::ofstream& ofile) const = 0;
 protected:
+    // Layers whose weights are not nodes x prevNodes, e.g. shared convolution filters.
+    // Weights and biases are left unset, see initializeParameters
+    Layer(unsigned int nodes, unsigned int weightRows, unsigned int weightColumns, MatrixUninitializedTag);
+
+    // Random weights and zero biases. fans is fan-in + fan-out of a weight, which sets the range of the values
+    void initializeParameters(unsigned int fans);
+
+    // Throws when backpropagation would accumulate into gradients that do not match weights and biases
+    // (e.g. were never allocated)
+    void requireGradients(const NNMatrixType& nablaW, const NNMatrixType& nablaB) const;
+
     // Return weights * input + bias. This value needs to be calculated in all layer types so this function is shared
-    virtual NNMatrixType calculateWeightedInput(const NNMatrixType& input) const;
+    NNMatrixType calculateWeightedInput(NNMatrixViewType input) const;
+
+    // Accumulates the gradients for given dC/dz into nablaW and nablaB and returns dC/da of the previous layer
+    virtual NNMatrixType propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                        NNMatrixType& nablaW, NNMatrixType& nablaB);
 
     virtual void serializeMatricies(std::ofstream& ofile) const;
 
+    // Reads the entries written by serializeMatricies (after the sizes) straight into weights and biases,
+    // which already have the sizes stored in the file
+    void deserializeMatricies(std::ifstream& ifile);
+
+    // Number of moment matrices per parameter followed by the moments, packed like the weights.
+    // Reading needs the moments allocated (allocateOptimizerState) with the count found in the file
+    void serializeOptimizerState(std::ofstream& ofile) const;
+    void deserializeOptimizerState(std::ifstream& ifile);
+
+    // Rows of m are stored without their padding
+    static void writePacked(std::ofstream& ofile, const NNMatrixType& m);
+    static void readPacked(std::ifstream& ifile, NNMatrixType& m);
+
     unsigned int nodes_;
+    ActivationAccuracy accuracy_;
     
     NNMatrixType weights_;
     NNMatrixType bias_;
 
-    NNMatrixType nablaW_;   // Accumulated cost derivative w.r.t weights
-    NNMatrixType nablaB_;   // Accumulated cost derivative w.r.t biases
+    NNMatrixType nablaW_;   // Accumulated cost derivative w.r.t weights, empty until allocateGradients
+    NNMatrixType nablaB_;   // Accumulated cost derivative w.r.t biases, empty until allocateGradients
+
+    std::vector<NNMatrixType> weightMoments_;   // Optimizer state of the weights
+    std::vector<NNMatrixType> biasMoments_;     // Optimizer state of the biases
 };
\ No newline at end of file
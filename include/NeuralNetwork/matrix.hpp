@@ -1,77 +1,155 @@
 #pragma once
 
-#include <chrono>
-#include <functional>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
-#include <random>
 #include <sstream>
 #include <type_traits>
 
-template<typename T>
-class Matrix
+#include "alignedAllocator.hpp"
+#include "gemm.hpp"
+#include "matrixExpression.hpp"
+#include "matrixView.hpp"
+#include "randomGenerator.hpp"
+#include "simdKernels.hpp"
+#include "threadPool.hpp"
+
+// Tags for Matrix(rows, columns, tag) constructors. Entries of an uninitialized matrix are left
+// as they come from the allocator, which is meant for matrices that are about to be overwritten
+struct MatrixUninitializedTag {};
+struct MatrixZerosTag {};
+inline constexpr MatrixUninitializedTag uninitialized{};
+inline constexpr MatrixZerosTag zeros{};
+
+// Row-major matrix of arithmetic values, storage comes from Alloc (64-byte aligned by default;
+// arena, pool or huge-page allocators plug in here). Rows that span at least one alignment unit
+// are padded so that each of them starts on an aligned address; getLeadingDimension() is the
+// distance between the starts of consecutive rows and depends only on the number of columns.
+// Shorter rows, including every column vector, stay packed.
+template<typename T, typename Alloc = AlignedAllocator<T>>
+class Matrix : public MatrixExpression<T, Matrix<T, Alloc>>
 {
 public:
     typedef T* iterator;
     typedef const T* const_iterator;
+    typedef Alloc allocator_type;
 
+    // Alignment rows are padded to, in bytes
+    static constexpr unsigned int ROW_ALIGNMENT = 64;
+
+    // Sets all entries to one
     Matrix(unsigned int rows, unsigned int columns);
+    Matrix(unsigned int rows, unsigned int columns, MatrixUninitializedTag);
+    Matrix(unsigned int rows, unsigned int columns, MatrixZerosTag);
     explicit Matrix(): Matrix(1, 1) {}
     Matrix(const T* data, unsigned int rows, unsigned int columns);
-    Matrix(const Matrix& o): Matrix(o.data_.get(), o.rows_, o.columns_) {}
+    Matrix(const Matrix& o);
     Matrix(Matrix&& o);
 
+    // Copies the entries seen through a view into a new, contiguous matrix
+    explicit Matrix(MatrixView<const T> view);
+
+    // Evaluates an element-wise expression in a single pass
+    template<typename E>
+    Matrix(const MatrixExpression<T, E>& e);
+
+    // Iterate over the storage, padding included
     const_iterator cbegin() const { return data_.get(); }
     const_iterator cend() const { return data_ .get() + len_; }
     
     iterator begin() { return data_.get(); }
     iterator end() { return data_.get() + len_; }
 
+    // Non-owning views of the whole matrix
+    MatrixView<const T> view() const { return MatrixView<const T>(data_.get(), rows_, columns_, ld_); }
+    MatrixView<T> view() { return MatrixView<T>(data_.get(), rows_, columns_, ld_); }
+    operator MatrixView<const T>() const { return view(); }
+    operator MatrixView<T>() { return view(); }
+
     unsigned int getRows() const;
     unsigned int getColumns() const;
+    unsigned int getLeadingDimension() const;
+    // Number of stored entries, rows*leading dimension
+    unsigned int getStorageSize() const;
     const T* getData() const;
     T get(unsigned int i, unsigned int j) const;
 
+    // Leading dimension used for matrices with given number of columns
+    static unsigned int leadingDimensionFor(unsigned int columns);
+
+    // Element-wise operations on large matrices are split between the threads of the ThreadPool
+
     // Sets all values to zero
     void zero();
 
-    // Sets values to random in range [min, max)
-    void randomize(T min, T max);
+    // Sets values to random in range [min, max) for floating point types and [min, max] for integers.
+    // Entry k takes output k of the stream, so the result depends only on the stream, never on
+    // how the work is split
+    void randomize(T min, T max, const Philox& stream);
 
-    // Apply function to every matrix entry
-    Matrix map(std::function<T(T)> const& f) const;
+    // Apply function to every matrix entry. f is called directly, so it can be inlined
+    template<typename F>
+    Matrix map(F&& f) const;
+
+    // Sets NaN and infinite entries to zero
+    Matrix& sanitize();
     T sum() const;
 
-    // Element-wise multiplication
-    Matrix hadamard(const Matrix& o) const;
-    Matrix static transpose(const Matrix& m);
+    // Cache-blocked transpose, float matrices use the SIMD kernels
+    Matrix static transpose(MatrixView<const T> m);
+
+    // Square matrices are transposed in place, block pair by block pair. Other shapes get new
+    // storage, since rows and leading dimension change
+    Matrix& transposeInPlace();
+
+    // Expression interface, lets matrices with a different allocator be assigned and accumulated
+    void evaluateTo(T* out) const;
+    void accumulateTo(T* out, T factor) const;
 
     Matrix& operator=(const Matrix& o);
     Matrix& operator=(Matrix&& o);
-    Matrix operator+(const Matrix& o) const;
-    Matrix& operator+=(const Matrix& o);
-    Matrix operator-(const Matrix& o) const;
-    Matrix& operator-=(const Matrix& o);
-    Matrix operator*(T f) const;
+    template<typename E>
+    Matrix& operator=(const MatrixExpression<T, E>& e);
+
+    // a += b and a -= f*b are computed in place, without temporaries
+    template<typename E>
+    Matrix& operator+=(const MatrixExpression<T, E>& e);
+    template<typename E>
+    Matrix& operator-=(const MatrixExpression<T, E>& e);
     Matrix& operator*=(T f);
 
-    Matrix operator*(const Matrix& o) const;
-
+    // Matrix product, computed eagerly by the blocked GEMM engine
+    Matrix operator*(MatrixView<const T> o) const;
+
+    // BLAS-style routines updating their last argument in place, without temporaries.
+    // C = alpha * op(A) * op(B) + beta * C; with beta zero C is only written.
+    // The epilogue (bias, activation) is applied to each tile of C as soon as it is complete
+    static void gemm(T alpha, MatrixView<const T> a, MatrixOp opA,
+                     MatrixView<const T> b, MatrixOp opB,
+                     T beta, MatrixView<T> c,
+                     const GemmEpilogue<T>& epilogue = GemmEpilogue<T>());
+    // y = alpha * op(A) * x + beta * y, where x and y are column vectors
+    static void gemv(T alpha, MatrixView<const T> a, MatrixOp opA,
+                     MatrixView<const T> x,
+                     T beta, MatrixView<T> y);
+    // A += alpha * x * y^T (rank-1 update), where x and y are column vectors
+    static void ger(T alpha, MatrixView<const T> x, MatrixView<const T> y, MatrixView<T> a);
+    // Y += alpha * X
+    static void axpy(T alpha, MatrixView<const T> x, MatrixView<T> y);
+
+    // Storage index, entry (i, j) is at i*getLeadingDimension() + j
     const T& operator[](int index) const { return data_[index]; }
     T& operator[](int index) { return data_[index]; }
 
-    friend Matrix operator*(T f, const Matrix& m)
-    {
-        return m*f;
-    }
     friend std::ostream& operator<<(std::ostream& os, const Matrix& m)
     {
-        for(unsigned int i = 0, k = 0; i < m.rows_; ++i)
+        for(unsigned int i = 0; i < m.rows_; ++i)
         {
             os << "[";
-            for(unsigned int j = 0; j < m.columns_; ++j, ++k)
+            for(unsigned int j = 0; j < m.columns_; ++j)
             {
-                os << m.data_[k];
+                os << m.data_[m.at(i, j)];
                 if(j + 1 < m.columns_) os << "\t";
             }
             os << "]";
@@ -80,77 +158,193 @@ public:
         return os;
     }
 private:
+    // Returns storage to the allocator it came from
+    struct Deleter
+    {
+        Alloc alloc;
+        unsigned int len;
+
+        void operator()(T* p) { std::allocator_traits<Alloc>::deallocate(alloc, p, len); }
+    };
+
     unsigned int rows_;
     unsigned int columns_;
+    unsigned int ld_;
     unsigned int len_;
-    std::mt19937 generator_;
-    std::unique_ptr<T[]> data_;
+    std::unique_ptr<T[], Deleter> data_;
 
     unsigned int at(unsigned int i, unsigned int j) const
     {
-        return i*columns_ + j;
+        return i*ld_ + j;
     }
-};
 
-template<typename T>
-Matrix<T>::Matrix(unsigned int rows, unsigned int columns): rows_(rows), columns_(columns)
-{
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    generator_ = std::mt19937(seed);
+    bool isPadded() const
+    {
+        return ld_ != columns_ && rows_ > 0;
+    }
+
+    // Allocates storage for a rows x columns matrix, only the padding is initialized
+    void allocate(unsigned int rows, unsigned int columns);
+
+    // y[0..n) += alpha * x[0..n)
+    static void axpy(T alpha, const T* x, T* y, unsigned int n);
+
+    // out = in^T, where in is rows x columns and does not overlap out
+    static void transpose(const T* in, unsigned int ldIn, T* out, unsigned int ldOut,
+                          unsigned int rows, unsigned int columns);
+
+    // Side of square blocks transposed at once, a pair of them fits in L1
+    static constexpr unsigned int TRANSPOSE_BLOCK = 64;
+
+    template<typename E>
+    void checkSize(const MatrixExpression<T, E>& e, const char* error) const
+    {
+        if(e.derived().getRows() != rows_ || e.derived().getColumns() != columns_)
+        {
+            throw std::runtime_error(error);
+        }
+    }
+
+    // float matrices are processed by the SIMD kernels picked for this CPU
+    static constexpr bool USE_SIMD_KERNELS = std::is_same<T, float>::value;
+};
 
-    len_ = rows*columns;
-    data_ = std::make_unique<T[]>(len_);
 
-    for(unsigned int i = 0; i < len_; ++i)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(unsigned int rows, unsigned int columns): Matrix(rows, columns, uninitialized)
+{
+    // the padding keeps the zeros allocate wrote
+    for(unsigned int i = 0; i < rows_; ++i)
     {
-        data_[i] = 1;
+        std::fill(data_.get() + at(i, 0), data_.get() + at(i, columns_), T(1));
     }
 }
 
-template<typename T>
-Matrix<T>::Matrix(const T* data, unsigned int rows, unsigned int columns): rows_(rows), columns_(columns)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(unsigned int rows, unsigned int columns, MatrixUninitializedTag)
+{
+    allocate(rows, columns);
+}
+
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(unsigned int rows, unsigned int columns, MatrixZerosTag): Matrix(rows, columns, uninitialized)
 {
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    generator_ = std::mt19937(seed);
+    zero();
+}
 
-    len_ = rows*columns;
-    data_ = std::make_unique<T[]>(len_);
-    for(unsigned int i = 0; i < len_; ++i)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(const T* data, unsigned int rows, unsigned int columns): Matrix(rows, columns, uninitialized)
+{
+    // data is packed, rows of this matrix may be padded
+    for(unsigned int i = 0; i < rows_; ++i)
     {
-        data_[i] = data[i];
+        std::copy(data + i*columns_, data + (i + 1)*columns_, data_.get() + at(i, 0));
     }
 }
 
-template<typename T>
-Matrix<T>::Matrix(Matrix&& o)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(const Matrix& o): Matrix(o.rows_, o.columns_, uninitialized)
+{
+    std::copy(o.data_.get(), o.data_.get() + len_, data_.get());
+}
+
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(Matrix&& o)
 {
     data_ = std::move(o.data_);
     rows_ = o.rows_;
     columns_ = o.columns_;
+    ld_ = o.ld_;
     len_ = o.len_;
-    generator_ = std::move(o.generator_);
+    o.rows_ = o.columns_ = o.ld_ = o.len_ = 0;
+}
+
+template<typename T, typename Alloc>
+Matrix<T, Alloc>::Matrix(MatrixView<const T> view): Matrix(view.getRows(), view.getColumns(), uninitialized)
+{
+    for(unsigned int i = 0; i < rows_; ++i)
+    {
+        std::copy(view.getData() + i*view.getLeadingDimension(),
+                  view.getData() + i*view.getLeadingDimension() + columns_,
+                  data_.get() + at(i, 0));
+    }
 }
 
-template<typename T>
-unsigned int Matrix<T>::getRows() const
+template<typename T, typename Alloc>
+template<typename E>
+Matrix<T, Alloc>::Matrix(const MatrixExpression<T, E>& e): Matrix(e.derived().getRows(), e.derived().getColumns(), uninitialized)
+{
+    e.derived().evaluateTo(data_.get());
+}
+
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::allocate(unsigned int rows, unsigned int columns)
+{
+    rows_ = rows;
+    columns_ = columns;
+    ld_ = leadingDimensionFor(columns);
+    len_ = rows*ld_;
+
+    // a matrix keeps the allocator it was created with, so one made outside of an ArenaScope keeps
+    // heap storage when it is resized inside one, instead of moving into the arena and dangling
+    Alloc alloc = data_.get_deleter().alloc;
+    // entries are arithmetic values, so the storage is used without constructing them
+    T* data = len_ > 0 ? std::allocator_traits<Alloc>::allocate(alloc, len_) : nullptr;
+    data_ = std::unique_ptr<T[], Deleter>(data, Deleter{alloc, len_});
+
+    // padding never holds NaNs or denormals that could slow down whole-storage kernels
+    if(isPadded())
+    {
+        for(unsigned int i = 0; i < rows_; ++i)
+        {
+            std::fill(data + at(i, columns_), data + at(i, ld_), T(0));
+        }
+    }
+}
+
+template<typename T, typename Alloc>
+unsigned int Matrix<T, Alloc>::leadingDimensionFor(unsigned int columns)
+{
+    const unsigned int perLine = ROW_ALIGNMENT/sizeof(T);
+    if(perLine <= 1 || columns < perLine)
+    {
+        return columns;
+    }
+    return (columns + perLine - 1)/perLine*perLine;
+}
+
+template<typename T, typename Alloc>
+unsigned int Matrix<T, Alloc>::getRows() const
 {
     return rows_;
 }
 
-template<typename T>
-unsigned int Matrix<T>::getColumns() const
+template<typename T, typename Alloc>
+unsigned int Matrix<T, Alloc>::getColumns() const
 {
     return columns_;
 }
 
-template<typename T>
-const T* Matrix<T>::getData() const
+template<typename T, typename Alloc>
+unsigned int Matrix<T, Alloc>::getLeadingDimension() const
+{
+    return ld_;
+}
+
+template<typename T, typename Alloc>
+unsigned int Matrix<T, Alloc>::getStorageSize() const
+{
+    return len_;
+}
+
+template<typename T, typename Alloc>
+const T* Matrix<T, Alloc>::getData() const
 {
     return data_.get();
 }
 
-template<typename T>
-T Matrix<T>::get(unsigned int i, unsigned int j) const
+template<typename T, typename Alloc>
+T Matrix<T, Alloc>::get(unsigned int i, unsigned int j) const
 {
     if(i < 0 || i >= rows_ || j < 0 || j >= columns_)
     {
@@ -161,226 +355,428 @@ T Matrix<T>::get(unsigned int i, unsigned int j) const
     return data_[at(i, j)];
 }
 
-template<typename T>
-void Matrix<T>::zero()
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::zero()
 {
-    for(unsigned int i = 0; i < len_; ++i)
+    ThreadPool::parallelRanges(len_, [&](size_t begin, size_t end)
     {
-        data_[i] = 0;
-    }
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            SimdKernels::get().fill(data_.get() + begin, 0.0f, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            data_[i] = 0;
+        }
+    });
 }
 
-template<typename T>
-void Matrix<T>::randomize(T min, T max)
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::randomize(T min, T max, const Philox& stream)
 {
-    if constexpr(std::is_integral<T>::value)
+    // k counts entries row by row without padding, so padding does not change the values
+    const unsigned int entries = rows_*columns_;
+    for(unsigned int k = 0; k < entries; k += 4)
     {
-        std::uniform_int_distribution<T> distribution(min, max);
-        for(unsigned int i = 0; i < len_; ++i)
+        const auto bits = stream.block(k/4);
+        for(unsigned int j = 0; j < 4 && k + j < entries; ++j)
         {
-            data_[i] = distribution(generator_);
+            T& entry = data_[isPadded() ? at((k + j)/columns_, (k + j)%columns_) : k + j];
+            if constexpr(std::is_integral<T>::value)
+            {
+                // maps 32 random bits onto the range with a multiply instead of a modulo
+                const uint64_t range = (uint64_t)((int64_t)max - (int64_t)min) + 1;
+                entry = (T)((int64_t)min + (int64_t)((bits[j]*range) >> 32));
+            }
+            else if constexpr(std::is_floating_point<T>::value)
+            {
+                // 24 random bits give every float in [0, 1) that is a multiple of 2^-24
+                const T unit = (T)(bits[j] >> 8) * (T)(1.0/16777216.0);
+                entry = min + unit*(max - min);
+            }
         }
     }
-    else if constexpr(std::is_floating_point<T>::value)
+}
+
+template<typename T, typename Alloc>
+template<typename F>
+Matrix<T, Alloc> Matrix<T, Alloc>::map(F&& f) const
+{
+    // only logical entries, the padding allocate zeroed stays zero whatever f(0) is
+    Matrix result(rows_, columns_, uninitialized);
+    for(unsigned int i = 0; i < rows_; ++i)
     {
-        std::uniform_real_distribution<T> distribution(min, max);
-        for(unsigned int i = 0; i < len_; ++i)
+        for(unsigned int j = 0; j < columns_; ++j)
         {
-            data_[i] = distribution(generator_);
+            result.data_[at(i, j)] = f(data_[at(i, j)]);
         }
     }
+    return result;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::map(std::function<T(T)> const& f) const
+template<typename T, typename Alloc>
+Matrix<T, Alloc>& Matrix<T, Alloc>::sanitize()
 {
-    Matrix result(rows_, columns_);
-    for(unsigned int i = 0; i < len_; ++i)
+    ThreadPool::parallelRanges(len_, [&](size_t begin, size_t end)
     {
-        result.data_[i] = f(data_[i]);
-        if(std::isinf(result.data_[i]) || std::isnan(result.data_[i]))
+        if constexpr(USE_SIMD_KERNELS)
         {
-            result.data_[i] = 0;
+            SimdKernels::get().replaceNonFinite(data_.get() + begin, end - begin);
+            return;
         }
-    }
-    return result;
+        for(size_t i = begin; i < end; ++i)
+        {
+            if(std::isinf(data_[i]) || std::isnan(data_[i]))
+            {
+                data_[i] = 0;
+            }
+        }
+    });
+    return *this;
 }
 
-template<typename T>
-T Matrix<T>::sum() const
+template<typename T, typename Alloc>
+T Matrix<T, Alloc>::sum() const
 {
+    if constexpr(USE_SIMD_KERNELS)
+    {
+        if(!isPadded())
+        {
+            return SimdKernels::get().sum(data_.get(), len_);
+        }
+        T sum = 0;
+        for(unsigned int i = 0; i < rows_; ++i)
+        {
+            sum += SimdKernels::get().sum(data_.get() + at(i, 0), columns_);
+        }
+        return sum;
+    }
     T sum = 0;
-    for(unsigned int i = 0; i < len_; ++i)
+    for(unsigned int i = 0; i < rows_; ++i)
     {
-        sum += data_[i];
+        for(unsigned int j = 0; j < columns_; ++j)
+        {
+            sum += data_[at(i, j)];
+        }
     }
     return sum;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::hadamard(const Matrix<T>& o) const
+template<typename T, typename Alloc>
+Matrix<T, Alloc> Matrix<T, Alloc>::transpose(MatrixView<const T> m)
+{
+    // inverted on purpose
+    Matrix result(m.getColumns(), m.getRows(), uninitialized);
+    transpose(m.getData(), m.getLeadingDimension(), result.data_.get(), result.ld_, m.getRows(), m.getColumns());
+    return result;
+}
+
+template<typename T, typename Alloc>
+Matrix<T, Alloc>& Matrix<T, Alloc>::transposeInPlace()
 {
-    if(o.rows_ != rows_ || o.columns_ != columns_)
+    if(rows_ != columns_)
     {
-        throw std::runtime_error("ERROR: Cannot perform hadamard product on matrices with different sizes!\n");
+        *this = transpose(view());
+        return *this;
     }
-    Matrix result(rows_, columns_);
-    for(unsigned int i = 0; i < len_; ++i)
+
+    // Blocks (I, J) and (J, I) are exchanged through a buffer holding one of them,
+    // diagonal blocks are transposed through the buffer alone
+    T buffer[TRANSPOSE_BLOCK*TRANSPOSE_BLOCK];
+    for(unsigned int ib = 0; ib < rows_; ib += TRANSPOSE_BLOCK)
     {
-        result.data_[i] = data_[i]*o.data_[i];
+        const unsigned int bi = std::min(TRANSPOSE_BLOCK, rows_ - ib);
+        for(unsigned int jb = ib; jb < columns_; jb += TRANSPOSE_BLOCK)
+        {
+            const unsigned int bj = std::min(TRANSPOSE_BLOCK, columns_ - jb);
+            T* upper = data_.get() + at(ib, jb);
+            T* lower = data_.get() + at(jb, ib);
+
+            // buffer = upper^T (bj x bi)
+            transpose(upper, ld_, buffer, TRANSPOSE_BLOCK, bi, bj);
+            if(jb != ib)
+            {
+                // upper = lower^T
+                transpose(lower, ld_, upper, ld_, bj, bi);
+            }
+            for(unsigned int r = 0; r < bj; ++r)
+            {
+                std::copy(buffer + r*TRANSPOSE_BLOCK, buffer + r*TRANSPOSE_BLOCK + bi, lower + r*ld_);
+            }
+        }
     }
-    return result;
+    return *this;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::transpose(const Matrix<T>& m)
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::transpose(const T* in, unsigned int ldIn, T* out, unsigned int ldOut,
+                                 unsigned int rows, unsigned int columns)
 {
-    // inverted on purpose
-    Matrix result(m.columns_, m.rows_);
-    for(unsigned int i = 0; i < m.columns_; ++i)
+    if constexpr(USE_SIMD_KERNELS)
+    {
+        SimdKernels::get().transpose(in, ldIn, out, ldOut, rows, columns);
+        return;
+    }
+    for(unsigned int ib = 0; ib < rows; ib += TRANSPOSE_BLOCK)
     {
-        for(unsigned int j = 0; j < m.rows_; ++j)
+        for(unsigned int jb = 0; jb < columns; jb += TRANSPOSE_BLOCK)
         {
-            result.data_[result.at(i, j)] = m.data_[m.at(j, i)]; // here also
+            const unsigned int ie = std::min(ib + TRANSPOSE_BLOCK, rows);
+            const unsigned int je = std::min(jb + TRANSPOSE_BLOCK, columns);
+            for(unsigned int i = ib; i < ie; ++i)
+            {
+                for(unsigned int j = jb; j < je; ++j)
+                {
+                    out[j*ldOut + i] = in[i*ldIn + j];
+                }
+            }
         }
     }
-    return result;
 }
 
-template<typename T>
-Matrix<T>& Matrix<T>::operator=(const Matrix& o)
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::evaluateTo(T* out) const
+{
+    std::copy(data_.get(), data_.get() + len_, out);
+}
+
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::accumulateTo(T* out, T factor) const
+{
+    axpy(factor, data_.get(), out, len_);
+}
+
+template<typename T, typename Alloc>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator=(const Matrix& o)
 {
     if(&o != this)
     {
         if(len_ != o.len_)
-            data_ = std::make_unique<T[]>(len_);
+            allocate(o.rows_, o.columns_);
         
         rows_ = o.rows_;
         columns_ = o.columns_;
-        len_ = o.len_;
+        ld_ = o.ld_;
 
-        for(unsigned int i = 0; i < len_; ++i)
-        {
-            data_[i] = o.data_[i];
-        }
+        std::copy(o.data_.get(), o.data_.get() + len_, data_.get());
     }
     
     return *this;
 }
 
-template<typename T>
-Matrix<T>& Matrix<T>::operator=(Matrix&& o)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator=(Matrix&& o)
 {
+    // storage only changes hands between matrices of the same allocator, see allocate
+    if(data_.get_deleter().alloc != o.data_.get_deleter().alloc)
+    {
+        return *this = static_cast<const Matrix&>(o);
+    }
     if(&o != this)
     {
         data_ = std::move(o.data_);
         rows_ = o.rows_;
         columns_ = o.columns_;
+        ld_ = o.ld_;
         len_ = o.len_;
-        generator_ = std::move(o.generator_);
+        o.rows_ = o.columns_ = o.ld_ = o.len_ = 0;
     }
     return *this;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::operator+(const Matrix& o) const
+template<typename T, typename Alloc>
+template<typename E>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator=(const MatrixExpression<T, E>& e)
 {
-    if(o.rows_ != rows_ || o.columns_ != columns_)
+    const E& expression = e.derived();
+    if(expression.getRows()*expression.getLeadingDimension() != len_)
     {
-        throw std::runtime_error("ERROR: Cannot perform addition of matrices with different sizes!\n");
+        *this = Matrix(expression);
+        return *this;
     }
-    Matrix result(rows_, columns_);
-    for(unsigned int i = 0; i < len_; ++i)
-    {
-        result.data_[i] = data_[i] + o.data_[i];
-    }
-    return result;
+    rows_ = expression.getRows();
+    columns_ = expression.getColumns();
+    ld_ = expression.getLeadingDimension();
+    expression.evaluateTo(data_.get());
+    return *this;
 }
 
-template<typename T>
-Matrix<T>& Matrix<T>::operator+=(const Matrix& o)
+template<typename T, typename Alloc>
+template<typename E>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator+=(const MatrixExpression<T, E>& e)
 {
-    if(o.rows_ != rows_ || o.columns_ != columns_)
+    checkSize(e, "ERROR: Cannot perform addition of matrices with different sizes!\n");
+    if constexpr(std::is_same<E, Matrix>::value)
     {
-        throw std::runtime_error("ERROR: Cannot perform addition of matrices with different sizes!\n");
+        const Matrix& o = e.derived();
+        ThreadPool::parallelRanges(len_, [&](size_t begin, size_t end)
+        {
+            if constexpr(USE_SIMD_KERNELS)
+            {
+                SimdKernels::get().add(data_.get() + begin, o.data_.get() + begin, data_.get() + begin, end - begin);
+                return;
+            }
+            for(size_t i = begin; i < end; ++i)
+            {
+                data_[i] += o.data_[i];
+            }
+        });
     }
-    for(unsigned int i = 0; i < len_; ++i)
+    else
     {
-        data_[i] += o.data_[i];
+        e.derived().accumulateTo(data_.get(), T(1));
     }
     return *this;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::operator-(const Matrix& o) const
+template<typename T, typename Alloc>
+template<typename E>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator-=(const MatrixExpression<T, E>& e)
 {
-    if(o.rows_ != rows_ || o.columns_ != columns_)
+    checkSize(e, "ERROR: Cannot perform subtraction of matrices with different sizes!\n");
+    if constexpr(std::is_same<E, Matrix>::value)
     {
-        throw std::runtime_error("ERROR: Cannot perform subtraction of matrices with different sizes!\n");
+        const Matrix& o = e.derived();
+        ThreadPool::parallelRanges(len_, [&](size_t begin, size_t end)
+        {
+            if constexpr(USE_SIMD_KERNELS)
+            {
+                SimdKernels::get().subtract(data_.get() + begin, o.data_.get() + begin, data_.get() + begin, end - begin);
+                return;
+            }
+            for(size_t i = begin; i < end; ++i)
+            {
+                data_[i] -= o.data_[i];
+            }
+        });
     }
-    Matrix result(rows_, columns_);
-    for(unsigned int i = 0; i < len_; ++i)
+    else
     {
-        result.data_[i] = data_[i] - o.data_[i];
+        e.derived().accumulateTo(data_.get(), T(-1));
     }
-    return result;
+    return *this;
 }
 
-template<typename T>
-Matrix<T>& Matrix<T>::operator-=(const Matrix& o)
+template<typename T, typename Alloc>
+Matrix<T, Alloc>& Matrix<T, Alloc>::operator*=(T f)
 {
-    if(o.rows_ != rows_ || o.columns_ != columns_)
+    ThreadPool::parallelRanges(len_, [&](size_t begin, size_t end)
     {
-        throw std::runtime_error("ERROR: Cannot perform addition of matrices with different sizes!\n");
-    }
-    for(unsigned int i = 0; i < len_; ++i)
-    {
-        data_[i] -= o.data_[i];
-    }
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            SimdKernels::get().scale(data_.get() + begin, f, data_.get() + begin, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            data_[i] *= f;
+        }
+    });
     return *this;
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::operator*(T f) const
+template<typename T, typename Alloc>
+Matrix<T, Alloc> Matrix<T, Alloc>::operator*(MatrixView<const T> o) const
 {
-    Matrix result(rows_, columns_);
-    for(unsigned int i = 0; i < len_; ++i)
+    if(columns_ != o.getRows())
     {
-        result.data_[i] = data_[i]*f;
+        throw std::runtime_error("ERROR: Inappropriate sizes of matrices to perform multiplication!\n");
     }
+    Matrix result(rows_, o.getColumns(), uninitialized);
+    Gemm<T>::multiply(rows_, o.getColumns(), columns_,
+                      data_.get(), ld_,
+                      o.getData(), o.getLeadingDimension(),
+                      result.data_.get(), result.ld_);
     return result;
 }
 
-template<typename T>
-Matrix<T>& Matrix<T>::operator*=(T f)
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::gemm(T alpha, MatrixView<const T> a, MatrixOp opA,
+                            MatrixView<const T> b, MatrixOp opB,
+                            T beta, MatrixView<T> c,
+                            const GemmEpilogue<T>& epilogue)
 {
-    for(unsigned int i = 0; i < len_; ++i)
+    const unsigned int m = opA == MatrixOp::Normal ? a.getRows() : a.getColumns();
+    const unsigned int k = opA == MatrixOp::Normal ? a.getColumns() : a.getRows();
+    const unsigned int kb = opB == MatrixOp::Normal ? b.getRows() : b.getColumns();
+    const unsigned int n = opB == MatrixOp::Normal ? b.getColumns() : b.getRows();
+    if(k != kb || c.getRows() != m || c.getColumns() != n)
     {
-        data_[i] *= f;
+        throw std::runtime_error("ERROR: Inappropriate sizes of matrices to perform multiplication!\n");
     }
-    return *this;
+    Gemm<T>::multiply(m, n, k, alpha,
+                      a.getData(), a.getLeadingDimension(), opA,
+                      b.getData(), b.getLeadingDimension(), opB,
+                      beta, c.getData(), c.getLeadingDimension(), epilogue);
 }
 
-template<typename T>
-Matrix<T> Matrix<T>::operator*(const Matrix& o) const
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::gemv(T alpha, MatrixView<const T> a, MatrixOp opA,
+                            MatrixView<const T> x,
+                            T beta, MatrixView<T> y)
 {
-    if(columns_ != o.rows_)
+    if(x.getColumns() != 1 || y.getColumns() != 1)
     {
-        throw std::runtime_error("ERROR: Inappropriate sizes of matrices to perform multiplication!\n");
+        throw std::runtime_error("ERROR: Matrix-vector product needs column vectors!\n");
     }
-    Matrix result(rows_, o.columns_);
-    T s;
-    for(unsigned int i = 0; i < rows_; ++i)
+    gemm(alpha, a, opA, x, MatrixOp::Normal, beta, y);
+}
+
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::ger(T alpha, MatrixView<const T> x, MatrixView<const T> y, MatrixView<T> a)
+{
+    if(x.getColumns() != 1 || y.getColumns() != 1 || a.getRows() != x.getRows() || a.getColumns() != y.getRows())
+    {
+        throw std::runtime_error("ERROR: Inappropriate sizes of matrices to perform rank-1 update!\n");
+    }
+    for(unsigned int i = 0; i < a.getRows(); ++i)
     {
-        for(unsigned int j = 0; j < o.columns_; ++j)
+        const T factor = alpha*x(i, 0);
+        T* ai = &a(i, 0);
+        if(y.getLeadingDimension() == 1 || y.getRows() <= 1)
         {
-            s = 0;
-            for(unsigned int r = 0; r < columns_; ++r)
-            {
-                s += data_[at(i, r)]*o.data_[o.at(r, j)];
-            }
-            result.data_[result.at(i, j)] = s;
+            axpy(factor, y.getData(), ai, a.getColumns());
+            continue;
+        }
+        for(unsigned int j = 0; j < a.getColumns(); ++j)
+        {
+            ai[j] += factor*y(j, 0);
         }
     }
-    return result;
+}
+
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::axpy(T alpha, MatrixView<const T> x, MatrixView<T> y)
+{
+    if(x.getRows() != y.getRows() || x.getColumns() != y.getColumns())
+    {
+        throw std::runtime_error("ERROR: Cannot perform addition of matrices with different sizes!\n");
+    }
+    if(x.isContiguous() && y.isContiguous())
+    {
+        axpy(alpha, x.getData(), y.getData(), x.getRows()*x.getColumns());
+        return;
+    }
+    for(unsigned int i = 0; i < x.getRows(); ++i)
+    {
+        axpy(alpha, &x(i, 0), &y(i, 0), x.getColumns());
+    }
+}
+
+template<typename T, typename Alloc>
+void Matrix<T, Alloc>::axpy(T alpha, const T* x, T* y, unsigned int n)
+{
+    ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+    {
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            SimdKernels::get().axpy(alpha, x + begin, y + begin, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            y[i] += alpha*x[i];
+        }
+    });
 }
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "simdKernels.hpp"
+#include "threadPool.hpp"
+
+// Expression templates for element-wise Matrix arithmetic. Operators such as a + b, a - b,
+// a.hadamard(b) and a * f do not compute anything, they return lightweight nodes describing
+// the operation. The whole expression is evaluated in a single pass when it is assigned to
+// (or accumulated into) a Matrix, so compound expressions create no intermediate matrices.
+//
+// Operands that are named matrices are held by reference, temporaries are moved into the node,
+// so an expression stays valid for as long as the named matrices it refers to.
+//
+// Indices passed to operator[] address storage, padding included. Matrices of the same size
+// always share the same leading dimension, so operands line up entry by entry and a whole
+// expression is evaluated over getRows()*getLeadingDimension() entries, split between the threads
+// of the ThreadPool when there are enough of them.
+
+template<typename T, typename Alloc>
+class Matrix;
+
+// Base class of every expression, including Matrix itself
+template<typename T, typename E>
+class MatrixExpression
+{
+public:
+    typedef T value_type;
+
+    const E& derived() const { return static_cast<const E&>(*this); }
+
+    // Element-wise multiplication
+    template<typename O>
+    auto hadamard(O&& o) const &;
+    template<typename O>
+    auto hadamard(O&& o) &&;
+};
+
+template<typename X>
+struct IsMatrixExpression
+{
+private:
+    typedef typename std::decay<X>::type Decayed;
+
+    template<typename U>
+    static std::true_type test(const MatrixExpression<typename U::value_type, U>*);
+    template<typename U>
+    static std::false_type test(...);
+public:
+    static constexpr bool value = decltype(test<Decayed>(std::declval<Decayed*>()))::value;
+};
+
+template<typename X>
+struct IsPlainMatrixType : std::false_type {};
+template<typename T, typename Alloc>
+struct IsPlainMatrixType<Matrix<T, Alloc>> : std::true_type {};
+
+template<typename X>
+struct IsPlainMatrix : IsPlainMatrixType<typename std::decay<X>::type> {};
+
+// Named matrices are referenced, temporaries and expression nodes are stored by value
+template<typename X>
+using MatrixOperand = typename std::conditional<std::is_lvalue_reference<X>::value && IsPlainMatrix<X>::value,
+                                                const typename std::decay<X>::type&,
+                                                typename std::decay<X>::type>::type;
+
+struct MatrixAddition
+{
+    static constexpr const char* ERROR = "ERROR: Cannot perform addition of matrices with different sizes!\n";
+    static constexpr auto KERNEL = &SimdKernelTable::add;
+
+    template<typename T>
+    static T apply(T a, T b) { return a + b; }
+};
+
+struct MatrixSubtraction
+{
+    static constexpr const char* ERROR = "ERROR: Cannot perform subtraction of matrices with different sizes!\n";
+    static constexpr auto KERNEL = &SimdKernelTable::subtract;
+
+    template<typename T>
+    static T apply(T a, T b) { return a - b; }
+};
+
+struct MatrixHadamardProduct
+{
+    static constexpr const char* ERROR = "ERROR: Cannot perform hadamard product on matrices with different sizes!\n";
+    static constexpr auto KERNEL = &SimdKernelTable::multiply;
+
+    template<typename T>
+    static T apply(T a, T b) { return a * b; }
+};
+
+// Element-wise operation on two expressions of the same size
+template<typename T, typename Op, typename L, typename R>
+class MatrixBinaryExpression : public MatrixExpression<T, MatrixBinaryExpression<T, Op, L, R>>
+{
+public:
+    template<typename A, typename B>
+    MatrixBinaryExpression(A&& left, B&& right): left_(std::forward<A>(left)), right_(std::forward<B>(right))
+    {
+        if(left_.getRows() != right_.getRows() || left_.getColumns() != right_.getColumns())
+        {
+            throw std::runtime_error(Op::ERROR);
+        }
+    }
+
+    unsigned int getRows() const { return left_.getRows(); }
+    unsigned int getColumns() const { return left_.getColumns(); }
+    unsigned int getLeadingDimension() const { return left_.getLeadingDimension(); }
+    T operator[](unsigned int index) const { return Op::apply(left_[index], right_[index]); }
+    T get(unsigned int i, unsigned int j) const;
+
+    // out = expression
+    void evaluateTo(T* out) const;
+
+    // out += factor * expression
+    void accumulateTo(T* out, T factor) const;
+private:
+    L left_;
+    R right_;
+
+    static constexpr bool USE_SIMD_KERNELS = std::is_same<T, float>::value && IsPlainMatrix<L>::value && IsPlainMatrix<R>::value;
+};
+
+// Expression multiplied by a scalar
+template<typename T, typename E>
+class MatrixScaledExpression : public MatrixExpression<T, MatrixScaledExpression<T, E>>
+{
+public:
+    template<typename A>
+    MatrixScaledExpression(A&& expression, T factor): expression_(std::forward<A>(expression)), factor_(factor) {}
+
+    unsigned int getRows() const { return expression_.getRows(); }
+    unsigned int getColumns() const { return expression_.getColumns(); }
+    unsigned int getLeadingDimension() const { return expression_.getLeadingDimension(); }
+    T operator[](unsigned int index) const { return expression_[index]*factor_; }
+    T get(unsigned int i, unsigned int j) const;
+
+    // out = expression
+    void evaluateTo(T* out) const;
+
+    // out += factor * expression, which for a scaled matrix is a single AXPY
+    void accumulateTo(T* out, T factor) const;
+private:
+    E expression_;
+    T factor_;
+
+    static constexpr bool USE_SIMD_KERNELS = std::is_same<T, float>::value && IsPlainMatrix<E>::value;
+};
+
+template<typename T, typename Op, typename L, typename R>
+T MatrixBinaryExpression<T, Op, L, R>::get(unsigned int i, unsigned int j) const
+{
+    if(i >= getRows() || j >= getColumns())
+    {
+        std::stringstream ss;
+        ss << "ERROR: Cannot access matrix entry indexed " << i << j << "!\n";
+        throw std::runtime_error(ss.str());
+    }
+    return (*this)[i*getLeadingDimension() + j];
+}
+
+template<typename T, typename Op, typename L, typename R>
+void MatrixBinaryExpression<T, Op, L, R>::evaluateTo(T* out) const
+{
+    ThreadPool::parallelRanges(getRows()*getLeadingDimension(), [&](size_t begin, size_t end)
+    {
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            (SimdKernels::get().*Op::KERNEL)(left_.getData() + begin, right_.getData() + begin, out + begin, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            out[i] = (*this)[i];
+        }
+    });
+}
+
+template<typename T, typename Op, typename L, typename R>
+void MatrixBinaryExpression<T, Op, L, R>::accumulateTo(T* out, T factor) const
+{
+    ThreadPool::parallelRanges(getRows()*getLeadingDimension(), [&](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; ++i)
+        {
+            out[i] += factor*(*this)[i];
+        }
+    });
+}
+
+template<typename T, typename E>
+T MatrixScaledExpression<T, E>::get(unsigned int i, unsigned int j) const
+{
+    return expression_.get(i, j)*factor_;
+}
+
+template<typename T, typename E>
+void MatrixScaledExpression<T, E>::evaluateTo(T* out) const
+{
+    ThreadPool::parallelRanges(getRows()*getLeadingDimension(), [&](size_t begin, size_t end)
+    {
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            SimdKernels::get().scale(expression_.getData() + begin, factor_, out + begin, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            out[i] = (*this)[i];
+        }
+    });
+}
+
+template<typename T, typename E>
+void MatrixScaledExpression<T, E>::accumulateTo(T* out, T factor) const
+{
+    ThreadPool::parallelRanges(getRows()*getLeadingDimension(), [&](size_t begin, size_t end)
+    {
+        if constexpr(USE_SIMD_KERNELS)
+        {
+            SimdKernels::get().axpy(factor*factor_, expression_.getData() + begin, out + begin, end - begin);
+            return;
+        }
+        for(size_t i = begin; i < end; ++i)
+        {
+            out[i] += factor*(*this)[i];
+        }
+    });
+}
+
+template<typename T, typename E>
+template<typename O>
+auto MatrixExpression<T, E>::hadamard(O&& o) const &
+{
+    return MatrixBinaryExpression<T, MatrixHadamardProduct, MatrixOperand<const E&>, MatrixOperand<O>>(derived(), std::forward<O>(o));
+}
+
+template<typename T, typename E>
+template<typename O>
+auto MatrixExpression<T, E>::hadamard(O&& o) &&
+{
+    return MatrixBinaryExpression<T, MatrixHadamardProduct, E, MatrixOperand<O>>(static_cast<E&&>(*this), std::forward<O>(o));
+}
+
+template<typename L, typename R>
+using EnableIfMatrixExpressions = typename std::enable_if<IsMatrixExpression<L>::value && IsMatrixExpression<R>::value>::type;
+
+template<typename L, typename R, typename = EnableIfMatrixExpressions<L, R>>
+auto operator+(L&& left, R&& right)
+{
+    typedef typename std::decay<L>::type::value_type T;
+    return MatrixBinaryExpression<T, MatrixAddition, MatrixOperand<L>, MatrixOperand<R>>(std::forward<L>(left), std::forward<R>(right));
+}
+
+template<typename L, typename R, typename = EnableIfMatrixExpressions<L, R>>
+auto operator-(L&& left, R&& right)
+{
+    typedef typename std::decay<L>::type::value_type T;
+    return MatrixBinaryExpression<T, MatrixSubtraction, MatrixOperand<L>, MatrixOperand<R>>(std::forward<L>(left), std::forward<R>(right));
+}
+
+template<typename E, typename = typename std::enable_if<IsMatrixExpression<E>::value>::type>
+auto operator*(E&& expression, typename std::decay<E>::type::value_type factor)
+{
+    typedef typename std::decay<E>::type::value_type T;
+    return MatrixScaledExpression<T, MatrixOperand<E>>(std::forward<E>(expression), factor);
+}
+
+template<typename E, typename = typename std::enable_if<IsMatrixExpression<E>::value>::type>
+auto operator*(typename std::decay<E>::type::value_type factor, E&& expression)
+{
+    typedef typename std::decay<E>::type::value_type T;
+    return MatrixScaledExpression<T, MatrixOperand<E>>(std::forward<E>(expression), factor);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+// Non-owning view of a row-major matrix stored somewhere else: a pointer to the first entry,
+// the size and the leading dimension, i.e. the distance (in elements) between the starts of
+// consecutive rows. A view can describe a whole Matrix, a range of rows of a big data set,
+// a block of columns of a batch or any other memory, without allocating or copying.
+// MatrixView<const T> is a read-only view, MatrixView<T> allows writing through it.
+template<typename T>
+class MatrixView
+{
+public:
+    typedef typename std::remove_const<T>::type value_type;
+
+    MatrixView(): data_(nullptr), rows_(0), columns_(0), ld_(0) {}
+    MatrixView(T* data, unsigned int rows, unsigned int columns):
+        data_(data), rows_(rows), columns_(columns), ld_(columns) {}
+    MatrixView(T* data, unsigned int rows, unsigned int columns, unsigned int leadingDimension):
+        data_(data), rows_(rows), columns_(columns), ld_(leadingDimension) {}
+
+    // Writable views convert to read-only ones
+    template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+    MatrixView(const MatrixView<U>& o): MatrixView(o.getData(), o.getRows(), o.getColumns(), o.getLeadingDimension()) {}
+
+    unsigned int getRows() const { return rows_; }
+    unsigned int getColumns() const { return columns_; }
+    unsigned int getLeadingDimension() const { return ld_; }
+    T* getData() const { return data_; }
+
+    // True when rows follow each other without gaps, so the entries form one array
+    bool isContiguous() const { return ld_ == columns_ || rows_ <= 1; }
+
+    T& operator()(unsigned int i, unsigned int j) const { return data_[i*ld_ + j]; }
+    value_type get(unsigned int i, unsigned int j) const;
+
+    // Views of a part of this view
+    MatrixView rows(unsigned int first, unsigned int count) const;
+    MatrixView block(unsigned int firstRow, unsigned int firstColumn, unsigned int rows, unsigned int columns) const;
+
+    // Row i seen as a column vector, e.g. a single sample of a data set stored one sample per row
+    MatrixView rowAsColumn(unsigned int i) const;
+private:
+    T* data_;
+    unsigned int rows_;
+    unsigned int columns_;
+    unsigned int ld_;
+};
+
+template<typename T>
+typename MatrixView<T>::value_type MatrixView<T>::get(unsigned int i, unsigned int j) const
+{
+    if(i >= rows_ || j >= columns_)
+    {
+        std::stringstream ss;
+        ss << "ERROR: Cannot access matrix entry indexed " << i << j << "!\n";
+        throw std::runtime_error(ss.str());
+    }
+    return (*this)(i, j);
+}
+
+template<typename T>
+MatrixView<T> MatrixView<T>::rows(unsigned int first, unsigned int count) const
+{
+    return block(first, 0, count, columns_);
+}
+
+template<typename T>
+MatrixView<T> MatrixView<T>::block(unsigned int firstRow, unsigned int firstColumn, unsigned int rows, unsigned int columns) const
+{
+    if(firstRow + rows > rows_ || firstColumn + columns > columns_)
+    {
+        throw std::runtime_error("ERROR: Matrix view block exceeds the viewed matrix!\n");
+    }
+    return MatrixView(data_ + firstRow*ld_ + firstColumn, rows, columns, ld_);
+}
+
+template<typename T>
+MatrixView<T> MatrixView<T>::rowAsColumn(unsigned int i) const
+{
+    if(i >= rows_)
+    {
+        throw std::runtime_error("ERROR: Matrix view block exceeds the viewed matrix!\n");
+    }
+    return MatrixView(data_ + i*ld_, columns_, 1, 1);
+}
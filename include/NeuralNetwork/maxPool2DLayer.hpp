@@ -0,0 +1,45 @@
+#pragma once
+
+#include "layer.hpp"
+#include "tensorShape.hpp"
+
+// Downsamples every feature map by taking the maximum of non-overlapping size x size windows
+// (a partial window at the right or bottom edge is dropped). The layer has no parameters.
+// Backpropagation routes the error of a window to its first maximal input, found again by
+// comparing the inputs with the cached output instead of storing the positions.
+class MaxPool2DLayer : public Layer
+{
+friend class NeuralNetwork;
+public:
+    MaxPool2DLayer(TensorShape input, unsigned int size);
+
+    TensorShape getInputShape() const { return input_; }
+    TensorShape getOutputShape() const { return output_; }
+    unsigned int getSize() const { return size_; }
+
+    virtual unsigned int getInputNodesCount() const { return input_.size(); }
+
+    // The maximum is not an element-wise function
+    virtual ActivationKernel getActivationKernel() const { return nullptr; }
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual bool derivativeFromOutput() const { return true; }
+
+    virtual NNMatrixType feedforward(NNMatrixViewType input, NNMatrixType& weightedInput);
+    virtual NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // Only routes the error, there is nothing to learn
+    using Layer::backpropagate;
+    virtual NNMatrixType backpropagate(const NNMatrixType& error,
+                                       const NNMatrixType& weightedInput,
+                                       const NNMatrixType& output,
+                                       NNMatrixViewType prevOutput,
+                                       NNMatrixType& nablaW,
+                                       NNMatrixType& nablaB);
+
+    // Writes the shape ahead of the (empty) matrices
+    virtual void serialize(std::ofstream& ofile) const;
+private:
+    TensorShape input_;
+    TensorShape output_;
+    unsigned int size_;
+};
@@ -5,7 +5,7 @@
 class MeanSquereErrorCost : public CostFunctionStrategy
 {
 public:
-    virtual NNDataType calculateCost(const NNMatrixType& output, const NNMatrixType& target) const;
-    virtual NNMatrixType calculateCostDerivative(const NNMatrixType& output, const NNMatrixType& target) const;
+    virtual NNDataType calculateCost(NNMatrixViewType output, NNMatrixViewType target) const;
+    virtual NNMatrixType calculateCostDerivative(NNMatrixViewType output, NNMatrixViewType target) const;
     virtual void serialize(std::ofstream& ofile) const;
 };
\ No newline at end of file
@@ -3,56 +3,93 @@
 #include "matrix.hpp"
 #include "neuralnetwork.hpp"
 
+// Each set is kept as one contiguous matrix with a sample per row,
+// samples are handed to the network as column views of those rows.
 class MNISTData
 {
-typedef std::vector<NNMatrixType> MatrixVec;
+typedef std::vector<NNMatrixViewType> ViewVec;
 public:
     MNISTData() = default;
 
-    MNISTData(const MatrixVec& trainingData, const MatrixVec& trainingLabels,
-              const MatrixVec& testingData, const MatrixVec& testingLabels):
-              trainingData_(trainingData), trainingLabels_(trainingLabels),
-              testingData_(testingData), testingLabels_(testingLabels) 
-    {}
-
-    const MatrixVec& getTrainingData() const
+    MNISTData(NNMatrixType trainingData, NNMatrixType trainingLabels,
+              NNMatrixType testingData, NNMatrixType testingLabels):
+              trainingData_(std::move(trainingData)), trainingLabels_(std::move(trainingLabels)),
+              testingData_(std::move(testingData)), testingLabels_(std::move(testingLabels))
     {
-        return trainingData_;
+        createViews();
     }
-    void setTrainingData(const MatrixVec& trainingData)
+
+    MNISTData(const MNISTData& o):
+              trainingData_(o.trainingData_), trainingLabels_(o.trainingLabels_),
+              testingData_(o.testingData_), testingLabels_(o.testingLabels_)
     {
-        trainingData_ = trainingData;
+        createViews();
     }
 
-    const MatrixVec& getTrainingLabels() const
+    MNISTData& operator=(const MNISTData& o)
     {
-        return trainingLabels_;
+        if(this != &o)
+        {
+            trainingData_ = o.trainingData_;
+            trainingLabels_ = o.trainingLabels_;
+            testingData_ = o.testingData_;
+            testingLabels_ = o.testingLabels_;
+            createViews();
+        }
+        return *this;
     }
-    void setTrainingLabels(const MatrixVec& trainingLabels)
+
+    // Moving matrices keeps their buffers, so the views stay valid
+    MNISTData(MNISTData&&) = default;
+    MNISTData& operator=(MNISTData&&) = default;
+
+    const ViewVec& getTrainingData() const
     {
-        trainingLabels_ = trainingLabels;
+        return trainingDataViews_;
     }
 
-    const MatrixVec& getTestingData() const
+    const ViewVec& getTrainingLabels() const
     {
-        return testingData_;
+        return trainingLabelsViews_;
     }
-    void setTestingData(const MatrixVec& testingData)
+
+    const ViewVec& getTestingData() const
     {
-        testingData_ = testingData;
+        return testingDataViews_;
     }
 
-    const MatrixVec& getTestingLabels() const
+    const ViewVec& getTestingLabels() const
+    {
+        return testingLabelsViews_;
+    }
+private:
+    static ViewVec rowViews(const NNMatrixType& samples)
     {
-        return testingLabels_;
+        ViewVec views;
+        views.reserve(samples.getRows());
+        NNMatrixViewType all = samples.view();
+        for(unsigned int i = 0; i < samples.getRows(); ++i)
+        {
+            views.emplace_back(all.rowAsColumn(i));
+        }
+        return views;
     }
-    void setTestingLabels(const MatrixVec& testingLabels)
+
+    void createViews()
     {
-        testingLabels_ = testingLabels;
+        trainingDataViews_ = rowViews(trainingData_);
+        trainingLabelsViews_ = rowViews(trainingLabels_);
+        testingDataViews_ = rowViews(testingData_);
+        testingLabelsViews_ = rowViews(testingLabels_);
     }
-private:
-    MatrixVec trainingData_;
-    MatrixVec trainingLabels_;
-    MatrixVec testingData_;
-    MatrixVec testingLabels_;
+
+    NNMatrixType trainingData_;
+    NNMatrixType trainingLabels_;
+    NNMatrixType testingData_;
+    NNMatrixType testingLabels_;
+
+    ViewVec trainingDataViews_;
+    ViewVec trainingLabelsViews_;
+    ViewVec testingDataViews_;
+    ViewVec testingLabelsViews_;
 };
@@ -6,7 +6,6 @@
 
 class MNISTDataLoader
 {
-typedef std::vector<NNMatrixType> MatrixVec;
 public:
     static MNISTData loadData(const char* trainingImagesFilename,
                               const char* trainingLabelsFilename,
@@ -18,7 +17,7 @@ private:
     static void loadImages(const char* imagesFilename, std::vector<std::unique_ptr<char[]>>& images, int& nLoadedImages, int& imagePixels);
     static std::unique_ptr<char[]> loadLabels(const char* labelsFilename, int& nLoadedLabels);
 
-    static void createMatriciesFromRawData(const std::vector<std::unique_ptr<char[]>>& images, std::unique_ptr<char[]>, int nData, int imagePixels, MatrixVec& imagesMatricies, MatrixVec& lablesMatricies);
+    static void createMatriciesFromRawData(const std::vector<std::unique_ptr<char[]>>& images, std::unique_ptr<char[]>, int nData, int imagePixels, NNMatrixType& imagesMatrix, NNMatrixType& labelsMatrix);
 
     MNISTDataLoader();
 };
\ No newline at end of file
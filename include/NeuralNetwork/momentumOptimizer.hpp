@@ -0,0 +1,23 @@
+#pragma once
+
+#include "optimizer.hpp"
+
+// SGD with a velocity v = momentum * v + g that the weights follow, w -= learningRate * v.
+// The Nesterov variant steps along the velocity it is about to have, w -= learningRate * (g + momentum * v)
+class MomentumOptimizer : public Optimizer
+{
+public:
+    explicit MomentumOptimizer(float momentum = 0.9f, bool nesterov = false);
+
+    float getMomentum() const { return momentum_; }
+    bool isNesterov() const { return nesterov_; }
+
+    virtual unsigned int getStateCount() const { return 1; }
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual void step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                      float learningRate, size_t n) const;
+private:
+    float momentum_;
+    bool nesterov_;
+};
@@ -5,18 +5,32 @@
 #include <random>
 #include <vector>
 
+#include "arena.hpp"
 #include "matrix.hpp"
 
 class Layer;
 class CostFunctionStrategy;
+class Optimizer;
+class Workspace;
 
 typedef float NNDataType;
-typedef Matrix<NNDataType> NNMatrixType;
+// Allocator of every matrix used by the network. Matrices created during a training step
+// come from the network's step arena, all others from the heap
+typedef ArenaAllocator<NNDataType> NNAllocatorType;
+typedef Matrix<NNDataType, NNAllocatorType> NNMatrixType;
+typedef MatrixView<const NNDataType> NNMatrixViewType;
+
+// Accuracy of activation functions built on the exponential: Exact stays within a couple of ulp
+// of the float library functions, Fast allows about 1e-4 relative error for higher throughput
+enum class ActivationAccuracy { Exact, Fast };
 
 class NeuralNetwork
 {
 public:
     NeuralNetwork(unsigned int inputNodes, float learningRate, std::unique_ptr<CostFunctionStrategy> costFunction);
+    NeuralNetwork(NeuralNetwork&& o);
+    NeuralNetwork& operator=(NeuralNetwork&& o);
+    ~NeuralNetwork();
 
     unsigned int getLayersCount() const;
     unsigned int getOutputNodesCount() const;
@@ -24,36 +38,126 @@ public:
     template<typename T>
     void addLayer(unsigned int nodes);
 
-    // Get output from neural net
-    NNMatrixType feedforward(const NNMatrixType& input) const;
+    // Appends a layer built by the caller, for layers shaped by more than a number of nodes
+    // (e.g. Conv2DLayer). Its input has to match the output of the last layer
+    void addLayer(std::shared_ptr<Layer> layer);
+
+    // Checking mode: replaces NaN and infinite values produced by layers and cost function with zeros.
+    // Off by default, as it costs an extra pass over every activation and error
+    void setNumericChecks(bool enabled);
+    bool getNumericChecks() const;
+
+    // Rule the weights are updated with after every batch, SGDOptimizer by default.
+    // Setting an optimizer discards the state (moments) the layers kept for the previous one
+    void setOptimizer(std::unique_ptr<Optimizer> optimizer);
+    const Optimizer& getOptimizer() const;
+
+    // Data-parallel training: train splits every batch into this many parts of consecutive samples, which
+    // separate threads backpropagate into gradients of their own, summed by a tree reduction before the update.
+    // The parts, the order of the sums and the products of a part (each runs on its thread alone, see Gemm) depend
+    // on nothing but this number, so a fixed count trains bit for bit the same with any number of ThreadPool
+    // threads, a single one included (deterministic mode). 0 uses one part
+    // per thread of ThreadPool, whose results change with the number of threads. 1 (default) keeps every batch whole,
+    // with the threads sharing each product, which is faster for small networks or small batches
+    void setTrainingWorkers(unsigned int workers);
+    unsigned int getTrainingWorkers() const;
+
+    // Accuracy tier of the activation functions of every layer, Exact by default
+    void setActivationAccuracy(ActivationAccuracy accuracy);
+    ActivationAccuracy getActivationAccuracy() const;
 
-    // The name of the game
+    // Get output from neural net. Every column of input is a separate sample
+    NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // Same, with every temporary taken from the workspace: once the workspace has seen a batch
+    // of this size the call does not allocate. The result stays valid until the next pass through the workspace
+    NNMatrixViewType feedforward(NNMatrixViewType input, Workspace& workspace) const;
+
+    // Bytes of workspace a training step (or a forward pass) over batchSize samples takes
+    size_t getWorkspaceSize(unsigned int batchSize) const;
+
+    // The name of the game. Each batch is evaluated as one matrix with a sample per column
+    void train(unsigned int epochs, 
+                unsigned int batchSize, 
+                const std::vector<NNMatrixViewType>& inputs, 
+                const std::vector<NNMatrixViewType>& targets);
     void train(unsigned int epochs, 
                 unsigned int batchSize, 
                 const std::vector<NNMatrixType>& inputs, 
                 const std::vector<NNMatrixType>& targets);
 
+    // Hogwild! training on several threads. Every epoch splits the shuffled samples into one shard per
+    // thread, and each thread trains on its shard in batches, applying the optimizer to the shared weights
+    // right after every batch without any locking, through relaxed atomic accesses (Optimizer::updateShared).
+    // A thread may read weights while another one writes them and so sees some updates partly applied;
+    // each update touches a small part of the weights' values, so this costs little accuracy and no thread
+    // ever waits. Those reads are the one data race left, see tsan.supp. Threads have their own gradients
+    // and workspace. threads = 0 uses one per thread of ThreadPool, whose size also limits how many run at once
+    void trainAsync(unsigned int threads,
+                    unsigned int epochs,
+                    unsigned int batchSize,
+                    const std::vector<NNMatrixViewType>& inputs,
+                    const std::vector<NNMatrixViewType>& targets);
+    void trainAsync(unsigned int threads,
+                    unsigned int epochs,
+                    unsigned int batchSize,
+                    const std::vector<NNMatrixType>& inputs,
+                    const std::vector<NNMatrixType>& targets);
+
     // Testing nn performance
+    float test(const std::vector<NNMatrixViewType>& inputs, 
+               const std::vector<NNMatrixViewType>& targets) const;
     float test(const std::vector<NNMatrixType>& inputs, 
                const std::vector<NNMatrixType>& targets) const;
 
-    // Serialization and deserialization
+    // Serialization and deserialization. The file holds the optimizer with its state, which load reads
+    // only with trainingState set (to resume training), a model loaded for inference holds nothing but weights
     void save(const char* filename) const;
-    static NeuralNetwork load(const char* filename);
+    static NeuralNetwork load(const char* filename, bool trainingState = false);
 private:
-    void singleInputTrain(const NNMatrixType& input, const NNMatrixType& target); // used in train
-    void addLayer(std::shared_ptr<Layer> layer); // used in serialization
+    // Gradient accumulators of every layer kept apart from the layers' own, e.g. by a training thread
+    struct Gradients
+    {
+        std::vector<NNMatrixType> weights;
+        std::vector<NNMatrixType> biases;
+    };
+
+    // Zeroed accumulators shaped like the weights and biases of the layers
+    Gradients makeGradients() const;
+
+    // used in train. Sums the gradients into the given accumulators, or into the layers' own ones without them
+    void batchTrain(NNMatrixViewType input, NNMatrixViewType target, Gradients* gradients = nullptr);
+
+    // Trains the samples with given indices split into one part per accumulator, each part on its own thread
+    // with its own workspace, then sums the parts into the layers' gradients
+    void parallelBatchTrain(const std::vector<NNMatrixViewType>& inputs, const std::vector<NNMatrixViewType>& targets,
+                            const unsigned int* indices, unsigned int count,
+                            std::vector<Gradients>& gradients, std::vector<Workspace>& workspaces);
+
+    // Adds the gradients of every part to the layers' own ones and clears them
+    void reduceGradients(std::vector<Gradients>& gradients);
+
+    // Copies the samples with given indices into the columns of one matrix
+    static NNMatrixType gatherColumns(const std::vector<NNMatrixViewType>& samples, const unsigned int* indices, unsigned int count);
+
+    static std::vector<NNMatrixViewType> viewsOf(const std::vector<NNMatrixType>& matrices);
 
     unsigned int inputNodes_;
     unsigned int outputNodes_;
     float learningRate_;
+    bool numericChecks_;
+    unsigned int trainingWorkers_;
+    ActivationAccuracy activationAccuracy_;
     std::unique_ptr<CostFunctionStrategy> costFunction_;
+    std::unique_ptr<Optimizer> optimizer_;
     std::vector<std::shared_ptr<Layer>> layers_;
+
+    // Temporaries of batchTrain, rewound after every batch
+    std::unique_ptr<Workspace> workspace_;
 };
 
 template<typename T>
 void NeuralNetwork::addLayer(unsigned int nodes)
 {
-    layers_.push_back(std::make_shared<T>(nodes, outputNodes_));
-    outputNodes_ = nodes;
+    addLayer(std::shared_ptr<Layer>(std::make_shared<T>(nodes, outputNodes_)));
 }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "matrix.hpp"
+#include "neuralnetwork.hpp"
+
+#include <fstream>
+
+// Rule turning the gradient accumulated over a batch into a change of the parameters. An update is
+// a single fused pass over a parameter matrix: it reads the gradient, updates the optimizer's moments,
+// writes the parameters and clears the gradient for the next batch. The moments are kept by the layers,
+// as getStateCount() matrices shaped like each parameter matrix, so they are saved with the model.
+class Optimizer
+{
+public:
+    virtual ~Optimizer() = default;
+
+    // Number of moment matrices kept per parameter matrix
+    virtual unsigned int getStateCount() const = 0;
+
+    // Called once per batch, before the layers are updated. Threads of NeuralNetwork::trainAsync
+    // call it and update at the same time, so both have to be safe to run concurrently
+    virtual void beginStep() {}
+
+    // Most moment matrices an optimizer keeps per parameter matrix
+    static constexpr unsigned int MAX_STATE_COUNT = 2;
+
+    // moments points to getStateCount() matrices shaped like parameters
+    void update(NNMatrixType& parameters, NNMatrixType& gradient, NNMatrixType* moments, float learningRate) const;
+
+    // Same for Hogwild! training (NeuralNetwork::trainAsync), where other threads update the same parameters
+    // and moments at the same time. Shared values are only accessed with relaxed atomic loads and stores,
+    // plain moves on x86, and the step runs on a thread-local copy of a few of them at a time. Updates of
+    // other threads landing in between are overwritten, as Hogwild! allows
+    void updateShared(NNMatrixType& parameters, NNMatrixType& gradient, NNMatrixType* moments, float learningRate) const;
+
+    // Writes the 3-letter tag followed by the hyperparameters
+    virtual void serialize(std::ofstream& ofile) const = 0;
+protected:
+    // The update of n consecutive parameters, their gradients and their values in each moment matrix
+    virtual void step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                      float learningRate, size_t n) const = 0;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+// Counter-based Philox4x32-10 generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+// Every block of four outputs is a pure function of (seed, stream, block index), so the state is
+// a few words instead of a 5 KB Mersenne Twister, and any part of a sequence can be generated
+// independently of the rest - e.g. by several threads filling one large weight matrix.
+class Philox
+{
+public:
+    typedef uint32_t result_type;
+
+    explicit Philox(uint64_t seed = 0, uint64_t stream = 0);
+
+    // UniformRandomBitGenerator interface, so that the generator works with std::shuffle and <random>
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    result_type operator()();
+    void discard(uint64_t n);
+
+    // Four outputs of block with given index, does not change the generator position
+    std::array<uint32_t, 4> block(uint64_t index) const;
+
+    // Output at given position of the sequence, does not change the generator position
+    uint32_t at(uint64_t position) const;
+
+    uint64_t getSeed() const;
+    uint64_t getStream() const;
+private:
+    uint32_t key_[2];
+    uint32_t stream_[2];
+    uint64_t position_;
+
+    // Last block produced by operator(), sequential draws compute every block once
+    std::array<uint32_t, 4> cache_;
+    uint64_t cachedBlock_;
+};
+
+// Process-wide source of independent Philox streams. Seeding it makes everything drawn
+// afterwards (weight initialisation, data shuffles) reproducible across runs.
+class RandomService
+{
+public:
+    static void seed(uint64_t seed);
+
+    // Generator on a stream that has not been handed out since the last seed
+    static Philox nextStream();
+private:
+    RandomService();
+
+    static std::atomic<uint64_t> seed_;
+    static std::atomic<uint64_t> nextStream_;
+};
@@ -1,15 +1,32 @@
 #pragma once
 
-#include "layer.hpp"
+#include "denseLayer.hpp"
 
-class ReLULayer : public Layer
+// Rectified linear unit max(0, z)
+struct ReLUActivation
 {
-friend class NeuralNetwork;
-public:
-    ReLULayer(unsigned int nodes, unsigned int prevNodes) : Layer(nodes, prevNodes) {};
+    static constexpr char ID[] = "REL";
 
-    virtual NNDataType activationFunction(NNDataType value) const;
-    virtual NNDataType activationDerivative(NNDataType value) const;
+    // The output is positive exactly where the derivative is 1
+    static constexpr bool DERIVATIVE_FROM_OUTPUT = true;
 
-    virtual void serialize(std::ofstream& ofile) const;
-};
\ No newline at end of file
+    static NNDataType value(NNDataType z)
+    {
+        if(z < 0.0f) return 0.0f;
+        else return z;
+    }
+
+    static NNDataType derivative(NNDataType a)
+    {
+        if(a > 0.0f) return 1.0f;
+        else return 0.0f;
+    }
+
+    // ReLU is exact in both accuracy tiers
+    static Layer::ActivationKernel forwardKernel(ActivationAccuracy);
+    static void backward(const NNDataType* in, NNDataType* out, size_t n);
+};
+
+typedef DenseLayer<ReLUActivation> ReLULayer;
+
+extern template class DenseLayer<ReLUActivation>;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "optimizer.hpp"
+
+// Divides the step of every weight by a running root mean square of its gradients,
+// s = decay * s + (1 - decay) * g^2, w -= learningRate * g / (sqrt(s) + epsilon)
+class RMSPropOptimizer : public Optimizer
+{
+public:
+    explicit RMSPropOptimizer(float decay = 0.9f, float epsilon = 1e-8f);
+
+    float getDecay() const { return decay_; }
+    float getEpsilon() const { return epsilon_; }
+
+    virtual unsigned int getStateCount() const { return 1; }
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual void step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                      float learningRate, size_t n) const;
+private:
+    float decay_;
+    float epsilon_;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "optimizer.hpp"
+
+// Plain stochastic gradient descent, w -= learningRate * g
+class SGDOptimizer : public Optimizer
+{
+public:
+    virtual unsigned int getStateCount() const { return 0; }
+    virtual void serialize(std::ofstream& ofile) const;
+protected:
+    virtual void step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                      float learningRate, size_t n) const;
+};
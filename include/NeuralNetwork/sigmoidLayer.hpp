@@ -1,15 +1,32 @@
 #pragma once
 
-#include "layer.hpp"
+#include "denseLayer.hpp"
 
-class SigmoidLayer : public Layer
+#include <cmath>
+
+// Logistic function 1/(1 + e^-z)
+struct SigmoidActivation
 {
-friend class NeuralNetwork;
-public:
-    SigmoidLayer(unsigned int nodes, unsigned int prevNodes) : Layer(nodes, prevNodes) {};
+    static constexpr char ID[] = "SIG";
+
+    // s'(z) = s(1 - s) is cheaper to get from the output than from z
+    static constexpr bool DERIVATIVE_FROM_OUTPUT = true;
+
+    // Evaluated in double precision like the sigmoid kernels, so both agree with them to the ulp
+    static NNDataType value(NNDataType z)
+    {
+        return (NNDataType)(1.0/(1.0 + std::exp(-(double)z)));
+    }
+
+    static NNDataType derivative(NNDataType a)
+    {
+        return (NNDataType)((double)a*(1.0 - a));
+    }
+
+    static Layer::ActivationKernel forwardKernel(ActivationAccuracy accuracy);
+    static void backward(const NNDataType* in, NNDataType* out, size_t n);
+};
 
-    virtual NNDataType activationFunction(NNDataType value) const;
-    virtual NNDataType activationDerivative(NNDataType value) const;
+typedef DenseLayer<SigmoidActivation> SigmoidLayer;
 
-    virtual void serialize(std::ofstream& ofile) const;
-};
\ No newline at end of file
+extern template class DenseLayer<SigmoidActivation>;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Set of float kernels backing Matrix<float>. Every function handles any length,
+// the part that does not fill a whole vector register is processed by scalar code.
+struct SimdKernelTable
+{
+    const char* name;
+
+    // out = a + b, out = a - b, out = a * b (element-wise). out may alias a or b
+    void (*add)(const float* a, const float* b, float* out, size_t n);
+    void (*subtract)(const float* a, const float* b, float* out, size_t n);
+    void (*multiply)(const float* a, const float* b, float* out, size_t n);
+
+    // out = a * f. out may alias a
+    void (*scale)(const float* a, float f, float* out, size_t n);
+
+    // y += alpha * x
+    void (*axpy)(float alpha, const float* x, float* y, size_t n);
+
+    void (*fill)(float* out, float value, size_t n);
+    float (*sum)(const float* a, size_t n);
+
+    // sum(a * b)
+    float (*dot)(const float* a, const float* b, size_t n);
+
+    // Sets NaN and infinite entries to zero
+    void (*replaceNonFinite)(float* data, size_t n);
+
+    // Activation functions, out = f(in). out may alias in.
+    // Sigmoid comes in two tiers: within 1 ulp of the exact value, and Fast with
+    // about 1e-4 relative error from a shorter exponential polynomial
+    void (*sigmoid)(const float* in, float* out, size_t n);
+    void (*sigmoidFast)(const float* in, float* out, size_t n);
+    void (*relu)(const float* in, float* out, size_t n);
+
+    // out = e^in, within 1 ulp (used by softmax). out may alias in. The vector versions flush
+    // results to 0 below in = -87.68 instead of going subnormal and saturate at 2.4e38 above
+    // in = 88.38 instead of overflowing, the scalar one follows std::exp
+    void (*exp)(const float* in, float* out, size_t n);
+
+    // Derivatives computed from the activation output a = f(z), out = f'(z). The sigmoid one is
+    // correctly rounded
+    void (*sigmoidDerivative)(const float* in, float* out, size_t n);
+    void (*reluDerivative)(const float* in, float* out, size_t n);
+
+    // out = in^T, where in is rows x columns. ldIn and ldOut are the leading dimensions,
+    // in and out must not overlap
+    void (*transpose)(const float* in, unsigned int ldIn, float* out, unsigned int ldOut,
+                      unsigned int rows, unsigned int columns);
+
+    // MR x NR register tile of Gemm<float>, see Gemm::microKernel
+    void (*gemmMicroKernel)(unsigned int kc, const float* a, const float* b,
+                            float* c, unsigned int ldc,
+                            unsigned int mr, unsigned int nr, bool accumulate);
+
+    // Fused optimizer updates of n weights w by their gradient g, which is cleared in the same pass.
+    // SGD: w -= lr*g. Momentum: v = mu*v + g, w -= lr*v, or w -= lr*(g + mu*v) for Nesterov
+    void (*sgdStep)(float* w, float* g, float learningRate, size_t n);
+    void (*momentumStep)(float* w, float* g, float* v, float learningRate, float momentum, bool nesterov, size_t n);
+
+    // RMSProp: s = rho*s + (1 - rho)*g^2, w -= lr*g/(sqrt(s) + eps)
+    void (*rmsPropStep)(float* w, float* g, float* s, float learningRate, float decay, float epsilon, size_t n);
+
+    // AdamW: m = b1*m + (1 - b1)*g, v = b2*v + (1 - b2)*g^2, w = decay*w - stepSize*m/(sqrt(vScale*v) + eps),
+    // where stepSize and vScale hold the bias corrections of the moments and decay the weight decay
+    void (*adamWStep)(float* w, float* g, float* m, float* v, float beta1, float beta2, float epsilon,
+                      float stepSize, float vScale, float decay, size_t n);
+};
+
+// Chooses kernels once per process according to the instruction sets reported by CPUID
+// (SSE4.2, AVX2+FMA, AVX-512), so a single binary runs at full speed on every x86-64 machine.
+// The choice can be narrowed with NN_SIMD environment variable set to one of the variant names.
+class SimdKernels
+{
+public:
+    // Kernels used by this process
+    static const SimdKernelTable& get();
+
+    // Every variant that can run on this machine, starting with the scalar reference
+    static std::vector<const SimdKernelTable*> available();
+
+    // Compares every available variant against the scalar reference, reporting mismatches to os
+    static bool selfCheck(std::ostream& os);
+private:
+    SimdKernels();
+
+    static const SimdKernelTable& select();
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "layer.hpp"
+
+// Fully connected output layer turning every sample (column) into a probability distribution,
+// a_i = e^z_i / sum_k e^z_k. The exponentials are taken of z minus the column maximum
+// (log-sum-exp), so no input overflows them. Together with CrossEntropyCost the backward pass
+// starts straight from dC/dz = a - y, without forming either derivative.
+class SoftmaxLayer : public Layer
+{
+friend class NeuralNetwork;
+public:
+    SoftmaxLayer(unsigned int nodes, unsigned int prevNodes) : Layer(nodes, prevNodes) {}
+    SoftmaxLayer(unsigned int nodes, unsigned int prevNodes, MatrixUninitializedTag) : Layer(nodes, prevNodes, uninitialized) {}
+
+    // Softmax couples all outputs of a sample, it has no element-wise kernel
+    virtual ActivationKernel getActivationKernel() const { return nullptr; }
+    virtual void activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const;
+    virtual bool derivativeFromOutput() const { return true; }
+
+    virtual NNMatrixType feedforward(NNMatrixViewType input, NNMatrixType& weightedInput);
+    virtual NNMatrixType feedforward(NNMatrixViewType input) const;
+
+    // dC/dz = a * (dC/da - sum(a * dC/da)) per sample, the product of the error with the softmax Jacobian
+    using Layer::backpropagate;
+    virtual NNMatrixType backpropagate(const NNMatrixType& error,
+                                       const NNMatrixType& weightedInput,
+                                       const NNMatrixType& output,
+                                       NNMatrixViewType prevOutput,
+                                       NNMatrixType& nablaW,
+                                       NNMatrixType& nablaB);
+
+    virtual bool outputDelta(const CostFunctionStrategy& cost, NNMatrixViewType output, NNMatrixViewType target,
+                             NNMatrixType& delta) const;
+
+    virtual void serialize(std::ofstream& ofile) const;
+private:
+    // Replaces every column of z with its softmax
+    static void softmaxColumns(NNMatrixType& z);
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+// Size of a stack of feature maps. A sample stores its maps in one column, channel after channel
+// and every map row after row (CHW), so a batch is the NCHW tensor with the sample index innermost:
+// entry (c, y, x) of sample n is row (c*height + y)*width + x, column n of the batch matrix.
+struct TensorShape
+{
+    unsigned int channels;
+    unsigned int height;
+    unsigned int width;
+
+    unsigned int pixels() const { return height*width; }
+    unsigned int size() const { return channels*height*width; }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Process-wide pool of worker threads used by matrix products and large element-wise operations.
+// The thread that starts a parallel job works on it too, so a pool of n threads has n - 1 workers.
+// The size comes from NN_THREADS environment variable or the number of cores, and can be changed
+// with setThreadCount (e.g. from the command line) while no parallel work is running.
+class ThreadPool
+{
+public:
+    // Element-wise work is split into ranges of at least this many entries,
+    // anything shorter than two of them runs inline on the calling thread
+    static constexpr size_t ELEMENTWISE_GRAIN = 1 << 15;
+
+    static unsigned int getThreadCount();
+
+    // 0 selects one thread per core
+    static void setThreadCount(unsigned int threads);
+
+    // Whether the calling thread is running a task, where parallel calls run inline
+    static bool insideTask() { return insideTask_; }
+
+    // Calls f(task) for every task in [0, tasks) and returns when all of them are done.
+    // Tasks must not throw. Parallel calls made from inside a task run inline
+    template<typename F>
+    static void parallelFor(unsigned int tasks, F&& f);
+
+    // Calls f(begin, end) on consecutive ranges covering [0, n), one range per thread
+    template<typename F>
+    static void parallelRanges(size_t n, F&& f);
+private:
+    explicit ThreadPool(unsigned int threads);
+    ~ThreadPool();
+
+    static ThreadPool& instance();
+
+    void run(unsigned int tasks, void (*invoke)(void*, unsigned int), void* context);
+    void work();
+    void workerLoop(uint64_t seenGeneration);
+    void startWorkers(unsigned int threads);
+    void stopWorkers();
+
+    std::vector<std::thread> workers_;
+
+    // Only one job runs at a time, callers from different threads wait for their turn
+    std::mutex jobMutex_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_;
+    unsigned int activeWorkers_;
+    bool stop_;
+
+    // Current job
+    void (*invoke_)(void*, unsigned int);
+    void* context_;
+    unsigned int tasks_;
+    std::atomic<unsigned int> nextTask_;
+
+    static thread_local bool insideTask_;
+};
+
+template<typename F>
+void ThreadPool::parallelFor(unsigned int tasks, F&& f)
+{
+    // f is passed as a pointer, so scheduling a job never allocates
+    auto invoke = [](void* context, unsigned int task) { (*static_cast<typename std::remove_reference<F>::type*>(context))(task); };
+    instance().run(tasks, invoke, (void*)&f);
+}
+
+template<typename F>
+void ThreadPool::parallelRanges(size_t n, F&& f)
+{
+    const size_t threads = getThreadCount();
+    if(threads <= 1 || n < 2*ELEMENTWISE_GRAIN || insideTask_)
+    {
+        f(size_t(0), n);
+        return;
+    }
+    const unsigned int tasks = (unsigned int)std::min(threads, n/ELEMENTWISE_GRAIN);
+    // range boundaries fall on multiples of 16 entries, so every range starts on a cache line
+    auto boundary = [&](unsigned int task) { return task == tasks ? n : n*task/tasks/16*16; };
+    parallelFor(tasks, [&](unsigned int task)
+    {
+        f(boundary(task), boundary(task + 1));
+    });
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+#include "arena.hpp"
+#include "neuralnetwork.hpp"
+
+// Scratch memory of the passes through one network. Every matrix a forward or backward pass
+// creates (activations, weighted inputs, deltas, im2col columns, ...) is taken from the arena of
+// the workspace, which is sized once from the layer topology (NeuralNetwork::getWorkspaceSize)
+// and rewound after every pass, so passes after the first touch the heap only if the batch grows.
+// A workspace serves one pass at a time; threads running passes at the same time use one each.
+class Workspace
+{
+friend class NeuralNetwork;
+public:
+    explicit Workspace(size_t bytes = 0);
+
+    // Grows the arena to hold at least bytes, never shrinks it. Not allowed during a pass
+    void reserve(size_t bytes);
+    size_t getCapacity() const;
+
+    // Bytes of the arena taken by a rows x columns matrix, padding included
+    static size_t matrixBytes(unsigned int rows, unsigned int columns);
+private:
+    Arena arena_;
+
+    // Result of the last NeuralNetwork::feedforward into the workspace, on the heap
+    NNMatrixType output_;
+};
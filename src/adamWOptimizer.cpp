@@ -0,0 +1,46 @@
+#include "adamWOptimizer.hpp"
+
+#include <cmath>
+
+#include "simdKernels.hpp"
+
+AdamWOptimizer::AdamWOptimizer(float beta1, float beta2, float epsilon, float weightDecay):
+    beta1_(beta1),
+    beta2_(beta2),
+    epsilon_(epsilon),
+    weightDecay_(weightDecay),
+    steps_(0)
+{
+}
+
+void AdamWOptimizer::beginStep()
+{
+    steps_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AdamWOptimizer::step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                          float learningRate, size_t n) const
+{
+    // bias corrections 1 - beta^t are folded into the step size and the scale of v once per range
+    const float steps = (float)steps_.load(std::memory_order_relaxed);
+    const float stepSize = learningRate/(1.0f - std::pow(beta1_, steps));
+    const float vScale = 1.0f/(1.0f - std::pow(beta2_, steps));
+    const float decay = 1.0f - learningRate*weightDecay_;
+
+    SimdKernels::get().adamWStep(parameters, gradient, moments[0], moments[1], beta1_, beta2_, epsilon_,
+                                 stepSize, vScale, decay, n);
+}
+
+void AdamWOptimizer::serialize(std::ofstream& ofile) const
+{
+    const char* id = "ADW";
+    const unsigned int ID_SIZE = 3;
+    ofile.write((char*)&ID_SIZE, sizeof(ID_SIZE));
+    ofile.write(id, ID_SIZE*sizeof(char));
+    ofile.write((char*)&beta1_, sizeof(beta1_));
+    ofile.write((char*)&beta2_, sizeof(beta2_));
+    ofile.write((char*)&epsilon_, sizeof(epsilon_));
+    ofile.write((char*)&weightDecay_, sizeof(weightDecay_));
+    const unsigned int steps = steps_.load();
+    ofile.write((char*)&steps, sizeof(steps));
+}
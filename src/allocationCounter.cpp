@@ -0,0 +1,28 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replacements of the global allocation functions counting heap allocations of the test binary,
+// see the arena test case. They live apart from the tests, where inlining them into the callers
+// of delete makes GCC pair malloc-based frees with new expressions (-Wmismatched-new-delete)
+std::atomic<size_t> heapAllocations{0};
+
+void* operator new(size_t size)
+{
+    ++heapAllocations;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    ++heapAllocations;
+    const size_t a = (size_t)alignment;
+    if(void* p = std::aligned_alloc(a, (size + a - 1)/a*a)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
@@ -0,0 +1,149 @@
+#include "arena.hpp"
+
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+thread_local Arena* Arena::current_ = nullptr;
+
+namespace
+{
+size_t roundToAlignment(size_t bytes)
+{
+    return (bytes + Arena::ALIGNMENT - 1)/Arena::ALIGNMENT*Arena::ALIGNMENT;
+}
+
+char* allocateAligned(size_t bytes)
+{
+    return static_cast<char*>(::operator new(bytes, std::align_val_t(Arena::ALIGNMENT)));
+}
+
+void deallocateAligned(void* p)
+{
+    ::operator delete(p, std::align_val_t(Arena::ALIGNMENT));
+}
+}
+
+Arena::Arena(size_t capacity): data_(nullptr), capacity_(roundToAlignment(capacity)), used_(0), overflowBytes_(0)
+{
+    if(capacity_ > 0)
+    {
+        data_ = allocateAligned(capacity_);
+    }
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+Arena::Arena(Arena&& o):
+    data_(std::exchange(o.data_, nullptr)),
+    capacity_(std::exchange(o.capacity_, 0)),
+    used_(std::exchange(o.used_, 0)),
+    overflow_(std::move(o.overflow_)),
+    overflowBytes_(std::exchange(o.overflowBytes_, 0))
+{
+}
+
+Arena& Arena::operator=(Arena&& o)
+{
+    if(this != &o)
+    {
+        release();
+        data_ = std::exchange(o.data_, nullptr);
+        capacity_ = std::exchange(o.capacity_, 0);
+        used_ = std::exchange(o.used_, 0);
+        overflow_ = std::move(o.overflow_);
+        overflowBytes_ = std::exchange(o.overflowBytes_, 0);
+    }
+    return *this;
+}
+
+void* Arena::allocate(size_t bytes)
+{
+    bytes = roundToAlignment(bytes);
+    if(used_ + bytes <= capacity_)
+    {
+        void* p = data_ + used_;
+        used_ += bytes;
+        return p;
+    }
+
+    // does not fit - served from the heap until the next rewind grows the arena
+    overflow_.push_back(allocateAligned(bytes));
+    overflowBytes_ += bytes;
+    return overflow_.back();
+}
+
+void Arena::rewind()
+{
+    if(!overflow_.empty())
+    {
+        const size_t capacity = capacity_ + overflowBytes_;
+        release();
+        capacity_ = capacity;
+        data_ = allocateAligned(capacity_);
+    }
+    used_ = 0;
+}
+
+void Arena::reserve(size_t capacity)
+{
+    if(used_ > 0 || !overflow_.empty())
+    {
+        throw std::runtime_error("ERROR: Arena cannot grow while its memory is in use!\n");
+    }
+
+    capacity = roundToAlignment(capacity);
+    if(capacity > capacity_)
+    {
+        release();
+        capacity_ = capacity;
+        data_ = allocateAligned(capacity_);
+    }
+}
+
+size_t Arena::getCapacity() const
+{
+    return capacity_;
+}
+
+size_t Arena::getUsed() const
+{
+    return used_ + overflowBytes_;
+}
+
+Arena* Arena::current()
+{
+    return current_;
+}
+
+void Arena::release()
+{
+    for(auto it = overflow_.begin(); it < overflow_.end(); ++it)
+    {
+        deallocateAligned(*it);
+    }
+    overflow_.clear();
+    overflowBytes_ = 0;
+
+    if(data_)
+    {
+        deallocateAligned(data_);
+    }
+    data_ = nullptr;
+    capacity_ = 0;
+    used_ = 0;
+}
+
+ArenaScope::ArenaScope(Arena& arena): arena_(arena), previous_(Arena::current_)
+{
+    Arena::current_ = &arena_;
+}
+
+ArenaScope::~ArenaScope()
+{
+    Arena::current_ = previous_;
+    arena_.rewind();
+}
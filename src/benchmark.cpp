@@ -0,0 +1,329 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "conv2DLayer.hpp"
+#include "crossEntropyCost.hpp"
+#include "depthwiseConv2DLayer.hpp"
+#include "maxPool2DLayer.hpp"
+#include "neuralnetwork.hpp"
+#include "randomGenerator.hpp"
+#include "reluLayer.hpp"
+#include "sigmoidLayer.hpp"
+#include "simdKernels.hpp"
+#include "softmaxLayer.hpp"
+#include "threadPool.hpp"
+#include "workspace.hpp"
+
+namespace
+{
+const unsigned int INPUT_NODES = 784;
+const unsigned int HIDDEN_NODES = 2048;
+const unsigned int OUTPUT_NODES = 10;
+const unsigned int BATCH_SIZE = 128;
+const unsigned int SAMPLES = 8*BATCH_SIZE;
+
+// Activation kernels run over a buffer that stays in L1, so the table shows their own cost
+const unsigned int ACTIVATION_LEN = 4096;
+const unsigned int ACTIVATION_REPEATS = 100000;
+
+// Feature maps of the convolution comparison, convolved 3x3 with padding 1
+const TensorShape CONV_MAPS{32, 14, 14};
+const unsigned int CONV_BATCH = 32;
+
+// Latencies are averaged over at least this long
+const double MIN_MEASURE_SECONDS = 0.2;
+
+// Synchronous against lock-free training of a 784-256-10 classifier, on samples of ten classes
+// that differ by a brighter band of pixels, with a quarter of them held out for the accuracy
+const unsigned int ASYNC_HIDDEN_NODES = 256;
+const unsigned int ASYNC_SAMPLES = 4096;
+const unsigned int ASYNC_BATCH_SIZE = 16;
+const unsigned int ASYNC_EPOCHS = 3;
+const float ASYNC_LEARNING_RATE = 0.001f;
+
+typedef void (*ActivationKernel)(const float*, float*, size_t);
+
+// Distance between two positive floats in units in the last place
+double ulpDistance(float a, float b)
+{
+    int32_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(a));
+    std::memcpy(&ib, &b, sizeof(b));
+    return std::fabs((double)ia - (double)ib);
+}
+
+// Largest relative and ulp errors against double precision on [-20, 20], and values per second
+void measureActivation(const char* name, ActivationKernel kernel)
+{
+    std::vector<float> in(ACTIVATION_LEN), out(ACTIVATION_LEN);
+    double maxRelative = 0.0, maxUlp = 0.0;
+    for(unsigned int pass = 0; pass < 64; ++pass)
+    {
+        for(unsigned int i = 0; i < ACTIVATION_LEN; ++i)
+        {
+            in[i] = -20.0f + 40.0f*(pass*ACTIVATION_LEN + i)/(64.0f*ACTIVATION_LEN);
+        }
+        kernel(in.data(), out.data(), ACTIVATION_LEN);
+        for(unsigned int i = 0; i < ACTIVATION_LEN; ++i)
+        {
+            const double expected = 1.0/(1.0 + std::exp(-(double)in[i]));
+            maxRelative = std::max(maxRelative, std::fabs(out[i] - expected)/expected);
+            maxUlp = std::max(maxUlp, ulpDistance(out[i], (float)expected));
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for(unsigned int r = 0; r < ACTIVATION_REPEATS; ++r)
+    {
+        kernel(in.data(), out.data(), ACTIVATION_LEN);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::setw(24) << name << std::setw(14) << std::scientific << std::setprecision(2) << maxRelative
+              << std::setw(10) << std::fixed << std::setprecision(0) << maxUlp
+              << std::setw(12) << std::setprecision(2) << (double)ACTIVATION_LEN*ACTIVATION_REPEATS/elapsed.count()/1e9 << "\n";
+}
+
+// Accuracy and throughput of both accuracy tiers of the sigmoid kernels
+void printActivationTable()
+{
+    const SimdKernelTable& kernels = SimdKernels::get();
+    std::cout << "Sigmoid kernels (" << kernels.name << "), errors against double precision on [-20, 20]\n";
+    std::cout << std::setw(24) << "kernel" << std::setw(14) << "max rel err" << std::setw(10) << "max ulp"
+              << std::setw(12) << "Gvalues/s" << "\n";
+    measureActivation("sigmoid", kernels.sigmoid);
+    measureActivation("sigmoidFast", kernels.sigmoidFast);
+    std::cout << "\n";
+}
+
+// Microseconds per sample of f(input), where input is a batch of samples
+template<typename F>
+double measureLatency(F f, unsigned int samples)
+{
+    f();
+    unsigned int repeats = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0);
+    while(elapsed.count() < MIN_MEASURE_SECONDS)
+    {
+        f();
+        ++repeats;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return elapsed.count()/repeats/samples*1e6;
+}
+
+// Forward latency of a layer stack for one sample and for a batch
+void measureConvolution(const char* name, double flops, const std::vector<std::shared_ptr<Layer>>& layers)
+{
+    double latency[2];
+    const unsigned int batches[] = {1, CONV_BATCH};
+    for(unsigned int b = 0; b < 2; ++b)
+    {
+        NNMatrixType input(layers.front()->getInputNodesCount(), batches[b], uninitialized);
+        input.randomize(0.0f, 1.0f, RandomService::nextStream());
+        latency[b] = measureLatency([&]()
+        {
+            NNMatrixType output = layers.front()->feedforward(input);
+            for(size_t i = 1; i < layers.size(); ++i)
+            {
+                output = layers[i]->feedforward(output);
+            }
+        }, batches[b]);
+    }
+    std::cout << std::setw(24) << name << std::setw(12) << std::fixed << std::setprecision(2) << flops/1e6
+              << std::setw(12) << latency[0] << std::setw(12) << latency[1]
+              << std::setw(12) << flops/latency[1]/1e3 << "\n";
+}
+
+// Standard against depthwise-separable 3x3 convolution of the same maps, then the per-image
+// latency of a small digit classifier built on the separable one, all on a single thread
+void printConvolutionTable()
+{
+    ThreadPool::setThreadCount(1);
+    RandomService::seed(0);
+
+    const double pixels = CONV_MAPS.pixels();
+    const double channels = CONV_MAPS.channels;
+    std::cout << "3x3 convolution of " << CONV_MAPS.channels << "x" << CONV_MAPS.height << "x" << CONV_MAPS.width
+              << " maps to " << CONV_MAPS.channels << " channels, 1 thread\n";
+    std::cout << std::setw(24) << "layers" << std::setw(12) << "MFLOP/img" << std::setw(12) << "us/img b=1"
+              << std::setw(12) << "us/img b=" + std::to_string(CONV_BATCH) << std::setw(12) << "GFLOP/s" << "\n";
+    measureConvolution("standard", 2.0*channels*channels*9*pixels,
+                       {std::make_shared<ReLUConv2DLayer>(CONV_MAPS, CONV_MAPS.channels, 3, 1)});
+    measureConvolution("depthwise + pointwise", 2.0*channels*9*pixels + 2.0*channels*channels*pixels,
+                       {std::make_shared<ReLUDepthwiseConv2DLayer>(CONV_MAPS, 3, 1),
+                        std::make_shared<ReLUConv2DLayer>(CONV_MAPS, CONV_MAPS.channels, 1)});
+
+    // 28x28 digit -> 3x3 conv, 8 channels -> pool -> separable conv, 16 channels -> pool -> softmax
+    NeuralNetwork nn(28*28, 0.1f, std::make_unique<CrossEntropyCost>());
+    nn.addLayer(std::make_shared<ReLUConv2DLayer>(TensorShape{1, 28, 28}, 8, 3, 1));
+    nn.addLayer(std::make_shared<MaxPool2DLayer>(TensorShape{8, 28, 28}, 2));
+    nn.addLayer(std::make_shared<ReLUDepthwiseConv2DLayer>(TensorShape{8, 14, 14}, 3, 1));
+    nn.addLayer(std::make_shared<ReLUConv2DLayer>(TensorShape{8, 14, 14}, 16, 1));
+    nn.addLayer(std::make_shared<MaxPool2DLayer>(TensorShape{16, 14, 14}, 2));
+    nn.addLayer<SoftmaxLayer>(10);
+    NNMatrixType image(28*28, 1, uninitialized);
+    image.randomize(0.0f, 1.0f, RandomService::nextStream());
+    std::cout << "separable digit classifier, batch 1: " << std::setprecision(1)
+              << measureLatency([&]() { nn.feedforward(image); }, 1) << " us/img\n";
+    Workspace workspace(nn.getWorkspaceSize(1));
+    std::cout << "separable digit classifier, batch 1, workspace: " << std::setprecision(1)
+              << measureLatency([&]() { nn.feedforward(image, workspace); }, 1) << " us/img\n\n";
+}
+
+// Samples per second of one epoch over the synthetic data set, after one warm-up epoch,
+// with every batch split into parts for the given number of workers (see setTrainingWorkers)
+double measureThroughput(const std::vector<NNMatrixViewType>& inputs, const std::vector<NNMatrixViewType>& targets,
+                         unsigned int workers)
+{
+    RandomService::seed(1);
+    NeuralNetwork nn(INPUT_NODES, 0.1f, std::make_unique<CrossEntropyCost>());
+    nn.addLayer<SigmoidLayer>(HIDDEN_NODES);
+    nn.addLayer<SigmoidLayer>(HIDDEN_NODES);
+    nn.addLayer<SigmoidLayer>(OUTPUT_NODES);
+    nn.setTrainingWorkers(workers);
+
+    nn.train(1, BATCH_SIZE, inputs, targets);
+    const auto start = std::chrono::steady_clock::now();
+    nn.train(1, BATCH_SIZE, inputs, targets);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return inputs.size()/elapsed.count();
+}
+
+// Samples per second of train (asyncThreads = 0) or trainAsync over a few epochs, and the accuracy reached
+double measureAsyncTraining(const std::vector<NNMatrixViewType>& inputs, const std::vector<NNMatrixViewType>& targets,
+                            const std::vector<NNMatrixViewType>& testInputs, const std::vector<NNMatrixViewType>& testTargets,
+                            unsigned int asyncThreads, float& accuracy)
+{
+    RandomService::seed(1);
+    NeuralNetwork nn(INPUT_NODES, ASYNC_LEARNING_RATE, std::make_unique<CrossEntropyCost>());
+    nn.addLayer<ReLULayer>(ASYNC_HIDDEN_NODES);
+    nn.addLayer<SoftmaxLayer>(OUTPUT_NODES);
+
+    const auto start = std::chrono::steady_clock::now();
+    if(asyncThreads > 0)
+    {
+        nn.trainAsync(asyncThreads, ASYNC_EPOCHS, ASYNC_BATCH_SIZE, inputs, targets);
+    }
+    else
+    {
+        nn.train(ASYNC_EPOCHS, ASYNC_BATCH_SIZE, inputs, targets);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    accuracy = nn.test(testInputs, testTargets);
+    return ASYNC_EPOCHS*inputs.size()/elapsed.count();
+}
+
+// train with the threads sharing every batch against trainAsync with a batch per thread,
+// speedups are against train on one thread
+void printAsyncTrainingTable(unsigned int cores)
+{
+    RandomService::seed(0);
+    Matrix<NNDataType> inputData(ASYNC_SAMPLES, INPUT_NODES, uninitialized);
+    inputData.randomize(0.0f, 1.0f, RandomService::nextStream());
+    Matrix<NNDataType> targetData(ASYNC_SAMPLES, OUTPUT_NODES, zeros);
+    std::vector<NNMatrixViewType> inputs, targets, testInputs, testTargets;
+    const unsigned int band = INPUT_NODES/OUTPUT_NODES;
+    for(unsigned int i = 0; i < ASYNC_SAMPLES; ++i)
+    {
+        const unsigned int label = i % OUTPUT_NODES;
+        for(unsigned int j = label*band; j < (label + 1)*band; ++j)
+        {
+            inputData.view()(i, j) += 0.3f;
+        }
+        targetData.view()(i, label) = 1.0f;
+        const bool held = i >= ASYNC_SAMPLES/4*3;
+        (held ? testInputs : inputs).push_back(NNMatrixViewType(inputData.view()).rowAsColumn(i));
+        (held ? testTargets : targets).push_back(NNMatrixViewType(targetData.view()).rowAsColumn(i));
+    }
+
+    std::cout << "784-" << ASYNC_HIDDEN_NODES << "-10, batch " << ASYNC_BATCH_SIZE << ", " << ASYNC_EPOCHS
+              << " epochs, train against lock-free trainAsync\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "samples/s" << std::setw(10) << "speedup"
+              << std::setw(10) << "accuracy" << std::setw(14) << "async s/s" << std::setw(10) << "speedup"
+              << std::setw(10) << "accuracy" << "\n";
+
+    double baseline = 0.0;
+    for(unsigned int threads = 1; ; threads *= 2)
+    {
+        threads = std::min(threads, cores);
+        ThreadPool::setThreadCount(threads);
+        float accuracy, asyncAccuracy;
+        const double throughput = measureAsyncTraining(inputs, targets, testInputs, testTargets, 0, accuracy);
+        const double asyncThroughput = measureAsyncTraining(inputs, targets, testInputs, testTargets, threads, asyncAccuracy);
+        if(threads == 1)
+        {
+            baseline = throughput;
+        }
+        std::cout << std::setw(8) << threads << std::setw(14) << std::fixed << std::setprecision(0) << throughput
+                  << std::setw(9) << std::setprecision(2) << throughput/baseline << "x"
+                  << std::setw(9) << std::setprecision(1) << accuracy << "%"
+                  << std::setw(14) << std::setprecision(0) << asyncThroughput
+                  << std::setw(9) << std::setprecision(2) << asyncThroughput/baseline << "x"
+                  << std::setw(9) << std::setprecision(1) << asyncAccuracy << "%\n";
+        if(threads == cores)
+        {
+            break;
+        }
+    }
+}
+}
+
+// Sigmoid accuracy tiers, convolution latencies, then training throughput of a 784-2048-2048-10
+// network for 1, 2, 4, ... threads up to the number of cores, with the threads sharing the products of
+// whole batches and with the batches split among them, and of synchronous against lock-free training
+// of a smaller one
+int main()
+{
+    printActivationTable();
+    printConvolutionTable();
+
+    RandomService::seed(0);
+    Matrix<NNDataType> inputData(SAMPLES, INPUT_NODES, uninitialized);
+    inputData.randomize(0.0f, 1.0f, RandomService::nextStream());
+    Matrix<NNDataType> targetData(SAMPLES, OUTPUT_NODES, zeros);
+    std::vector<NNMatrixViewType> inputs, targets;
+    for(unsigned int i = 0; i < SAMPLES; ++i)
+    {
+        targetData.view()(i, i % OUTPUT_NODES) = 1.0f;
+        inputs.push_back(NNMatrixViewType(inputData.view()).rowAsColumn(i));
+        targets.push_back(NNMatrixViewType(targetData.view()).rowAsColumn(i));
+    }
+
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "784-2048-2048-10, batch " << BATCH_SIZE << ", " << cores << " cores\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "samples/s" << std::setw(10) << "speedup"
+              << std::setw(14) << "split s/s" << std::setw(10) << "speedup" << "\n";
+
+    double baseline = 0.0;
+    for(unsigned int threads = 1; ; threads *= 2)
+    {
+        threads = std::min(threads, cores);
+        ThreadPool::setThreadCount(threads);
+        const double throughput = measureThroughput(inputs, targets, 1);
+        const double splitThroughput = measureThroughput(inputs, targets, threads);
+        if(threads == 1)
+        {
+            baseline = throughput;
+        }
+        std::cout << std::setw(8) << threads << std::setw(14) << std::fixed << std::setprecision(0) << throughput
+                  << std::setw(9) << std::setprecision(2) << throughput/baseline << "x"
+                  << std::setw(14) << std::setprecision(0) << splitThroughput
+                  << std::setw(9) << std::setprecision(2) << splitThroughput/baseline << "x\n";
+        if(threads == cores)
+        {
+            break;
+        }
+    }
+    std::cout << "\n";
+    printAsyncTrainingTable(cores);
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "conv2DLayer.hpp"
+
+#include "convolutionTaps.hpp"
+#include "simdKernels.hpp"
+#include "threadPool.hpp"
+#include "workspace.hpp"
+
+template<typename Activation>
+Conv2DLayer<Activation>::Conv2DLayer(TensorShape input, unsigned int filters, unsigned int kernelSize, unsigned int padding):
+    Conv2DLayer(input, filters, kernelSize, padding, uninitialized)
+{
+    // a weight feeds k*k outputs of each filter and reads k*k inputs of each channel
+    initializeParameters((input.channels + filters)*kernelSize*kernelSize);
+}
+
+template<typename Activation>
+Conv2DLayer<Activation>::Conv2DLayer(TensorShape input, unsigned int filters, unsigned int kernelSize, unsigned int padding,
+                                     MatrixUninitializedTag):
+    Layer(filters*(input.height + 2*padding + 1 - kernelSize)*(input.width + 2*padding + 1 - kernelSize),
+          filters, input.channels*kernelSize*kernelSize, uninitialized),
+    input_(input),
+    output_{filters, input.height + 2*padding + 1 - kernelSize, input.width + 2*padding + 1 - kernelSize},
+    kernelSize_(kernelSize),
+    padding_(padding)
+{
+    if(kernelSize == 0 || kernelSize > input.height + 2*padding || kernelSize > input.width + 2*padding)
+    {
+        throw std::runtime_error("ERROR: Convolution kernel does not fit the input!\n");
+    }
+}
+
+template<typename Activation>
+size_t Conv2DLayer<Activation>::getWorkspaceSize(unsigned int samples) const
+{
+    const unsigned int width = output_.pixels()*samples;
+    return Layer::getWorkspaceSize(samples) + 2*Workspace::matrixBytes(weights_.getColumns(), width) +
+           Workspace::matrixBytes(output_.channels, width) + Workspace::matrixBytes(width, 1);
+}
+
+template<typename Activation>
+void Conv2DLayer<Activation>::activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const
+{
+    ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+    {
+        Activation::backward(in + begin, out + begin, end - begin);
+    });
+}
+
+template<typename Activation>
+NNMatrixType Conv2DLayer<Activation>::feedforward(NNMatrixViewType input, NNMatrixType& weightedInput)
+{
+    if(derivativeFromOutput())
+    {
+        weightedInput = NNMatrixType();
+        return feedforward(input);
+    }
+
+    weightedInput = convolve(input, nullptr);
+    NNMatrixType output(weightedInput.getRows(), weightedInput.getColumns(), uninitialized);
+    ActivationKernel kernel = getActivationKernel();
+    for(unsigned int i = 0; i < output.getRows(); ++i)
+    {
+        kernel(&weightedInput.view()(i, 0), &output.view()(i, 0), output.getColumns());
+    }
+    return output;
+}
+
+template<typename Activation>
+NNMatrixType Conv2DLayer<Activation>::feedforward(NNMatrixViewType input) const
+{
+    return convolve(input, getActivationKernel());
+}
+
+template<typename Activation>
+NNMatrixType Conv2DLayer<Activation>::convolve(NNMatrixViewType input, ActivationKernel activation) const
+{
+    if(input.getRows() != input_.size())
+    {
+        throw std::runtime_error("ERROR: Input does not match the shape of convolution layer!\n");
+    }
+
+    const unsigned int samples = input.getColumns();
+    const unsigned int width = output_.pixels()*samples;
+    NNMatrixType output(nodes_, samples, uninitialized);
+
+    // Rows (filter, pixel) of an unpadded output are the rows of the filters x (pixels * samples)
+    // product one after another, so the product is written straight into it
+    const bool inPlace = output.getLeadingDimension() == samples;
+    NNMatrixType product = inPlace ? NNMatrixType(0, 0, uninitialized) : NNMatrixType(output_.channels, width, uninitialized);
+    MatrixView<NNDataType> z = inPlace ? MatrixView<NNDataType>(output.begin(), output_.channels, width) : product.view();
+
+    if(kernelSize_ == 3 && input_.channels*3*3 <= DIRECT_MAX_DEPTH)
+    {
+        convolveDirect(input, z);
+        if(activation)
+        {
+            for(unsigned int f = 0; f < output_.channels; ++f)
+            {
+                NNDataType* zf = &z(f, 0);
+                ThreadPool::parallelRanges(width, [&](size_t begin, size_t end)
+                {
+                    activation(zf + begin, zf + begin, end - begin);
+                });
+            }
+        }
+    }
+    else
+    {
+        // a 1x1 receptive field is the input pixel itself, so unpadded input rows already are the im2col matrix
+        const bool pointwise = isPointwise() && input.getLeadingDimension() == samples;
+        NNMatrixType columns = pointwise ? NNMatrixType(0, 0, uninitialized) : im2col(input);
+        NNMatrixViewType b = pointwise ? NNMatrixViewType(input.getData(), input_.channels, width) : columns.view();
+        GemmEpilogue<NNDataType> epilogue(bias_.getData(), activation, activation ? z.getData() : nullptr,
+                                          activation ? z.getLeadingDimension() : 0);
+        NNMatrixType::gemm(1.0f, weights_, MatrixOp::Normal, b, MatrixOp::Normal, 0.0f, z, epilogue);
+    }
+
+    if(!inPlace)
+    {
+        MatrixView<NNDataType> out = output.view();
+        for(unsigned int f = 0; f < output_.channels; ++f)
+        {
+            for(unsigned int p = 0; p < output_.pixels(); ++p)
+            {
+                std::copy(&z(f, p*samples), &z(f, p*samples) + samples, &out(f*output_.pixels() + p, 0));
+            }
+        }
+    }
+    return output;
+}
+
+template<typename Activation>
+void Conv2DLayer<Activation>::convolveDirect(NNMatrixViewType input, MatrixView<NNDataType> z) const
+{
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int samples = input.getColumns();
+    const unsigned int ld = input.getLeadingDimension();
+    const unsigned int k = kernelSize_;
+
+    // Each weight scales a shifted window of an input map into the output map. Pixels of a map row
+    // are consecutive rows of the batch, so when the input rows are unpadded whole map rows are
+    // single runs of values, see ConvolutionTaps
+    NNMatrixType scratch(output_.channels, ConvolutionTaps::scratchSize(output_, k, samples), uninitialized);
+    ThreadPool::parallelFor(output_.channels, [&](unsigned int f)
+    {
+        NNDataType* zf = &z(f, 0);
+        kernels.fill(zf, bias_.getData()[f], output_.pixels()*samples);
+        const NNDataType* w = weights_.getData() + f*weights_.getLeadingDimension();
+        NNDataType* tapScratch = &scratch.view()(f, 0);
+
+        for(unsigned int c = 0; c < input_.channels; ++c)
+        {
+            const NNDataType* map = &input(c*input_.pixels(), 0);
+            for(unsigned int ky = 0; ky < k; ++ky)
+            {
+                for(unsigned int kx = 0; kx < k; ++kx)
+                {
+                    const NNDataType weight = w[(c*k + ky)*k + kx];
+                    if(ld == samples)
+                    {
+                        ConvolutionTaps::accumulate(input_, output_, ky, kx, padding_, weight, map, zf, samples, tapScratch);
+                        continue;
+                    }
+                    ConvolutionTaps::forEachRun(input_, output_, ky, kx, padding_, [&](unsigned int in, unsigned int out, unsigned int count)
+                    {
+                        for(unsigned int i = 0; i < count; ++i)
+                        {
+                            kernels.axpy(weight, map + (in + i)*ld, zf + (out + i)*samples, samples);
+                        }
+                    });
+                }
+            }
+        }
+    });
+}
+
+template<typename Activation>
+NNMatrixType Conv2DLayer<Activation>::im2col(NNMatrixViewType input) const
+{
+    const unsigned int samples = input.getColumns();
+    const unsigned int ld = input.getLeadingDimension();
+    const unsigned int k = kernelSize_;
+
+    NNMatrixType columns(input_.channels*k*k, output_.pixels()*samples, uninitialized);
+    MatrixView<NNDataType> col = columns.view();
+
+    // A row of the matrix is the input map shifted by one kernel entry, copied a map row at a time
+    // when the input rows are unpadded. Only padded convolutions have entries left to zero
+    ThreadPool::parallelFor(columns.getRows(), [&](unsigned int r)
+    {
+        const NNDataType* map = &input(r/(k*k)*input_.pixels(), 0);
+        NNDataType* dst = &col(r, 0);
+        if(padding_ > 0)
+        {
+            std::fill(dst, dst + columns.getColumns(), 0.0f);
+        }
+        ConvolutionTaps::forEachRun(input_, output_, r/k%k, r%k, padding_, [&](unsigned int in, unsigned int out, unsigned int count)
+        {
+            if(ld == samples)
+            {
+                std::copy(map + in*ld, map + (in + count)*ld, dst + out*samples);
+                return;
+            }
+            for(unsigned int i = 0; i < count; ++i)
+            {
+                std::copy(map + (in + i)*ld, map + (in + i)*ld + samples, dst + (out + i)*samples);
+            }
+        });
+    });
+    return columns;
+}
+
+template<typename Activation>
+void Conv2DLayer<Activation>::col2im(NNMatrixViewType columns, NNMatrixType& input) const
+{
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int samples = input.getColumns();
+    const unsigned int ld = input.getLeadingDimension();
+    const unsigned int k = kernelSize_;
+
+    // a channel is only written by its own rows of columns, so channels are independent tasks
+    ThreadPool::parallelFor(input_.channels, [&](unsigned int c)
+    {
+        NNDataType* map = input.begin() + c*input_.pixels()*ld;
+        for(unsigned int ky = 0; ky < k; ++ky)
+        {
+            for(unsigned int kx = 0; kx < k; ++kx)
+            {
+                const NNDataType* src = &columns((c*k + ky)*k + kx, 0);
+                ConvolutionTaps::forEachRun(input_, output_, ky, kx, padding_, [&](unsigned int in, unsigned int out, unsigned int count)
+                {
+                    if(ld == samples)
+                    {
+                        kernels.add(map + in*ld, src + out*samples, map + in*ld, count*samples);
+                        return;
+                    }
+                    for(unsigned int i = 0; i < count; ++i)
+                    {
+                        kernels.add(map + (in + i)*ld, src + (out + i)*samples, map + (in + i)*ld, samples);
+                    }
+                });
+            }
+        }
+    });
+}
+
+template<typename Activation>
+NNMatrixType Conv2DLayer<Activation>::propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                                     NNMatrixType& nablaW, NNMatrixType& nablaB)
+{
+    requireGradients(nablaW, nablaB);
+    const unsigned int samples = delta.getColumns();
+    const unsigned int width = output_.pixels()*samples;
+
+    // delta as filters x (pixels * samples), the layout of the forward product
+    NNMatrixType packed = delta.getLeadingDimension() == samples ? NNMatrixType(0, 0, uninitialized)
+                                                                 : NNMatrixType(output_.channels, width, uninitialized);
+    NNMatrixViewType d(delta.getData(), output_.channels, width);
+    if(delta.getLeadingDimension() != samples)
+    {
+        MatrixView<NNDataType> p = packed.view();
+        for(unsigned int i = 0; i < delta.getRows(); ++i)
+        {
+            std::copy(&delta.view()(i, 0), &delta.view()(i, 0) + samples,
+                      &p(i/output_.pixels(), i%output_.pixels()*samples));
+        }
+        d = packed.view();
+    }
+
+    // dC/dw = delta * columns^T and dC/db sums every row of delta, as in the dense layer
+    NNMatrixType prevError(input_.size(), samples, zeros);
+    if(isPointwise() && prevOutput.getLeadingDimension() == samples && prevError.getLeadingDimension() == samples)
+    {
+        // the input is its own im2col matrix and dC/da of the receptive fields is dC/da of the input
+        NNMatrixType::gemm(1.0f, d, MatrixOp::Normal, NNMatrixViewType(prevOutput.getData(), input_.channels, width),
+                           MatrixOp::Transpose, 1.0f, nablaW);
+        NNMatrixType::gemv(1.0f, d, MatrixOp::Normal, NNMatrixType(width, 1), 1.0f, nablaB);
+        NNMatrixType::gemm(1.0f, weights_, MatrixOp::Transpose, d, MatrixOp::Normal, 0.0f,
+                           MatrixView<NNDataType>(prevError.begin(), input_.channels, width));
+        return prevError;
+    }
+
+    NNMatrixType columns = im2col(prevOutput);
+    NNMatrixType::gemm(1.0f, d, MatrixOp::Normal, columns, MatrixOp::Transpose, 1.0f, nablaW);
+    NNMatrixType::gemv(1.0f, d, MatrixOp::Normal, NNMatrixType(width, 1), 1.0f, nablaB);
+
+    // dC/da of the receptive fields, W^T * delta, reuses their storage and is summed back onto the input pixels
+    NNMatrixType::gemm(1.0f, weights_, MatrixOp::Transpose, d, MatrixOp::Normal, 0.0f, columns);
+    col2im(columns, prevError);
+    return prevError;
+}
+
+template<typename Activation>
+void Conv2DLayer<Activation>::serialize(std::ofstream& ofile) const
+{
+    const unsigned int ID_LEN = 3;
+    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
+    ofile.write("CNV", ID_LEN*sizeof(char));
+
+    // the loader builds the layer from the shape before it reads the matrices into it
+    ofile.write(Activation::ID, ID_LEN*sizeof(char));
+    const unsigned int shape[] = {input_.channels, input_.height, input_.width, output_.channels, kernelSize_, padding_};
+    ofile.write((char*)shape, sizeof(shape));
+
+    serializeMatricies(ofile);
+}
+
+template class Conv2DLayer<SigmoidActivation>;
+template class Conv2DLayer<ReLUActivation>;
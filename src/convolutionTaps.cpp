@@ -0,0 +1,59 @@
+#include "convolutionTaps.hpp"
+
+#include "simdKernels.hpp"
+
+unsigned int ConvolutionTaps::scratchSize(TensorShape output, unsigned int kernelSize, unsigned int samples)
+{
+    // a tap leaves at most kernelSize - 1 pixels between the runs of consecutive rows
+    return output.height*kernelSize*samples;
+}
+
+void ConvolutionTaps::accumulate(TensorShape input, TensorShape output, unsigned int ky, unsigned int kx,
+                                 unsigned int padding, NNDataType weight, const NNDataType* in, NNDataType* out,
+                                 unsigned int samples, NNDataType* scratch)
+{
+    const SimdKernelTable& kernels = SimdKernels::get();
+    if(input.width != output.width)
+    {
+        forEachRun(input, output, ky, kx, padding, [&](unsigned int inPixel, unsigned int outPixel, unsigned int count)
+        {
+            kernels.axpy(weight, in + inPixel*samples, out + outPixel*samples, count*samples);
+        });
+        return;
+    }
+
+    // gaps are a pixel or two, too short for a library copy
+    unsigned int firstIn = 0, firstOut = 0, end = 0;
+    NNDataType* saved = scratch;
+    forEachRun(input, output, ky, kx, padding, [&](unsigned int inPixel, unsigned int outPixel, unsigned int count)
+    {
+        if(end == 0)
+        {
+            firstIn = inPixel;
+            firstOut = outPixel;
+        }
+        for(const NNDataType* p = out + end*samples; end != 0 && p < out + outPixel*samples; ++p)
+        {
+            *saved++ = *p;
+        }
+        end = outPixel + count;
+    });
+    if(end == 0)
+    {
+        return;
+    }
+
+    kernels.axpy(weight, in + firstIn*samples, out + firstOut*samples, (end - firstOut)*samples);
+
+    // runs come in the same order, so the gaps are restored in the order they were saved
+    const NNDataType* restored = scratch;
+    end = 0;
+    forEachRun(input, output, ky, kx, padding, [&](unsigned int, unsigned int outPixel, unsigned int count)
+    {
+        for(NNDataType* p = out + end*samples; end != 0 && p < out + outPixel*samples; ++p)
+        {
+            *p = *restored++;
+        }
+        end = outPixel + count;
+    });
+}
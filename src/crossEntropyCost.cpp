@@ -2,29 +2,35 @@
 
 #include "matrix.hpp"
 
-NNDataType CrossEntropyCost::calculateCost(const NNMatrixType& output, const NNMatrixType& target) const
+NNDataType CrossEntropyCost::calculateCost(NNMatrixViewType output, NNMatrixViewType target) const
 {
     NNDataType error = 0;
     for(unsigned int i = 0; i < target.getRows(); ++i)
     {
-        NNDataType ai = output.get(i, 0);
-        NNDataType yi = target.get(i, 0);
-        error += -yi*std::log(ai) - (1.0 - yi)*std::log(1.0 - ai);
+        for(unsigned int j = 0; j < target.getColumns(); ++j)
+        {
+            NNDataType ai = output(i, j);
+            NNDataType yi = target(i, j);
+            error += -yi*std::log(ai) - (1.0 - yi)*std::log(1.0 - ai);
+        }
     }
     return error;
 }
 
-NNMatrixType CrossEntropyCost::calculateCostDerivative(const NNMatrixType& output, const NNMatrixType& target) const
+NNMatrixType CrossEntropyCost::calculateCostDerivative(NNMatrixViewType output, NNMatrixViewType target) const
 {
     // dc/da = (a-y)/(a(1-a))
-    unsigned int rows = output.getRows();
-    NNMatrixType result = NNMatrixType(rows, 1);
+    NNMatrixType result = NNMatrixType(output.getRows(), output.getColumns(), uninitialized);
+    MatrixView<NNDataType> derivative = result.view();
 
-    for(unsigned int i = 0; i < rows; ++i)
+    for(unsigned int i = 0; i < output.getRows(); ++i)
     {
-        NNDataType ai = output.get(i, 0);
-        NNDataType yi = target.get(i, 0);
-        result[i] = (ai - yi)/(ai*(1.0 - ai));
+        for(unsigned int j = 0; j < output.getColumns(); ++j)
+        {
+            NNDataType ai = output(i, j);
+            NNDataType yi = target(i, j);
+            derivative(i, j) = (ai - yi)/(ai*(1.0 - ai));
+        }
     }
 
     return result;
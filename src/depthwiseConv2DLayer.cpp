@@ -0,0 +1,211 @@
+#include "depthwiseConv2DLayer.hpp"
+
+#include "convolutionTaps.hpp"
+#include "simdKernels.hpp"
+#include "threadPool.hpp"
+
+template<typename Activation>
+DepthwiseConv2DLayer<Activation>::DepthwiseConv2DLayer(TensorShape input, unsigned int kernelSize, unsigned int padding):
+    DepthwiseConv2DLayer(input, kernelSize, padding, uninitialized)
+{
+    // a weight reads k*k inputs and feeds k*k outputs of its own channel
+    initializeParameters(2*kernelSize*kernelSize);
+}
+
+template<typename Activation>
+DepthwiseConv2DLayer<Activation>::DepthwiseConv2DLayer(TensorShape input, unsigned int kernelSize, unsigned int padding,
+                                                       MatrixUninitializedTag):
+    Layer(input.channels*(input.height + 2*padding + 1 - kernelSize)*(input.width + 2*padding + 1 - kernelSize),
+          input.channels, kernelSize*kernelSize, uninitialized),
+    input_(input),
+    output_{input.channels, input.height + 2*padding + 1 - kernelSize, input.width + 2*padding + 1 - kernelSize},
+    kernelSize_(kernelSize),
+    padding_(padding)
+{
+    if(kernelSize == 0 || kernelSize > input.height + 2*padding || kernelSize > input.width + 2*padding)
+    {
+        throw std::runtime_error("ERROR: Convolution kernel does not fit the input!\n");
+    }
+}
+
+template<typename Activation>
+void DepthwiseConv2DLayer<Activation>::activateDerivative(const NNDataType* in, NNDataType* out, unsigned int n) const
+{
+    ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+    {
+        Activation::backward(in + begin, out + begin, end - begin);
+    });
+}
+
+template<typename Activation>
+NNMatrixType DepthwiseConv2DLayer<Activation>::feedforward(NNMatrixViewType input, NNMatrixType& weightedInput)
+{
+    if(derivativeFromOutput())
+    {
+        weightedInput = NNMatrixType();
+        return feedforward(input);
+    }
+
+    weightedInput = convolve(input);
+    NNMatrixType output(weightedInput.getRows(), weightedInput.getColumns(), uninitialized);
+    ActivationKernel kernel = getActivationKernel();
+    for(unsigned int i = 0; i < output.getRows(); ++i)
+    {
+        kernel(&weightedInput.view()(i, 0), &output.view()(i, 0), output.getColumns());
+    }
+    return output;
+}
+
+template<typename Activation>
+NNMatrixType DepthwiseConv2DLayer<Activation>::feedforward(NNMatrixViewType input) const
+{
+    NNMatrixType output = convolve(input);
+    if(output.getLeadingDimension() == output.getColumns())
+    {
+        activate(output.getData(), output.begin(), output.getStorageSize());
+        return output;
+    }
+    ActivationKernel kernel = getActivationKernel();
+    for(unsigned int i = 0; i < output.getRows(); ++i)
+    {
+        kernel(&output.view()(i, 0), &output.view()(i, 0), output.getColumns());
+    }
+    return output;
+}
+
+template<typename Activation>
+template<typename Op>
+void DepthwiseConv2DLayer<Activation>::forEachRun(unsigned int c, unsigned int ky, unsigned int kx, bool contiguous, Op op) const
+{
+    ConvolutionTaps::forEachRun(input_, output_, ky, kx, padding_, [&](unsigned int in, unsigned int out, unsigned int count)
+    {
+        const unsigned int inRow = c*input_.pixels() + in;
+        const unsigned int outRow = c*output_.pixels() + out;
+        if(contiguous)
+        {
+            op(inRow, outRow, count);
+            return;
+        }
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            op(inRow + i, outRow + i, 1);
+        }
+    });
+}
+
+template<typename Activation>
+NNMatrixType DepthwiseConv2DLayer<Activation>::convolve(NNMatrixViewType input) const
+{
+    if(input.getRows() != input_.size())
+    {
+        throw std::runtime_error("ERROR: Input does not match the shape of convolution layer!\n");
+    }
+
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int samples = input.getColumns();
+    const unsigned int k = kernelSize_;
+    NNMatrixType output(nodes_, samples, uninitialized);
+    MatrixView<NNDataType> out = output.view();
+    const bool contiguous = input.getLeadingDimension() == samples && output.getLeadingDimension() == samples;
+
+    NNMatrixType scratch(input_.channels, ConvolutionTaps::scratchSize(output_, k, samples), uninitialized);
+
+    ThreadPool::parallelFor(input_.channels, [&](unsigned int c)
+    {
+        const NNDataType* w = weights_.getData() + c*weights_.getLeadingDimension();
+        NNDataType* tapScratch = &scratch.view()(c, 0);
+        if(contiguous)
+        {
+            kernels.fill(&out(c*output_.pixels(), 0), bias_.getData()[c], output_.pixels()*samples);
+        }
+        for(unsigned int p = 0; p < output_.pixels() && !contiguous; ++p)
+        {
+            kernels.fill(&out(c*output_.pixels() + p, 0), bias_.getData()[c], samples);
+        }
+        for(unsigned int ky = 0; ky < k; ++ky)
+        {
+            for(unsigned int kx = 0; kx < k; ++kx)
+            {
+                const NNDataType weight = w[ky*k + kx];
+                if(contiguous)
+                {
+                    ConvolutionTaps::accumulate(input_, output_, ky, kx, padding_, weight, &input(c*input_.pixels(), 0),
+                                                &out(c*output_.pixels(), 0), samples, tapScratch);
+                    continue;
+                }
+                forEachRun(c, ky, kx, false, [&](unsigned int inRow, unsigned int outRow, unsigned int pixels)
+                {
+                    kernels.axpy(weight, &input(inRow, 0), &out(outRow, 0), pixels*samples);
+                });
+            }
+        }
+    });
+    return output;
+}
+
+template<typename Activation>
+NNMatrixType DepthwiseConv2DLayer<Activation>::propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                                              NNMatrixType& nablaW, NNMatrixType& nablaB)
+{
+    requireGradients(nablaW, nablaB);
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int samples = delta.getColumns();
+    const unsigned int k = kernelSize_;
+    NNMatrixType prevError(input_.size(), samples, zeros);
+    MatrixView<NNDataType> pe = prevError.view();
+    NNMatrixViewType d = delta.view();
+    const bool contiguous = delta.getLeadingDimension() == samples && prevOutput.getLeadingDimension() == samples;
+
+    // Every gradient of channel c comes from its own maps, so channels are independent tasks:
+    // dC/db sums the delta map, dC/dw correlates it with the input map, and dC/da of the input
+    // scatters it back through the same windows
+    ThreadPool::parallelFor(input_.channels, [&](unsigned int c)
+    {
+        const NNDataType* w = weights_.getData() + c*weights_.getLeadingDimension();
+        NNDataType* filterGradient = nablaW.begin() + c*nablaW.getLeadingDimension();
+
+        NNDataType biasGradient = 0.0f;
+        if(contiguous)
+        {
+            biasGradient = kernels.sum(&d(c*output_.pixels(), 0), output_.pixels()*samples);
+        }
+        for(unsigned int p = 0; p < output_.pixels() && !contiguous; ++p)
+        {
+            biasGradient += kernels.sum(&d(c*output_.pixels() + p, 0), samples);
+        }
+        nablaB.begin()[c] += biasGradient;
+
+        for(unsigned int ky = 0; ky < k; ++ky)
+        {
+            for(unsigned int kx = 0; kx < k; ++kx)
+            {
+                const NNDataType weight = w[ky*k + kx];
+                NNDataType weightGradient = 0.0f;
+                forEachRun(c, ky, kx, contiguous, [&](unsigned int inRow, unsigned int outRow, unsigned int pixels)
+                {
+                    weightGradient += kernels.dot(&d(outRow, 0), &prevOutput(inRow, 0), pixels*samples);
+                    kernels.axpy(weight, &d(outRow, 0), &pe(inRow, 0), pixels*samples);
+                });
+                filterGradient[ky*k + kx] += weightGradient;
+            }
+        }
+    });
+    return prevError;
+}
+
+template<typename Activation>
+void DepthwiseConv2DLayer<Activation>::serialize(std::ofstream& ofile) const
+{
+    const unsigned int ID_LEN = 3;
+    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
+    ofile.write("DWC", ID_LEN*sizeof(char));
+
+    ofile.write(Activation::ID, ID_LEN*sizeof(char));
+    const unsigned int shape[] = {input_.channels, input_.height, input_.width, kernelSize_, padding_};
+    ofile.write((char*)shape, sizeof(shape));
+
+    serializeMatricies(ofile);
+}
+
+template class DepthwiseConv2DLayer<SigmoidActivation>;
+template class DepthwiseConv2DLayer<ReLUActivation>;
@@ -1,26 +1,35 @@
 #include "layer.hpp"
+#include "optimizer.hpp"
+#include "threadPool.hpp"
+#include "workspace.hpp"
 
-#include <functional>
+Layer::Layer(unsigned int nodes, unsigned int prevNodes): Layer(nodes, nodes, prevNodes, uninitialized)
+{
+    initializeParameters(nodes + prevNodes);
+}
 
-Layer::Layer(unsigned int nodes, unsigned int prevNodes)
+Layer::Layer(unsigned int nodes, unsigned int prevNodes, MatrixUninitializedTag):
+    Layer(nodes, nodes, prevNodes, uninitialized)
 {
-    nodes_ = nodes;
-    
-    weights_ = NNMatrixType(nodes, prevNodes);
-    bias_ = NNMatrixType(nodes, 1);
+}
 
-    // initializes weights is this way so as to the keep values reasonably small
-    float r = 4.0*std::sqrt(6.0/(nodes + prevNodes));
-    weights_.randomize(-r, r);
+Layer::Layer(unsigned int nodes, unsigned int weightRows, unsigned int weightColumns, MatrixUninitializedTag):
+    nodes_(nodes),
+    accuracy_(ActivationAccuracy::Exact),
+    weights_(weightRows, weightColumns, uninitialized),
+    bias_(weightRows, 1, uninitialized),
+    // gradients exist only once the layer is trained
+    nablaW_(0, 0, uninitialized),
+    nablaB_(0, 0, uninitialized)
+{
+}
 
+void Layer::initializeParameters(unsigned int fans)
+{
+    // initializes weights is this way so as to the keep values reasonably small
+    float r = 4.0*std::sqrt(6.0/fans);
+    weights_.randomize(-r, r, RandomService::nextStream());
     bias_.zero();
-
-    nablaW_ = NNMatrixType(nodes, prevNodes);
-    nablaB_ = NNMatrixType(nodes, 1);
-
-    // start with zero gradient - it will be accumulated during backprop and added later
-    nablaW_.zero();
-    nablaB_.zero();
 }
 
 unsigned int Layer::getNodesCount() const
@@ -28,60 +37,248 @@ unsigned int Layer::getNodesCount() const
     return nodes_;
 }
 
-NNMatrixType Layer::feedforward(const NNMatrixType& input, NNMatrixType& weightedInput)
+unsigned int Layer::getInputNodesCount() const
+{
+    return weights_.getColumns();
+}
+
+size_t Layer::getWorkspaceSize(unsigned int samples) const
+{
+    // weighted input, output, derivative and delta of this layer, error of the previous one
+    // and the vector of ones summing the bias gradient
+    return 4*Workspace::matrixBytes(nodes_, samples) + Workspace::matrixBytes(getInputNodesCount(), samples) +
+           Workspace::matrixBytes(samples, 1);
+}
+
+void Layer::setActivationAccuracy(ActivationAccuracy accuracy)
+{
+    accuracy_ = accuracy;
+}
+
+void Layer::activate(const NNDataType* in, NNDataType* out, unsigned int n) const
+{
+    ActivationKernel kernel = getActivationKernel();
+    if(!kernel)
+    {
+        throw std::runtime_error("ERROR: Layer has no element-wise activation function!\n");
+    }
+    ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+    {
+        kernel(in + begin, out + begin, end - begin);
+    });
+}
+
+NNMatrixType Layer::feedforward(NNMatrixViewType input, NNMatrixType& weightedInput)
+{
+    if(derivativeFromOutput())
+    {
+        weightedInput = NNMatrixType();
+        return feedforward(input);
+    }
+
+    // the epilogue leaves z in weightedInput and writes f(z) to output
+    weightedInput = NNMatrixType(nodes_, input.getColumns(), uninitialized);
+    NNMatrixType output(nodes_, input.getColumns(), uninitialized);
+    GemmEpilogue<NNDataType> epilogue(bias_.getData(), getActivationKernel(), output.begin(), output.getLeadingDimension());
+    NNMatrixType::gemm(1.0f, weights_, MatrixOp::Normal, input, MatrixOp::Normal, 0.0f, weightedInput, epilogue);
+    return output;
+}
+
+NNMatrixType Layer::feedforward(NNMatrixViewType input) const
 {
-    weightedInput = calculateWeightedInput(input);
-    return weightedInput.map(std::bind(&Layer::activationFunction, this, std::placeholders::_1));
+    // f(z) overwrites z in cache, before the tile is ever written back
+    NNMatrixType output(nodes_, input.getColumns(), uninitialized);
+    GemmEpilogue<NNDataType> epilogue(bias_.getData(), getActivationKernel(), output.begin(), output.getLeadingDimension());
+    NNMatrixType::gemm(1.0f, weights_, MatrixOp::Normal, input, MatrixOp::Normal, 0.0f, output, epilogue);
+    return output;
 }
 
-NNMatrixType Layer::feedforward(const NNMatrixType& input) const
+NNMatrixType Layer::backpropagate(const NNMatrixType& error,
+                                    const NNMatrixType& weightedInput,
+                                    const NNMatrixType& output,
+                                    NNMatrixViewType prevOutput)
 {
-    NNMatrixType weightedInput = calculateWeightedInput(input);
-    return weightedInput.map(std::bind(&Layer::activationFunction, this, std::placeholders::_1));
+    return backpropagate(error, weightedInput, output, prevOutput, nablaW_, nablaB_);
 }
 
 NNMatrixType Layer::backpropagate(const NNMatrixType& error,
                                     const NNMatrixType& weightedInput,
-                                    const NNMatrixType& prevOutput)
+                                    const NNMatrixType& output,
+                                    NNMatrixViewType prevOutput,
+                                    NNMatrixType& nablaW,
+                                    NNMatrixType& nablaB)
 {
     // Calculates dC/dz = dC/da * da/dz, where da/dz is the derivative of the activation function
-    NNMatrixType delta = error.hadamard(weightedInput.map(std::bind(&Layer::activationDerivative, this, std::placeholders::_1)));
-    // dC/dw = dC/dz * dz/dw
-    NNMatrixType nablaW = delta * NNMatrixType::transpose(prevOutput);
+    const NNMatrixType& derivativeInput = derivativeFromOutput() ? output : weightedInput;
+    NNMatrixType delta(derivativeInput.getRows(), derivativeInput.getColumns(), uninitialized);
+    activateDerivative(derivativeInput.getData(), delta.begin(), derivativeInput.getStorageSize());
+    delta = error.hadamard(delta);
+
+    return propagateDelta(delta, prevOutput, nablaW, nablaB);
+}
+
+bool Layer::outputDelta(const CostFunctionStrategy&, NNMatrixViewType, NNMatrixViewType, NNMatrixType&) const
+{
+    return false;
+}
 
-    // dC/da for the next layer
-    NNMatrixType output = NNMatrixType::transpose(weights_) * delta;
+NNMatrixType Layer::propagateDelta(const NNMatrixType& delta, NNMatrixViewType prevOutput,
+                                   NNMatrixType& nablaW, NNMatrixType& nablaB)
+{
+    requireGradients(nablaW, nablaB);
 
-    // Accumulate the gradients
-    nablaW_ += nablaW;
-    nablaB_ += delta;
+    // dC/da for the next layer, W^T * delta reads the weights as they are stored
+    NNMatrixType prevError(weights_.getColumns(), delta.getColumns(), uninitialized);
+    NNMatrixType::gemm(1.0f, weights_, MatrixOp::Transpose, delta, MatrixOp::Normal, 0.0f, prevError);
 
-    return output;
+    // Accumulate the gradients summed over the batch: dC/dw = delta * prevOutput^T is a single
+    // product added to nablaW, dC/db sums the columns of delta (a product with a vector of ones)
+    NNMatrixType::gemm(1.0f, delta, MatrixOp::Normal, prevOutput, MatrixOp::Transpose, 1.0f, nablaW);
+    NNMatrixType::gemv(1.0f, delta, MatrixOp::Normal, NNMatrixType(delta.getColumns(), 1), 1.0f, nablaB);
+
+    return prevError;
 }
 
-NNMatrixType Layer::calculateWeightedInput(const NNMatrixType& input) const
+NNMatrixType Layer::calculateWeightedInput(NNMatrixViewType input) const
 {
-    return weights_*input + bias_;
+    // the bias is added to every tile of the product by the GEMM epilogue
+    NNMatrixType result(nodes_, input.getColumns(), uninitialized);
+    GemmEpilogue<NNDataType> epilogue(bias_.getData(), nullptr, nullptr, 0);
+    NNMatrixType::gemm(1.0f, weights_, MatrixOp::Normal, input, MatrixOp::Normal, 0.0f, result, epilogue);
+    return result;
 }
 
-void Layer::performSDGStep(float learningRate)
+void Layer::applyGradients(const Optimizer& optimizer, float learningRate)
 {
-    weights_ -= nablaW_ * learningRate;
-    bias_ -= nablaB_ * learningRate;
+    applyGradients(optimizer, learningRate, nablaW_, nablaB_);
+}
+
+void Layer::applyGradients(const Optimizer& optimizer, float learningRate, NNMatrixType& nablaW, NNMatrixType& nablaB)
+{
+    // a single pass per matrix also resets the gradient values for the next batch
+    optimizer.update(weights_, nablaW, weightMoments_.data(), learningRate);
+    optimizer.update(bias_, nablaB, biasMoments_.data(), learningRate);
+}
+
+void Layer::applySharedGradients(const Optimizer& optimizer, float learningRate, NNMatrixType& nablaW, NNMatrixType& nablaB)
+{
+    optimizer.updateShared(weights_, nablaW, weightMoments_.data(), learningRate);
+    optimizer.updateShared(bias_, nablaB, biasMoments_.data(), learningRate);
+}
+
+void Layer::allocateGradients()
+{
+    if(hasGradients())
+    {
+        return;
+    }
+
+    // start with zero gradient - it will be accumulated during backprop and added later
+    nablaW_ = NNMatrixType(weights_.getRows(), weights_.getColumns(), zeros);
+    nablaB_ = NNMatrixType(bias_.getRows(), 1, zeros);
+}
+
+bool Layer::hasGradients() const
+{
+    return nablaW_.getRows() == weights_.getRows() && nablaW_.getColumns() == weights_.getColumns() &&
+           nablaB_.getRows() == bias_.getRows();
+}
+
+void Layer::requireGradients(const NNMatrixType& nablaW, const NNMatrixType& nablaB) const
+{
+    if(nablaW.getRows() != weights_.getRows() || nablaW.getColumns() != weights_.getColumns() ||
+       nablaB.getRows() != bias_.getRows())
+    {
+        throw std::runtime_error("ERROR: Layer gradients are not allocated, call allocateGradients before backpropagation!\n");
+    }
+}
+
+void Layer::allocateOptimizerState(unsigned int count)
+{
+    if(weightMoments_.size() == count)
+    {
+        return;
+    }
 
-    // Reset gradient values (for next batch)
-    nablaW_.zero();
-    nablaB_.zero();
+    weightMoments_.clear();
+    biasMoments_.clear();
+    for(unsigned int k = 0; k < count; ++k)
+    {
+        weightMoments_.emplace_back(weights_.getRows(), weights_.getColumns(), zeros);
+        biasMoments_.emplace_back(bias_.getRows(), 1, zeros);
+    }
+}
+
+void Layer::releaseOptimizerState()
+{
+    weightMoments_.clear();
+    biasMoments_.clear();
+}
+
+unsigned int Layer::getOptimizerStateCount() const
+{
+    return weightMoments_.size();
 }
 
 void Layer::serializeMatricies(std::ofstream& ofile) const
 {
     auto rows = weights_.getRows();
     auto columns = weights_.getColumns();
-    auto len = rows*columns;
     
     ofile.write((char*)&rows, sizeof(rows));
     ofile.write((char*)&columns, sizeof(columns));
-    ofile.write((char*)weights_.getData(), len*sizeof(NNDataType));
-    ofile.write((char*)bias_.getData(), rows*sizeof(NNDataType));
+    writePacked(ofile, weights_);
+    writePacked(ofile, bias_);
+}
+void Layer::deserializeMatricies(std::ifstream& ifile)
+{
+    readPacked(ifile, weights_);
+    readPacked(ifile, bias_);
+}
+
+void Layer::serializeOptimizerState(std::ofstream& ofile) const
+{
+    unsigned int count = weightMoments_.size();
+    ofile.write((char*)&count, sizeof(count));
+    for(unsigned int k = 0; k < count; ++k)
+    {
+        writePacked(ofile, weightMoments_[k]);
+        writePacked(ofile, biasMoments_[k]);
+    }
+}
+
+void Layer::deserializeOptimizerState(std::ifstream& ifile)
+{
+    for(unsigned int k = 0; k < weightMoments_.size(); ++k)
+    {
+        readPacked(ifile, weightMoments_[k]);
+        readPacked(ifile, biasMoments_[k]);
+    }
+}
+
+void Layer::writePacked(std::ofstream& ofile, const NNMatrixType& m)
+{
+    if(m.getLeadingDimension() == m.getColumns())
+    {
+        ofile.write((char*)m.getData(), m.getStorageSize()*sizeof(NNDataType));
+        return;
+    }
+    for(unsigned int i = 0; i < m.getRows(); ++i)
+    {
+        ofile.write((char*)(m.getData() + i*m.getLeadingDimension()), m.getColumns()*sizeof(NNDataType));
+    }
+}
+
+void Layer::readPacked(std::ifstream& ifile, NNMatrixType& m)
+{
+    // packed rows of the file land in the (possibly padded) rows of m
+    if(m.getLeadingDimension() == m.getColumns())
+    {
+        ifile.read((char*)m.begin(), m.getStorageSize()*sizeof(NNDataType));
+        return;
+    }
+    for(unsigned int i = 0; i < m.getRows(); ++i)
+    {
+        ifile.read((char*)(m.begin() + i*m.getLeadingDimension()), m.getColumns()*sizeof(NNDataType));
+    }
 }
\ No newline at end of file
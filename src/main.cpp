@@ -1,8 +1,28 @@
+#include "threadPool.hpp"
 #include "userInterface.hpp"
 
-int main()
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv)
 {
+    // --threads N (or -t N) overrides NN_THREADS environment variable, 0 means one thread per core
+    for(int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if((arg == "--threads" || arg == "-t") && i + 1 < argc)
+        {
+            ThreadPool::setThreadCount((unsigned int)std::strtoul(argv[++i], nullptr, 10));
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--threads N]\n";
+            return 1;
+        }
+    }
+
     UserInterface::handleInteraction();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,132 @@
+#include "maxPool2DLayer.hpp"
+
+#include "threadPool.hpp"
+
+MaxPool2DLayer::MaxPool2DLayer(TensorShape input, unsigned int size):
+    Layer(input.channels*(size ? input.height/size : 0)*(size ? input.width/size : 0), 0, 0, uninitialized),
+    input_(input),
+    output_{input.channels, size ? input.height/size : 0, size ? input.width/size : 0},
+    size_(size)
+{
+    if(size == 0 || size > input.height || size > input.width)
+    {
+        throw std::runtime_error("ERROR: Pooling window does not fit the input!\n");
+    }
+}
+
+void MaxPool2DLayer::activateDerivative(const NNDataType*, NNDataType*, unsigned int) const
+{
+    throw std::runtime_error("ERROR: Max pooling has no element-wise derivative!\n");
+}
+
+NNMatrixType MaxPool2DLayer::feedforward(NNMatrixViewType input, NNMatrixType& weightedInput)
+{
+    // backpropagation needs only the output
+    weightedInput = NNMatrixType();
+    return feedforward(input);
+}
+
+NNMatrixType MaxPool2DLayer::feedforward(NNMatrixViewType input) const
+{
+    if(input.getRows() != input_.size())
+    {
+        throw std::runtime_error("ERROR: Input does not match the shape of pooling layer!\n");
+    }
+
+    const unsigned int samples = input.getColumns();
+    NNMatrixType output(nodes_, samples, uninitialized);
+    MatrixView<NNDataType> out = output.view();
+
+    // Every output row is reduced window entry by window entry: the first entry initializes it and
+    // the others take the maximum. The innermost loop runs along the output row, which stays long
+    // when a single sample goes through the layer
+    const unsigned int ldIn = input.getLeadingDimension();
+    const unsigned int ldOut = output.getLeadingDimension();
+    ThreadPool::parallelFor(input_.channels, [&](unsigned int c)
+    {
+        for(unsigned int oy = 0; oy < output_.height; ++oy)
+        {
+            NNDataType* maximum = &out((c*output_.height + oy)*output_.width, 0);
+            const NNDataType* window = &input((c*input_.height + oy*size_)*input_.width, 0);
+            for(unsigned int n = 0; n < samples; ++n)
+            {
+                for(unsigned int ox = 0; ox < output_.width; ++ox)
+                {
+                    maximum[ox*ldOut + n] = window[ox*size_*ldIn + n];
+                }
+            }
+            for(unsigned int dy = 0; dy < size_; ++dy)
+            {
+                for(unsigned int dx = 0; dx < size_; ++dx)
+                {
+                    const NNDataType* in = window + (dy*input_.width + dx)*ldIn;
+                    for(unsigned int n = 0; n < samples; ++n)
+                    {
+                        for(unsigned int ox = 0; ox < output_.width; ++ox)
+                        {
+                            maximum[ox*ldOut + n] = std::max(maximum[ox*ldOut + n], in[ox*size_*ldIn + n]);
+                        }
+                    }
+                }
+            }
+        }
+    });
+    return output;
+}
+
+NNMatrixType MaxPool2DLayer::backpropagate(const NNMatrixType& error,
+                                           const NNMatrixType&,
+                                           const NNMatrixType& output,
+                                           NNMatrixViewType prevOutput,
+                                           NNMatrixType&,
+                                           NNMatrixType&)
+{
+    const unsigned int samples = error.getColumns();
+    NNMatrixType prevError(input_.size(), samples, zeros);
+    MatrixView<NNDataType> pe = prevError.view();
+    NNMatrixViewType g = error.view();
+    NNMatrixViewType a = output.view();
+
+    ThreadPool::parallelFor(input_.channels, [&](unsigned int c)
+    {
+        for(unsigned int oy = 0; oy < output_.height; ++oy)
+        {
+            for(unsigned int ox = 0; ox < output_.width; ++ox)
+            {
+                const unsigned int i = (c*output_.height + oy)*output_.width + ox;
+                const unsigned int first = (c*input_.height + oy*size_)*input_.width + ox*size_;
+                for(unsigned int n = 0; n < samples; ++n)
+                {
+                    // the first input equal to the maximum gets the whole error of the window
+                    bool routed = false;
+                    for(unsigned int dy = 0; dy < size_ && !routed; ++dy)
+                    {
+                        for(unsigned int dx = 0; dx < size_ && !routed; ++dx)
+                        {
+                            const unsigned int j = first + dy*input_.width + dx;
+                            if(prevOutput(j, n) == a(i, n))
+                            {
+                                pe(j, n) = g(i, n);
+                                routed = true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+    return prevError;
+}
+
+void MaxPool2DLayer::serialize(std::ofstream& ofile) const
+{
+    const char* id = "MXP";
+    const unsigned int ID_LEN = 3;
+    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
+    ofile.write(id, ID_LEN*sizeof(char));
+
+    const unsigned int shape[] = {input_.channels, input_.height, input_.width, size_};
+    ofile.write((char*)shape, sizeof(shape));
+
+    serializeMatricies(ofile);
+}
@@ -2,20 +2,32 @@
 
 #include "matrix.hpp"
 
-NNDataType MeanSquereErrorCost::calculateCost(const NNMatrixType& output, const NNMatrixType& target) const
+NNDataType MeanSquereErrorCost::calculateCost(NNMatrixViewType output, NNMatrixViewType target) const
 {
     NNDataType error = 0;
-    NNMatrixType difference = output - target;
-    for(auto it = difference.cbegin(); it < difference.cend(); ++it)
+    for(unsigned int i = 0; i < output.getRows(); ++i)
     {
-        error += *it * (*it);
+        for(unsigned int j = 0; j < output.getColumns(); ++j)
+        {
+            NNDataType difference = output(i, j) - target(i, j);
+            error += difference*difference;
+        }
     }
     return 0.5 * error;
 }
 
-NNMatrixType MeanSquereErrorCost::calculateCostDerivative(const NNMatrixType& output, const NNMatrixType& target) const
+NNMatrixType MeanSquereErrorCost::calculateCostDerivative(NNMatrixViewType output, NNMatrixViewType target) const
 {
-    return output - target;
+    NNMatrixType result(output.getRows(), output.getColumns(), uninitialized);
+    MatrixView<NNDataType> difference = result.view();
+    for(unsigned int i = 0; i < output.getRows(); ++i)
+    {
+        for(unsigned int j = 0; j < output.getColumns(); ++j)
+        {
+            difference(i, j) = output(i, j) - target(i, j);
+        }
+    }
+    return result;
 }
 
 void MeanSquereErrorCost::serialize(std::ofstream& ofile) const
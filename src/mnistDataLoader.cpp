@@ -4,8 +4,6 @@
 
 #include "data_load_failure.hpp"
 
-typedef std::vector<NNMatrixType> MatrixVec;
-
 int MNISTDataLoader::reverseInt(int number)
 {
     // divides int into 4 chunks and concats them in reversed order
@@ -37,13 +35,14 @@ MNISTData MNISTDataLoader::loadData(const char* trainingImagesFilename,
     int nLoadedTestingLabels;
     auto testingLabels = loadLabels(testingLabelsFilename, nLoadedTestingLabels);
 
-    MatrixVec trainingDataMatrix, trainingLabelsMatrix, testingDataMatrix, testingLabelsMatrix;
+    NNMatrixType trainingDataMatrix, trainingLabelsMatrix, testingDataMatrix, testingLabelsMatrix;
     createMatriciesFromRawData(trainingImages, std::move(trainingLabels), nLoadedTrainingImages, 
                                 imagePixels, trainingDataMatrix, trainingLabelsMatrix);
     createMatriciesFromRawData(testingImages, std::move(testingLabels), nLoadedTestingImages, 
                                 imagePixels, testingDataMatrix, testingLabelsMatrix);
     
-    return MNISTData(trainingDataMatrix, trainingLabelsMatrix, testingDataMatrix, testingLabelsMatrix);
+    return MNISTData(std::move(trainingDataMatrix), std::move(trainingLabelsMatrix),
+                     std::move(testingDataMatrix), std::move(testingLabelsMatrix));
 }
 
 void MNISTDataLoader::loadImages(const char* imagesFilename, 
@@ -110,34 +109,26 @@ void MNISTDataLoader::createMatriciesFromRawData(const std::vector<std::unique_p
                                              std::unique_ptr<char[]> labels, 
                                              int nData, 
                                              int imagePixels, 
-                                             MatrixVec& imagesMatricies, 
-                                             MatrixVec& lablesMatricies)
+                                             NNMatrixType& imagesMatrix, 
+                                             NNMatrixType& labelsMatrix)
 {
     const int POSSIBLE_LABELS = 10;
 
-    std::unique_ptr<float[]> imageMatrixData = std::make_unique<float[]>(imagePixels);
-    float labelMatrixData[POSSIBLE_LABELS];
-
-    imagesMatricies.clear();
-    lablesMatricies.clear();
-    imagesMatricies.reserve(nData);
-    lablesMatricies.reserve(nData);
+    // one sample per row, all samples of a set in a single allocation
+    imagesMatrix = NNMatrixType(nData, imagePixels, uninitialized);
+    labelsMatrix = NNMatrixType(nData, POSSIBLE_LABELS, zeros);
 
+    MatrixView<float> imagesView = imagesMatrix.view();
+    MatrixView<float> labelsView = labelsMatrix.view();
     for(int i = 0; i < nData; ++i)
     {
         for(int j = 0; j < imagePixels; ++j)
         {
-            imageMatrixData[j] = (unsigned char)(images[i][j])/255.0f;
+            imagesView(i, j) = (unsigned char)(images[i][j])/255.0f;
         }
-        imagesMatricies.emplace_back(NNMatrixType(imageMatrixData.get(), imagePixels, 1));
-        
+
         // convert from label to matrix by setting matrix entry to 1 in specific place
         int label = +labels[i];
-        for(int n = 0; n < POSSIBLE_LABELS; ++n)
-        {
-            if(n != label) labelMatrixData[n] = 0.0f;
-            else labelMatrixData[n] = 1.0f;
-        }
-        lablesMatricies.emplace_back(NNMatrixType(labelMatrixData, POSSIBLE_LABELS, 1));
+        labelsView(i, label) = 1.0f;
     }
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "momentumOptimizer.hpp"
+
+#include "simdKernels.hpp"
+
+MomentumOptimizer::MomentumOptimizer(float momentum, bool nesterov): momentum_(momentum), nesterov_(nesterov)
+{
+}
+
+void MomentumOptimizer::step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                             float learningRate, size_t n) const
+{
+    SimdKernels::get().momentumStep(parameters, gradient, moments[0], learningRate, momentum_, nesterov_, n);
+}
+
+void MomentumOptimizer::serialize(std::ofstream& ofile) const
+{
+    const char* id = nesterov_ ? "NAG" : "MOM";
+    const unsigned int ID_SIZE = 3;
+    ofile.write((char*)&ID_SIZE, sizeof(ID_SIZE));
+    ofile.write(id, ID_SIZE*sizeof(char));
+    ofile.write((char*)&momentum_, sizeof(momentum_));
+}
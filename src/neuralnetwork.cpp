@@ -1,24 +1,43 @@
 #include <algorithm>
-#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 
+#include "adamWOptimizer.hpp"
+#include "conv2DLayer.hpp"
 #include "costFunctionStrategy.hpp"
 #include "crossEntropyCost.hpp"
 #include "data_load_failure.hpp"
+#include "depthwiseConv2DLayer.hpp"
+#include "maxPool2DLayer.hpp"
 #include "meanSquereErrorCost.hpp"
+#include "momentumOptimizer.hpp"
 #include "neuralnetwork.hpp"
 #include "reluLayer.hpp"
+#include "rmsPropOptimizer.hpp"
+#include "sgdOptimizer.hpp"
 #include "sigmoidLayer.hpp"
+#include "simdKernels.hpp"
+#include "softmaxLayer.hpp"
+#include "threadPool.hpp"
+#include "workspace.hpp"
 
 NeuralNetwork::NeuralNetwork(unsigned int inputNodes, float learningRate, std::unique_ptr<CostFunctionStrategy> costFunction): 
     inputNodes_(inputNodes),
     outputNodes_(inputNodes),
     learningRate_(learningRate),
-    costFunction_(std::move(costFunction))
+    numericChecks_(false),
+    trainingWorkers_(1),
+    activationAccuracy_(ActivationAccuracy::Exact),
+    costFunction_(std::move(costFunction)),
+    optimizer_(std::make_unique<SGDOptimizer>()),
+    workspace_(std::make_unique<Workspace>())
 {}
 
+NeuralNetwork::NeuralNetwork(NeuralNetwork&& o) = default;
+NeuralNetwork& NeuralNetwork::operator=(NeuralNetwork&& o) = default;
+NeuralNetwork::~NeuralNetwork() = default;
+
 unsigned int NeuralNetwork::getLayersCount() const
 {
     return layers_.size();
@@ -29,26 +48,131 @@ unsigned int NeuralNetwork::getOutputNodesCount() const
     return outputNodes_;
 }
 
-NNMatrixType NeuralNetwork::feedforward(const NNMatrixType& input) const
+void NeuralNetwork::setNumericChecks(bool enabled)
+{
+    numericChecks_ = enabled;
+}
+
+bool NeuralNetwork::getNumericChecks() const
+{
+    return numericChecks_;
+}
+
+void NeuralNetwork::setOptimizer(std::unique_ptr<Optimizer> optimizer)
 {
-    if(input.getRows() != inputNodes_ || input.getColumns() != 1)
+    optimizer_ = std::move(optimizer);
+    for(auto& layer : layers_)
+    {
+        layer->releaseOptimizerState();
+    }
+}
+
+const Optimizer& NeuralNetwork::getOptimizer() const
+{
+    return *optimizer_;
+}
+
+void NeuralNetwork::setTrainingWorkers(unsigned int workers)
+{
+    trainingWorkers_ = workers;
+}
+
+unsigned int NeuralNetwork::getTrainingWorkers() const
+{
+    return trainingWorkers_;
+}
+
+void NeuralNetwork::setActivationAccuracy(ActivationAccuracy accuracy)
+{
+    activationAccuracy_ = accuracy;
+    for(auto& layer : layers_)
+    {
+        layer->setActivationAccuracy(accuracy);
+    }
+}
+
+ActivationAccuracy NeuralNetwork::getActivationAccuracy() const
+{
+    return activationAccuracy_;
+}
+
+NNMatrixType NeuralNetwork::feedforward(NNMatrixViewType input) const
+{
+    if(input.getRows() != inputNodes_)
     {
         throw std::runtime_error("ERROR: passed input matrix has wrong dimensions!\n");
     }
 
-    NNMatrixType result = input;
-    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    if(layers_.empty())
+    {
+        return NNMatrixType(input);
+    }
+
+    // The first layer reads the input in place, without copying it
+    NNMatrixType result = layers_.front()->feedforward(input);
+    if(numericChecks_) result.sanitize();
+    for(auto it = layers_.begin() + 1; it < layers_.end(); ++it)
     {
         result = (*it)->feedforward(result);
+        if(numericChecks_) result.sanitize();
     }
 
     return result;
 }
 
+NNMatrixViewType NeuralNetwork::feedforward(NNMatrixViewType input, Workspace& workspace) const
+{
+    // the result is copied out of the arena before it is rewound, into a matrix that is
+    // reallocated only when the batch size changes
+    NNMatrixType& output = workspace.output_;
+    if(output.getRows() != outputNodes_ || output.getColumns() != input.getColumns())
+    {
+        output = NNMatrixType(outputNodes_, input.getColumns(), uninitialized);
+    }
+
+    {
+        ArenaScope scope(workspace.arena_);
+        NNMatrixType result = feedforward(input);
+        output = result;
+    }
+    return output.view();
+}
+
+size_t NeuralNetwork::getWorkspaceSize(unsigned int batchSize) const
+{
+    // gathered inputs and targets, dC/da of the output and the per-layer vectors of batchTrain
+    size_t bytes = Workspace::matrixBytes(inputNodes_, batchSize) + 2*Workspace::matrixBytes(outputNodes_, batchSize) +
+                   2*(layers_.size()*sizeof(NNMatrixType) + Arena::ALIGNMENT);
+    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    {
+        bytes += (*it)->getWorkspaceSize(batchSize);
+    }
+    return bytes;
+}
+
+std::vector<NNMatrixViewType> NeuralNetwork::viewsOf(const std::vector<NNMatrixType>& matrices)
+{
+    std::vector<NNMatrixViewType> views;
+    views.reserve(matrices.size());
+    for(auto it = matrices.begin(); it < matrices.end(); ++it)
+    {
+        views.emplace_back(it->view());
+    }
+    return views;
+}
+
 void NeuralNetwork::train(unsigned int epochs, 
                           unsigned int batchSize, 
                           const std::vector<NNMatrixType>& inputs, 
                           const std::vector<NNMatrixType>& targets)
+{
+    train(epochs, batchSize, viewsOf(inputs), viewsOf(targets));
+}
+
+void NeuralNetwork::train(unsigned int epochs, 
+                          unsigned int batchSize, 
+                          const std::vector<NNMatrixViewType>& inputs, 
+                          const std::vector<NNMatrixViewType>& targets)
 {
     // Prepare permutation table for training data shuffle
     size_t trainingSize = inputs.size();
@@ -58,86 +182,309 @@ void NeuralNetwork::train(unsigned int epochs,
         permutaionTable[i] = i;
     }
 
-    // Initialize PRNG
-    int seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::mt19937 generator(seed);
+    // Shuffles are drawn from the shared service, so seeding it makes training reproducible
+    Philox generator = RandomService::nextStream();
 
     unsigned int numBatches = std::ceil((float)trainingSize / batchSize);
 
-    NNMatrixType input{inputNodes_, 1};
-    NNMatrixType target{outputNodes_, 1};
+    // Training state is created on first use, before the workspace would take the allocations
+    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    {
+        (*it)->allocateGradients();
+        (*it)->allocateOptimizerState(optimizer_->getStateCount());
+    }
+
+    // Parts of a split batch have their own gradients and workspaces
+    const unsigned int workers = std::min(trainingWorkers_ ? trainingWorkers_ : ThreadPool::getThreadCount(), batchSize);
+    std::vector<Gradients> workerGradients;
+    std::vector<Workspace> workerWorkspaces;
+    if(workers <= 1)
+    {
+        workspace_->reserve(getWorkspaceSize(batchSize));
+    }
+    else
+    {
+        workerGradients.reserve(workers);
+        workerWorkspaces.reserve(workers);
+        for(unsigned int w = 0; w < workers; ++w)
+        {
+            workerGradients.emplace_back(makeGradients());
+            workerWorkspaces.emplace_back(getWorkspaceSize((batchSize + workers - 1)/workers));
+        }
+    }
 
     for(unsigned int epoch = 0; epoch < epochs; ++epoch)
     {
         std::cout << "Epoch " << epoch + 1 << " out of " << epochs << "\n";
         std::shuffle(permutaionTable.begin(), permutaionTable.end(), generator);
         
-        unsigned int idx = 0;
         for(unsigned int n = 0; n < numBatches; ++n)
         {
-            // Train on single batch
-            for(unsigned int i = 0; i < batchSize; ++i)
+            const unsigned int first = n*batchSize;
+            const unsigned int count = std::min<size_t>(batchSize, trainingSize - first);
+            if(workers > 1)
             {
-                if(idx >= trainingSize) break;
-
-                input = inputs[permutaionTable[idx]];
-                target = targets[permutaionTable[idx]];
-
-                singleInputTrain(input, target);
-                idx += 1;
+                parallelBatchTrain(inputs, targets, permutaionTable.data() + first, count, workerGradients, workerWorkspaces);
+            }
+            else
+            {
+                // Train on single batch, gathered into matrices with a sample per column
+                ArenaScope scope(workspace_->arena_);
+                NNMatrixType batchInputs = gatherColumns(inputs, permutaionTable.data() + first, count);
+                NNMatrixType batchTargets = gatherColumns(targets, permutaionTable.data() + first, count);
+                batchTrain(batchInputs, batchTargets);
             }
             
             // Adjust weights and biases after finishing batch
+            optimizer_->beginStep();
             for(auto it = layers_.begin(); it < layers_.end(); ++it)
             {
-                (*it)->performSDGStep(learningRate_);
+                (*it)->applyGradients(*optimizer_, learningRate_);
+            }
+        }
+    }
+}
+
+void NeuralNetwork::trainAsync(unsigned int threads,
+                               unsigned int epochs,
+                               unsigned int batchSize,
+                               const std::vector<NNMatrixType>& inputs,
+                               const std::vector<NNMatrixType>& targets)
+{
+    trainAsync(threads, epochs, batchSize, viewsOf(inputs), viewsOf(targets));
+}
+
+void NeuralNetwork::trainAsync(unsigned int threads,
+                               unsigned int epochs,
+                               unsigned int batchSize,
+                               const std::vector<NNMatrixViewType>& inputs,
+                               const std::vector<NNMatrixViewType>& targets)
+{
+    const size_t trainingSize = inputs.size();
+    if(threads == 0)
+    {
+        threads = ThreadPool::getThreadCount();
+    }
+    threads = std::max<size_t>(1, std::min<size_t>(threads, trainingSize));
+
+    std::vector<unsigned int> permutaionTable(trainingSize);
+    for(size_t i = 0; i < trainingSize; ++i)
+    {
+        permutaionTable[i] = i;
+    }
+    Philox generator = RandomService::nextStream();
+
+    // Weights and optimizer moments are shared, gradients and temporaries belong to a thread
+    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    {
+        (*it)->allocateOptimizerState(optimizer_->getStateCount());
+    }
+    std::vector<Gradients> gradients;
+    std::vector<Workspace> workspaces;
+    gradients.reserve(threads);
+    workspaces.reserve(threads);
+    for(unsigned int t = 0; t < threads; ++t)
+    {
+        gradients.emplace_back(makeGradients());
+        workspaces.emplace_back(getWorkspaceSize(batchSize));
+    }
+
+    for(unsigned int epoch = 0; epoch < epochs; ++epoch)
+    {
+        std::cout << "Epoch " << epoch + 1 << " out of " << epochs << "\n";
+        std::shuffle(permutaionTable.begin(), permutaionTable.end(), generator);
+
+        // Parallel work inside a task runs inline, so every thread does its own products
+        ThreadPool::parallelFor(threads, [&](unsigned int t)
+        {
+            const size_t shardEnd = trainingSize*(t + 1)/threads;
+            for(size_t first = trainingSize*t/threads; first < shardEnd; first += batchSize)
+            {
+                {
+                    ArenaScope scope(workspaces[t].arena_);
+                    const unsigned int count = std::min<size_t>(batchSize, shardEnd - first);
+                    NNMatrixType batchInputs = gatherColumns(inputs, permutaionTable.data() + first, count);
+                    NNMatrixType batchTargets = gatherColumns(targets, permutaionTable.data() + first, count);
+                    batchTrain(batchInputs, batchTargets, &gradients[t]);
+                }
+
+                // Lock-free update of the shared weights and moments with relaxed atomic accesses. The products
+                // of the other threads' batches still read weights and biases with plain loads while this
+                // writes them; Hogwild! accepts those stale reads, and tsan.supp names this one race
+                optimizer_->beginStep();
+                for(unsigned int idx = 0; idx < layers_.size(); ++idx)
+                {
+                    layers_[idx]->applySharedGradients(*optimizer_, learningRate_, gradients[t].weights[idx], gradients[t].biases[idx]);
+                }
+            }
+        });
+    }
+}
+
+void NeuralNetwork::parallelBatchTrain(const std::vector<NNMatrixViewType>& inputs, const std::vector<NNMatrixViewType>& targets,
+                                       const unsigned int* indices, unsigned int count,
+                                       std::vector<Gradients>& gradients, std::vector<Workspace>& workspaces)
+{
+    // Part p takes samples [count*p/parts, count*(p + 1)/parts) of the batch, whichever thread runs it
+    const unsigned int parts = gradients.size();
+    ThreadPool::parallelFor(parts, [&](unsigned int p)
+    {
+        const unsigned int first = (size_t)count*p/parts;
+        const unsigned int last = (size_t)count*(p + 1)/parts;
+        if(first == last)
+        {
+            return;
+        }
+        ArenaScope scope(workspaces[p].arena_);
+        NNMatrixType partInputs = gatherColumns(inputs, indices + first, last - first);
+        NNMatrixType partTargets = gatherColumns(targets, indices + first, last - first);
+        batchTrain(partInputs, partTargets, &gradients[p]);
+    });
+    reduceGradients(gradients);
+}
+
+void NeuralNetwork::reduceGradients(std::vector<Gradients>& gradients)
+{
+    // Entries reduced together, so that every level of the tree finds the parts' rows still in cache
+    const size_t CHUNK = 4096;
+
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int parts = gradients.size();
+
+    // Each thread takes a block of rows of the matrix, whose boundaries fall on cache lines, and sums the parts
+    // pairwise in a tree: part p += part p + s for s = 1, 2, 4, ..., so the order of the sums is fixed by the
+    // number of parts alone. Parts are cleared as they are added
+    auto reduce = [&](NNMatrixType& total, auto partOf)
+    {
+        ThreadPool::parallelRanges(total.getStorageSize(), [&](size_t begin, size_t end)
+        {
+            for(size_t chunk = begin; chunk < end; chunk += CHUNK)
+            {
+                const size_t n = std::min(CHUNK, end - chunk);
+                for(unsigned int stride = 1; stride < parts; stride *= 2)
+                {
+                    for(unsigned int p = 0; p + stride < parts; p += 2*stride)
+                    {
+                        NNDataType* sum = partOf(p).begin() + chunk;
+                        NNDataType* part = partOf(p + stride).begin() + chunk;
+                        kernels.add(sum, part, sum, n);
+                        kernels.fill(part, 0.0f, n);
+                    }
+                }
+                NNDataType* sum = partOf(0).begin() + chunk;
+                kernels.add(total.begin() + chunk, sum, total.begin() + chunk, n);
+                kernels.fill(sum, 0.0f, n);
             }
+        });
+    };
+
+    for(unsigned int idx = 0; idx < layers_.size(); ++idx)
+    {
+        reduce(layers_[idx]->nablaW_, [&](unsigned int p) -> NNMatrixType& { return gradients[p].weights[idx]; });
+        reduce(layers_[idx]->nablaB_, [&](unsigned int p) -> NNMatrixType& { return gradients[p].biases[idx]; });
+    }
+}
+
+NeuralNetwork::Gradients NeuralNetwork::makeGradients() const
+{
+    Gradients gradients;
+    gradients.weights.reserve(layers_.size());
+    gradients.biases.reserve(layers_.size());
+    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    {
+        gradients.weights.emplace_back((*it)->weights_.getRows(), (*it)->weights_.getColumns(), zeros);
+        gradients.biases.emplace_back((*it)->bias_.getRows(), 1, zeros);
+    }
+    return gradients;
+}
+
+NNMatrixType NeuralNetwork::gatherColumns(const std::vector<NNMatrixViewType>& samples, const unsigned int* indices, unsigned int count)
+{
+    NNMatrixType result(samples[indices[0]].getRows(), count, uninitialized);
+    MatrixView<NNDataType> columns = result.view();
+    for(unsigned int j = 0; j < count; ++j)
+    {
+        NNMatrixViewType sample = samples[indices[j]];
+        for(unsigned int i = 0; i < sample.getRows(); ++i)
+        {
+            columns(i, j) = sample(i, 0);
         }
     }
+    return result;
 }
 
-void NeuralNetwork::singleInputTrain(const NNMatrixType& input, const NNMatrixType& target)
+void NeuralNetwork::batchTrain(NNMatrixViewType input, NNMatrixViewType target, Gradients* gradients)
 {
     // forward pass
-    NNMatrixType output = input;
     // Vectors storing results of layers' calculations
-    // used in backpropagation
-    std::vector<NNMatrixType> weightedInputs;
-    std::vector<NNMatrixType> outputs;
+    // used in backpropagation. Weighted inputs stay empty for layers that take the derivative from the output
+    std::vector<NNMatrixType, ArenaAllocator<NNMatrixType>> weightedInputs;
+    std::vector<NNMatrixType, ArenaAllocator<NNMatrixType>> outputs;
     weightedInputs.reserve(layers_.size());
     outputs.reserve(layers_.size());
 
+    NNMatrixViewType layerInput = input;
     for(auto it = layers_.begin(); it < layers_.end(); ++it)
     {
         NNMatrixType weightedInput;
-        output = (*it)->feedforward(output, weightedInput);
-        weightedInputs.emplace_back(weightedInput);
-        outputs.emplace_back(output);
+        NNMatrixType output = (*it)->feedforward(layerInput, weightedInput);
+        if(numericChecks_)
+        {
+            weightedInput.sanitize();
+            output.sanitize();
+        }
+        weightedInputs.emplace_back(std::move(weightedInput));
+        outputs.emplace_back(std::move(output));
+        layerInput = outputs.back();
     }
 
-    // dC/da
-    NNMatrixType costDerivative = costFunction_->calculateCostDerivative(output, target);
-
-    unsigned int backpropIdx = layers_.size() - 1;
-    for(auto it = layers_.rbegin(); it < layers_.rend() - 1; ++it)
+    // First layer gets input instead of previous layer's output
+    auto prevOutputOf = [&](unsigned int idx) { return idx > 0 ? NNMatrixViewType(outputs[idx - 1]) : input; };
+    auto nablaWOf = [&](unsigned int idx) -> NNMatrixType& { return gradients ? gradients->weights[idx] : layers_[idx]->nablaW_; };
+    auto nablaBOf = [&](unsigned int idx) -> NNMatrixType& { return gradients ? gradients->biases[idx] : layers_[idx]->nablaB_; };
+    const unsigned int last = layers_.size() - 1;
+
+    // Output layer starts from dC/dz when its activation cancels with the cost (softmax and
+    // cross-entropy), otherwise from dC/da
+    NNMatrixType costDerivative;
+    NNMatrixType delta;
+    if(layers_[last]->outputDelta(*costFunction_, outputs[last], target, delta))
+    {
+        if(numericChecks_) delta.sanitize();
+        costDerivative = layers_[last]->propagateDelta(delta, prevOutputOf(last), nablaWOf(last), nablaBOf(last));
+    }
+    else
     {
-        costDerivative = (*it)->backpropagate(costDerivative, weightedInputs[backpropIdx], outputs[backpropIdx - 1]);
-        backpropIdx--;
+        costDerivative = costFunction_->calculateCostDerivative(outputs[last], target);
+        if(numericChecks_) costDerivative.sanitize();
+        costDerivative = layers_[last]->backpropagate(costDerivative, weightedInputs[last], outputs[last], prevOutputOf(last),
+                                                      nablaWOf(last), nablaBOf(last));
     }
 
-    // Handle first layer differently - pass input instead of last layer's output
-    costDerivative = layers_[0]->backpropagate(costDerivative, weightedInputs[0], input);
+    for(unsigned int idx = last; idx-- > 0;)
+    {
+        if(numericChecks_) costDerivative.sanitize();
+        costDerivative = layers_[idx]->backpropagate(costDerivative, weightedInputs[idx], outputs[idx], prevOutputOf(idx),
+                                                     nablaWOf(idx), nablaBOf(idx));
+    }
 }
 
 float NeuralNetwork::test(const std::vector<NNMatrixType>& inputs, 
                           const std::vector<NNMatrixType>& targets) const
 {
-    NNMatrixType result;
+    return test(viewsOf(inputs), viewsOf(targets));
+}
+
+float NeuralNetwork::test(const std::vector<NNMatrixViewType>& inputs, 
+                          const std::vector<NNMatrixViewType>& targets) const
+{
+    // every sample goes through the same workspace, so only the first one allocates
+    Workspace workspace(getWorkspaceSize(1));
     unsigned correctPredictions = 0;
     unsigned predictions = inputs.size();
     for(size_t n = 0; n < predictions; ++n)
     {
-        result = feedforward(inputs[n]);
+        NNMatrixViewType result = feedforward(inputs[n], workspace);
 
         unsigned int predictedLabel = 0;
         float currentValue = result.get(0, 0);
@@ -173,7 +520,12 @@ float NeuralNetwork::test(const std::vector<NNMatrixType>& inputs,
 
 void NeuralNetwork::addLayer(std::shared_ptr<Layer> layer)
 {
+    if(layer->getInputNodesCount() != outputNodes_)
+    {
+        throw std::runtime_error("ERROR: Layer input does not match the output of the network!\n");
+    }
     outputNodes_ = layer->getNodesCount();
+    layer->setActivationAccuracy(activationAccuracy_);
     layers_.emplace_back(layer);
 }
 
@@ -195,10 +547,17 @@ void NeuralNetwork::save(const char* filename) const
         (*it)->serialize(ofile);
     }
 
+    // Optimizer follows the layers, so files without it still load
+    optimizer_->serialize(ofile);
+    for(auto it = layers_.begin(); it < layers_.end(); ++it)
+    {
+        (*it)->serializeOptimizerState(ofile);
+    }
+
     ofile.close();
 }
 
-NeuralNetwork NeuralNetwork::load(const char* filename)
+NeuralNetwork NeuralNetwork::load(const char* filename, bool trainingState)
 {
     std::ifstream ifile(filename, std::ios::binary);
 
@@ -249,35 +608,171 @@ NeuralNetwork NeuralNetwork::load(const char* filename)
         id = std::make_unique<char[]>(idLen);
         ifile.read(id.get(), idLen*sizeof(char));
 
+        // Layers are built without initial values and the file is read straight into their weights.
+        // Convolution and pooling layers store their shape ahead of the matrices, dense layers are
+        // built from the sizes of the matrices
+        std::shared_ptr<Layer> layer = nullptr;
         unsigned int rows, columns;
+
+        if(id[0] == 'C' && id[1] == 'N' && id[2] == 'V')
+        {
+            // activation tag, input channels, height, width, filters, kernel size, padding
+            char activation[3];
+            unsigned int shape[6];
+            ifile.read(activation, sizeof(activation));
+            ifile.read((char*)shape, sizeof(shape));
+            TensorShape input{shape[0], shape[1], shape[2]};
+
+            if(activation[0] == 'S' && activation[1] == 'I' && activation[2] == 'G')
+            {
+                layer = std::make_shared<SigmoidConv2DLayer>(input, shape[3], shape[4], shape[5], uninitialized);
+            }
+            else if(activation[0] == 'R' && activation[1] == 'E' && activation[2] == 'L')
+            {
+                layer = std::make_shared<ReLUConv2DLayer>(input, shape[3], shape[4], shape[5], uninitialized);
+            }
+            else
+            {
+                throw data_load_failure(filename);
+            }
+        }
+        else if(id[0] == 'D' && id[1] == 'W' && id[2] == 'C')
+        {
+            // activation tag, channels, height, width, kernel size, padding
+            char activation[3];
+            unsigned int shape[5];
+            ifile.read(activation, sizeof(activation));
+            ifile.read((char*)shape, sizeof(shape));
+            TensorShape input{shape[0], shape[1], shape[2]};
+
+            if(activation[0] == 'S' && activation[1] == 'I' && activation[2] == 'G')
+            {
+                layer = std::make_shared<SigmoidDepthwiseConv2DLayer>(input, shape[3], shape[4], uninitialized);
+            }
+            else if(activation[0] == 'R' && activation[1] == 'E' && activation[2] == 'L')
+            {
+                layer = std::make_shared<ReLUDepthwiseConv2DLayer>(input, shape[3], shape[4], uninitialized);
+            }
+            else
+            {
+                throw data_load_failure(filename);
+            }
+        }
+        else if(id[0] == 'M' && id[1] == 'X' && id[2] == 'P')
+        {
+            // input channels, height, width, window size
+            unsigned int shape[4];
+            ifile.read((char*)shape, sizeof(shape));
+            layer = std::make_shared<MaxPool2DLayer>(TensorShape{shape[0], shape[1], shape[2]}, shape[3]);
+        }
+
         ifile.read((char*)&rows, sizeof(rows));
         ifile.read((char*)&columns, sizeof(columns));
 
-        std::shared_ptr<Layer> layer = nullptr;
+        if(layer == nullptr)
+        {
+            if(id[0] == 'S' && id[1] == 'I' && id[2] == 'G')
+            {
+                layer = std::make_shared<SigmoidLayer>(rows, columns, uninitialized);
+            }
+            else if(id[0] == 'R' && id[1] == 'E' && id[2] == 'L')
+            {
+                layer = std::make_shared<ReLULayer>(rows, columns, uninitialized);
+            }
+            else if(id[0] == 'S' && id[1] == 'M' && id[2] == 'X')
+            {
+                layer = std::make_shared<SoftmaxLayer>(rows, columns, uninitialized);
+            }
+            else
+            {
+                throw data_load_failure(filename);
+            }
+        }
 
-        if(id[0] == 'S' && id[1] == 'I' && id[2] == 'G')
+        if(!ifile || layer->weights_.getRows() != rows || layer->weights_.getColumns() != columns)
         {
-            layer = std::make_shared<SigmoidLayer>(rows, columns);
+            throw data_load_failure(filename);
         }
-        else if(id[0] == 'R' && id[1] == 'E' && id[2] == 'L')
+
+        layer->deserializeMatricies(ifile);
+        if(!ifile)
         {
-            layer = std::make_shared<ReLULayer>(rows, columns);
+            throw data_load_failure(filename);
         }
 
-        unsigned int len = rows*columns;
-        std::unique_ptr<NNDataType[]> bufferWeights = std::make_unique<NNDataType[]>(len);
-        ifile.read((char*)bufferWeights.get(), len*sizeof(NNDataType));
+        nn.addLayer(std::move(layer));
+    }
 
-        std::unique_ptr<NNDataType[]> bufferBias = std::make_unique<NNDataType[]>(rows);
-        ifile.read((char*)bufferBias.get(), rows*sizeof(NNDataType));
+    // Optimizer, missing from files saved before the optimizer could be chosen
+    ifile.read((char*)&idLen, sizeof(idLen));
+    if(ifile)
+    {
+        id = std::make_unique<char[]>(idLen);
+        ifile.read(id.get(), idLen*sizeof(char));
+
+        std::unique_ptr<Optimizer> optimizer = nullptr;
+        if(id[0] == 'S' && id[1] == 'G' && id[2] == 'D')
+        {
+            optimizer = std::make_unique<SGDOptimizer>();
+        }
+        else if((id[0] == 'M' && id[1] == 'O' && id[2] == 'M') || (id[0] == 'N' && id[1] == 'A' && id[2] == 'G'))
+        {
+            float momentum;
+            ifile.read((char*)&momentum, sizeof(momentum));
+            optimizer = std::make_unique<MomentumOptimizer>(momentum, id[0] == 'N');
+        }
+        else if(id[0] == 'R' && id[1] == 'M' && id[2] == 'S')
+        {
+            // decay, epsilon
+            float parameters[2];
+            ifile.read((char*)parameters, sizeof(parameters));
+            optimizer = std::make_unique<RMSPropOptimizer>(parameters[0], parameters[1]);
+        }
+        else if(id[0] == 'A' && id[1] == 'D' && id[2] == 'W')
+        {
+            // beta1, beta2, epsilon, weight decay, steps taken
+            float parameters[4];
+            unsigned int steps;
+            ifile.read((char*)parameters, sizeof(parameters));
+            ifile.read((char*)&steps, sizeof(steps));
+            auto adam = std::make_unique<AdamWOptimizer>(parameters[0], parameters[1], parameters[2], parameters[3]);
+            // bias corrections continue only together with the moments they belong to
+            adam->steps_ = trainingState ? steps : 0;
+            optimizer = std::move(adam);
+        }
+        else
+        {
+            throw data_load_failure(filename);
+        }
+        nn.setOptimizer(std::move(optimizer));
 
-        NNMatrixType weights = NNMatrixType(bufferWeights.get(), rows, columns);
-        NNMatrixType bias = NNMatrixType(bufferBias.get(), rows, 1);
+        // Moments of every layer, skipped unless training resumes
+        for(auto it = nn.layers_.begin(); it < nn.layers_.end(); ++it)
+        {
+            unsigned int count;
+            ifile.read((char*)&count, sizeof(count));
+            if(!ifile)
+            {
+                throw data_load_failure(filename);
+            }
 
-        layer->weights_ = weights;
-        layer->bias_ = bias;
+            if(trainingState)
+            {
+                (*it)->allocateOptimizerState(count);
+                (*it)->deserializeOptimizerState(ifile);
+            }
+            else
+            {
+                const NNMatrixType& weights = (*it)->weights_;
+                ifile.seekg((std::streamoff)count*(weights.getRows()*weights.getColumns() + weights.getRows())*sizeof(NNDataType),
+                            std::ios::cur);
+            }
+        }
 
-        nn.addLayer(std::move(layer));
+        if(!ifile)
+        {
+            throw data_load_failure(filename);
+        }
     }
 
     ifile.close();
@@ -0,0 +1,54 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+#include "threadPool.hpp"
+
+namespace
+{
+// Values updated at once by updateShared, small enough for thread-local copies on the stack
+const size_t SHARED_CHUNK = 256;
+
+void loadRelaxed(const NNDataType* shared, NNDataType* local, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) __atomic_load(shared + i, local + i, __ATOMIC_RELAXED);
+}
+
+void storeRelaxed(NNDataType* shared, NNDataType* local, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) __atomic_store(shared + i, local + i, __ATOMIC_RELAXED);
+}
+}
+
+void Optimizer::update(NNMatrixType& parameters, NNMatrixType& gradient, NNMatrixType* moments, float learningRate) const
+{
+    const unsigned int states = getStateCount();
+    ThreadPool::parallelRanges(parameters.getStorageSize(), [&](size_t begin, size_t end)
+    {
+        NNDataType* m[MAX_STATE_COUNT];
+        for(unsigned int k = 0; k < states; ++k) m[k] = moments[k].begin() + begin;
+        step(parameters.begin() + begin, gradient.begin() + begin, m, learningRate, end - begin);
+    });
+}
+
+void Optimizer::updateShared(NNMatrixType& parameters, NNMatrixType& gradient, NNMatrixType* moments, float learningRate) const
+{
+    // the gradient belongs to the calling thread, only parameters and moments are shared
+    const unsigned int states = getStateCount();
+    alignas(64) NNDataType w[SHARED_CHUNK];
+    alignas(64) NNDataType m[MAX_STATE_COUNT][SHARED_CHUNK];
+    NNDataType* local[MAX_STATE_COUNT];
+    for(unsigned int k = 0; k < MAX_STATE_COUNT; ++k) local[k] = m[k];
+    const size_t n = parameters.getStorageSize();
+    for(size_t begin = 0; begin < n; begin += SHARED_CHUNK)
+    {
+        const size_t count = std::min(SHARED_CHUNK, n - begin);
+        loadRelaxed(parameters.begin() + begin, w, count);
+        for(unsigned int k = 0; k < states; ++k) loadRelaxed(moments[k].begin() + begin, local[k], count);
+
+        step(w, gradient.begin() + begin, local, learningRate, count);
+
+        storeRelaxed(parameters.begin() + begin, w, count);
+        for(unsigned int k = 0; k < states; ++k) storeRelaxed(moments[k].begin() + begin, local[k], count);
+    }
+}
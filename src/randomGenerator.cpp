@@ -0,0 +1,90 @@
+#include "randomGenerator.hpp"
+
+#include <chrono>
+
+namespace
+{
+const uint32_t PHILOX_M0 = 0xD2511F53;
+const uint32_t PHILOX_M1 = 0xCD9E8D57;
+const uint32_t PHILOX_W0 = 0x9E3779B9;
+const uint32_t PHILOX_W1 = 0xBB67AE85;
+const unsigned int PHILOX_ROUNDS = 10;
+}
+
+Philox::Philox(uint64_t seed, uint64_t stream): position_(0), cache_(), cachedBlock_(std::numeric_limits<uint64_t>::max())
+{
+    key_[0] = (uint32_t)seed;
+    key_[1] = (uint32_t)(seed >> 32);
+    stream_[0] = (uint32_t)stream;
+    stream_[1] = (uint32_t)(stream >> 32);
+}
+
+Philox::result_type Philox::operator()()
+{
+    const uint64_t index = position_ / 4;
+    if(index != cachedBlock_)
+    {
+        cache_ = block(index);
+        cachedBlock_ = index;
+    }
+    return cache_[position_++ % 4];
+}
+
+void Philox::discard(uint64_t n)
+{
+    position_ += n;
+}
+
+std::array<uint32_t, 4> Philox::block(uint64_t index) const
+{
+    uint32_t c0 = (uint32_t)index;
+    uint32_t c1 = (uint32_t)(index >> 32);
+    uint32_t c2 = stream_[0];
+    uint32_t c3 = stream_[1];
+    uint32_t k0 = key_[0];
+    uint32_t k1 = key_[1];
+
+    for(unsigned int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        const uint64_t p0 = (uint64_t)PHILOX_M0*c0;
+        const uint64_t p1 = (uint64_t)PHILOX_M1*c2;
+        const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        const uint32_t n1 = (uint32_t)p1;
+        const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        const uint32_t n3 = (uint32_t)p0;
+        c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    return {c0, c1, c2, c3};
+}
+
+uint32_t Philox::at(uint64_t position) const
+{
+    return block(position / 4)[position % 4];
+}
+
+uint64_t Philox::getSeed() const
+{
+    return ((uint64_t)key_[1] << 32) | key_[0];
+}
+
+uint64_t Philox::getStream() const
+{
+    return ((uint64_t)stream_[1] << 32) | stream_[0];
+}
+
+std::atomic<uint64_t> RandomService::seed_{(uint64_t)std::chrono::system_clock::now().time_since_epoch().count()};
+std::atomic<uint64_t> RandomService::nextStream_{0};
+
+void RandomService::seed(uint64_t seed)
+{
+    seed_ = seed;
+    nextStream_ = 0;
+}
+
+Philox RandomService::nextStream()
+{
+    return Philox(seed_, nextStream_++);
+}
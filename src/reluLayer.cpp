@@ -1,23 +1,15 @@
 #include "reluLayer.hpp"
 
-NNDataType ReLULayer::activationFunction(NNDataType value) const
+#include "simdKernels.hpp"
+
+Layer::ActivationKernel ReLUActivation::forwardKernel(ActivationAccuracy)
 {
-    if(value < 0.0f) return 0.0f;
-    else return value;
+    return SimdKernels::get().relu;
 }
 
-NNDataType ReLULayer::activationDerivative(NNDataType value) const
+void ReLUActivation::backward(const NNDataType* in, NNDataType* out, size_t n)
 {
-    if(value < 0.0f) return 0.0f;
-    else return 1.0f;
+    SimdKernels::get().reluDerivative(in, out, n);
 }
 
-void ReLULayer::serialize(std::ofstream& ofile) const
-{
-    const char* id = "REL";
-    const unsigned int ID_LEN = 3;
-    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
-    ofile.write(id, ID_LEN*sizeof(char));
-    
-    serializeMatricies(ofile);
-}
\ No newline at end of file
+template class DenseLayer<ReLUActivation>;
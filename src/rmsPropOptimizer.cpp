@@ -0,0 +1,23 @@
+#include "rmsPropOptimizer.hpp"
+
+#include "simdKernels.hpp"
+
+RMSPropOptimizer::RMSPropOptimizer(float decay, float epsilon): decay_(decay), epsilon_(epsilon)
+{
+}
+
+void RMSPropOptimizer::step(NNDataType* parameters, NNDataType* gradient, NNDataType* const* moments,
+                            float learningRate, size_t n) const
+{
+    SimdKernels::get().rmsPropStep(parameters, gradient, moments[0], learningRate, decay_, epsilon_, n);
+}
+
+void RMSPropOptimizer::serialize(std::ofstream& ofile) const
+{
+    const char* id = "RMS";
+    const unsigned int ID_SIZE = 3;
+    ofile.write((char*)&ID_SIZE, sizeof(ID_SIZE));
+    ofile.write(id, ID_SIZE*sizeof(char));
+    ofile.write((char*)&decay_, sizeof(decay_));
+    ofile.write((char*)&epsilon_, sizeof(epsilon_));
+}
@@ -0,0 +1,16 @@
+#include "sgdOptimizer.hpp"
+
+#include "simdKernels.hpp"
+
+void SGDOptimizer::step(NNDataType* parameters, NNDataType* gradient, NNDataType* const*, float learningRate, size_t n) const
+{
+    SimdKernels::get().sgdStep(parameters, gradient, learningRate, n);
+}
+
+void SGDOptimizer::serialize(std::ofstream& ofile) const
+{
+    const char* id = "SGD";
+    const unsigned int ID_SIZE = 3;
+    ofile.write((char*)&ID_SIZE, sizeof(ID_SIZE));
+    ofile.write(id, ID_SIZE*sizeof(char));
+}
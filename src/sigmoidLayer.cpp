@@ -1,22 +1,16 @@
 #include "sigmoidLayer.hpp"
 
-NNDataType SigmoidLayer::activationFunction(NNDataType value) const
-{
-    return 1.0/(1.0 + exp(-value));
-}
+#include "simdKernels.hpp"
 
-NNDataType SigmoidLayer::activationDerivative(NNDataType value) const
+Layer::ActivationKernel SigmoidActivation::forwardKernel(ActivationAccuracy accuracy)
 {
-    NNDataType sigmoid = 1.0/(1.0 + exp(-value));
-    return sigmoid*(1.0-sigmoid);
+    const SimdKernelTable& kernels = SimdKernels::get();
+    return accuracy == ActivationAccuracy::Fast ? kernels.sigmoidFast : kernels.sigmoid;
 }
 
-void SigmoidLayer::serialize(std::ofstream& ofile) const
+void SigmoidActivation::backward(const NNDataType* in, NNDataType* out, size_t n)
 {
-    const char* id = "SIG";
-    const unsigned int ID_LEN = 3;
-    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
-    ofile.write(id, ID_LEN*sizeof(char));
-
-    serializeMatricies(ofile);
+    SimdKernels::get().sigmoidDerivative(in, out, n);
 }
+
+template class DenseLayer<SigmoidActivation>;
@@ -0,0 +1,491 @@
+#include "simdKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "gemm.hpp"
+
+namespace
+{
+const unsigned int GEMM_MR = Gemm<float>::MR;
+const unsigned int GEMM_NR = Gemm<float>::NR;
+
+// Transposes proceed in square cache blocks, so that both the rows read and the rows written
+// by a block stay in L1
+const unsigned int TRANSPOSE_BLOCK = 64;
+
+// Reference implementation, also used on machines without any of the supported extensions
+namespace scalar
+{
+void add(const float* a, const float* b, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = a[i] + b[i];
+}
+
+void subtract(const float* a, const float* b, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = a[i] - b[i];
+}
+
+void multiply(const float* a, const float* b, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = a[i] * b[i];
+}
+
+void scale(const float* a, float f, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = a[i] * f;
+}
+
+void axpy(float alpha, const float* x, float* y, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) y[i] += alpha*x[i];
+}
+
+void fill(float* out, float value, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = value;
+}
+
+float sum(const float* a, size_t n)
+{
+    float s = 0;
+    for(size_t i = 0; i < n; ++i) s += a[i];
+    return s;
+}
+
+float dot(const float* a, const float* b, size_t n)
+{
+    float s = 0;
+    for(size_t i = 0; i < n; ++i) s += a[i]*b[i];
+    return s;
+}
+
+void replaceNonFinite(float* data, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(std::isinf(data[i]) || std::isnan(data[i])) data[i] = 0.0f;
+    }
+}
+
+void sigmoid(const float* in, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = (float)(1.0/(1.0 + std::exp(-(double)in[i])));
+}
+
+void exponential(const float* in, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = std::exp(in[i]);
+}
+
+void sigmoidDerivative(const float* in, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = (float)((double)in[i]*(1.0 - in[i]));
+}
+
+// The scalar code has no fast tier, it computes the reference values the fast kernels are checked against
+void sigmoidFast(const float* in, float* out, size_t n)
+{
+    sigmoid(in, out, n);
+}
+
+void relu(const float* in, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = in[i] < 0.0f ? 0.0f : in[i];
+}
+
+void reluDerivative(const float* in, float* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = in[i] > 0.0f ? 1.0f : 0.0f;
+}
+
+void transpose(const float* in, unsigned int ldIn, float* out, unsigned int ldOut,
+               unsigned int rows, unsigned int columns)
+{
+    for(unsigned int ib = 0; ib < rows; ib += TRANSPOSE_BLOCK)
+    {
+        for(unsigned int jb = 0; jb < columns; jb += TRANSPOSE_BLOCK)
+        {
+            const unsigned int ie = std::min(ib + TRANSPOSE_BLOCK, rows);
+            const unsigned int je = std::min(jb + TRANSPOSE_BLOCK, columns);
+            for(unsigned int i = ib; i < ie; ++i)
+            {
+                for(unsigned int j = jb; j < je; ++j) out[j*ldOut + i] = in[i*ldIn + j];
+            }
+        }
+    }
+}
+
+void gemmMicroKernel(unsigned int kc, const float* a, const float* b,
+                     float* c, unsigned int ldc,
+                     unsigned int mr, unsigned int nr, bool accumulate)
+{
+    for(unsigned int i = 0; i < mr; ++i)
+    {
+        for(unsigned int j = 0; j < nr; ++j)
+        {
+            float s = 0;
+            for(unsigned int p = 0; p < kc; ++p) s += a[p*GEMM_MR + i]*b[p*GEMM_NR + j];
+            c[i*ldc + j] = accumulate ? c[i*ldc + j] + s : s;
+        }
+    }
+}
+
+void sgdStep(float* w, float* g, float learningRate, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        w[i] -= learningRate*g[i];
+        g[i] = 0.0f;
+    }
+}
+
+void momentumStep(float* w, float* g, float* v, float learningRate, float momentum, bool nesterov, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        v[i] = momentum*v[i] + g[i];
+        w[i] -= nesterov ? learningRate*(g[i] + momentum*v[i]) : learningRate*v[i];
+        g[i] = 0.0f;
+    }
+}
+
+void rmsPropStep(float* w, float* g, float* s, float learningRate, float decay, float epsilon, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        s[i] = decay*s[i] + (1.0f - decay)*g[i]*g[i];
+        w[i] -= learningRate*g[i]/(std::sqrt(s[i]) + epsilon);
+        g[i] = 0.0f;
+    }
+}
+
+void adamWStep(float* w, float* g, float* m, float* v, float beta1, float beta2, float epsilon,
+               float stepSize, float vScale, float decay, size_t n)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        m[i] = beta1*m[i] + (1.0f - beta1)*g[i];
+        v[i] = beta2*v[i] + (1.0f - beta2)*g[i]*g[i];
+        w[i] = decay*w[i] - stepSize*m[i]/(std::sqrt(vScale*v[i]) + epsilon);
+        g[i] = 0.0f;
+    }
+}
+
+const SimdKernelTable table = {
+    "scalar",
+    add, subtract, multiply, scale, axpy, fill, sum, dot, replaceNonFinite,
+    sigmoid, sigmoidFast, relu, exponential, sigmoidDerivative, reluDerivative,
+    transpose,
+    gemmMicroKernel,
+    sgdStep, momentumStep, rmsPropStep, adamWStep
+};
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+
+#include <immintrin.h>
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+namespace sse42
+{
+#define SIMD_LANES 4
+#define SIMD_NAME "sse4.2"
+#include "simdKernelsImpl.inl"
+#undef SIMD_LANES
+#undef SIMD_NAME
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2
+{
+#define SIMD_LANES 8
+#define SIMD_NAME "avx2"
+#include "simdKernelsImpl.inl"
+#undef SIMD_LANES
+#undef SIMD_NAME
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+namespace avx512
+{
+#define SIMD_LANES 16
+#define SIMD_NAME "avx512"
+#include "simdKernelsImpl.inl"
+#undef SIMD_LANES
+#undef SIMD_NAME
+}
+#pragma GCC pop_options
+
+#endif
+
+bool closeEnough(float expected, float actual, float tolerance)
+{
+    return std::fabs(expected - actual) <= tolerance*std::max(1.0f, std::fabs(expected));
+}
+
+// Whether two floats of the same sign are at most ulps units in the last place apart
+bool withinUlps(float expected, float actual, int32_t ulps)
+{
+    int32_t e, a;
+    std::memcpy(&e, &expected, sizeof(e));
+    std::memcpy(&a, &actual, sizeof(a));
+    return std::abs(e - a) <= ulps;
+}
+}
+
+SimdKernels::SimdKernels() {}
+
+std::vector<const SimdKernelTable*> SimdKernels::available()
+{
+    std::vector<const SimdKernelTable*> tables{&scalar::table};
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) tables.push_back(&sse42::table);
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) tables.push_back(&avx2::table);
+    if(__builtin_cpu_supports("avx512f")) tables.push_back(&avx512::table);
+#endif
+    return tables;
+}
+
+const SimdKernelTable& SimdKernels::get()
+{
+    static const SimdKernelTable& table = select();
+    return table;
+}
+
+const SimdKernelTable& SimdKernels::select()
+{
+#ifndef NDEBUG
+    if(!selfCheck(std::cerr))
+    {
+        throw std::runtime_error("ERROR: SIMD kernels do not match the scalar reference!\n");
+    }
+#endif
+
+    auto tables = available();
+    const char* requested = std::getenv("NN_SIMD");
+    if(requested)
+    {
+        for(auto table : tables)
+        {
+            if(std::strcmp(table->name, requested) == 0) return *table;
+        }
+    }
+    return *tables.back();
+}
+
+bool SimdKernels::selfCheck(std::ostream& os)
+{
+    const float TOLERANCE = 1e-5f;
+    const float ACTIVATION_TOLERANCE = 1e-6f;
+    const int32_t ACTIVATION_ULPS = 1; // both sides are within 0.51 ulp of the exact sigmoid
+    const float FAST_ACTIVATION_TOLERANCE = 2e-4f;
+    const size_t MAX_LEN = 1031; // odd on purpose, so that every kernel goes through its tail
+    const SimdKernelTable& reference = scalar::table;
+
+    std::mt19937 generator(1234);
+    std::uniform_real_distribution<float> distribution(-2.0f, 2.0f);
+    std::vector<float> a(MAX_LEN), b(MAX_LEN), expected(MAX_LEN), actual(MAX_LEN);
+    for(size_t i = 0; i < MAX_LEN; ++i)
+    {
+        a[i] = distribution(generator);
+        b[i] = distribution(generator);
+    }
+
+    bool ok = true;
+    auto report = [&](const SimdKernelTable* table, const char* kernel, size_t n)
+    {
+        os << "SIMD self-check: " << table->name << " " << kernel << " differs from reference for n = " << n << "\n";
+        ok = false;
+    };
+    auto compare = [&](size_t n, float tolerance)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(!closeEnough(expected[i], actual[i], tolerance)) return false;
+        }
+        return true;
+    };
+    auto compareUlps = [&](size_t n, int32_t ulps)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(!withinUlps(expected[i], actual[i], ulps)) return false;
+        }
+        return true;
+    };
+
+    typedef void (*UnaryKernel)(const float*, float*, size_t);
+    struct ActivationKernel
+    {
+        const char* name;
+        UnaryKernel SimdKernelTable::* kernel;
+        float tolerance;
+        int32_t ulps; // compared in ulps instead of the tolerance when non-zero
+    };
+    const ActivationKernel activationKernels[] = {
+        {"sigmoid", &SimdKernelTable::sigmoid, 0.0f, ACTIVATION_ULPS},
+        {"sigmoidFast", &SimdKernelTable::sigmoidFast, FAST_ACTIVATION_TOLERANCE, 0},
+        {"sigmoidDerivative", &SimdKernelTable::sigmoidDerivative, 0.0f, ACTIVATION_ULPS},
+        {"relu", &SimdKernelTable::relu, ACTIVATION_TOLERANCE, 0},
+        {"reluDerivative", &SimdKernelTable::reluDerivative, ACTIVATION_TOLERANCE, 0}
+    };
+
+    // Activations are also checked far outside of the range where they change
+    std::vector<float> wide(MAX_LEN);
+    for(size_t i = 0; i < MAX_LEN; ++i) wide[i] = 60.0f*a[i];
+
+    // Optimizer steps run on weights, gradients and two moments of the reference and the checked table,
+    // the second moment being non-negative as it is in training
+    std::vector<float> optimizerBuffers[2][4];
+    auto checkOptimizer = [&](const SimdKernelTable* table, const char* kernel, size_t n, auto step)
+    {
+        for(auto& buffers : optimizerBuffers)
+        {
+            buffers[0].assign(a.begin(), a.begin() + n);
+            buffers[1].assign(b.begin(), b.begin() + n);
+            buffers[2].assign(b.begin(), b.begin() + n);
+            buffers[3].assign(a.begin(), a.begin() + n);
+            for(auto& value : buffers[3]) value = std::fabs(value);
+        }
+        step(reference, optimizerBuffers[0]);
+        step(*table, optimizerBuffers[1]);
+        for(unsigned int k = 0; k < 4; ++k)
+        {
+            for(size_t i = 0; i < n; ++i)
+            {
+                if(!closeEnough(optimizerBuffers[0][k][i], optimizerBuffers[1][k][i], TOLERANCE))
+                {
+                    report(table, kernel, n);
+                    return;
+                }
+            }
+        }
+    };
+
+    typedef void (*BinaryKernel)(const float*, const float*, float*, size_t);
+    const std::pair<const char*, BinaryKernel SimdKernelTable::*> binaryKernels[] = {
+        {"add", &SimdKernelTable::add},
+        {"subtract", &SimdKernelTable::subtract},
+        {"multiply", &SimdKernelTable::multiply}
+    };
+
+    for(auto table : available())
+    {
+        for(size_t n : {size_t(0), size_t(1), size_t(3), size_t(10), size_t(17), size_t(64), MAX_LEN})
+        {
+            for(auto& kernel : binaryKernels)
+            {
+                (reference.*kernel.second)(a.data(), b.data(), expected.data(), n);
+                (table->*kernel.second)(a.data(), b.data(), actual.data(), n);
+                if(!compare(n, 0)) report(table, kernel.first, n);
+            }
+
+            for(auto& kernel : activationKernels)
+            {
+                (reference.*kernel.kernel)(wide.data(), expected.data(), n);
+                (table->*kernel.kernel)(wide.data(), actual.data(), n);
+                const bool matches = kernel.ulps ? compareUlps(n, kernel.ulps) : compare(n, kernel.tolerance);
+                if(!matches) report(table, kernel.name, n);
+            }
+
+            // inputs of exp stay in range, the vector version saturates instead of overflowing
+            reference.exp(a.data(), expected.data(), n);
+            table->exp(a.data(), actual.data(), n);
+            if(!compare(n, ACTIVATION_TOLERANCE)) report(table, "exp", n);
+
+            reference.scale(a.data(), 0.37f, expected.data(), n);
+            table->scale(a.data(), 0.37f, actual.data(), n);
+            if(!compare(n, 0)) report(table, "scale", n);
+
+            std::copy(b.begin(), b.begin() + n, expected.begin());
+            std::copy(b.begin(), b.begin() + n, actual.begin());
+            reference.axpy(-0.37f, a.data(), expected.data(), n);
+            table->axpy(-0.37f, a.data(), actual.data(), n);
+            if(!compare(n, TOLERANCE)) report(table, "axpy", n);
+
+            reference.fill(expected.data(), 0.5f, n);
+            table->fill(actual.data(), 0.5f, n);
+            if(!compare(n, 0)) report(table, "fill", n);
+
+            if(!closeEnough(reference.sum(a.data(), n), table->sum(a.data(), n), TOLERANCE*n))
+                report(table, "sum", n);
+
+            if(!closeEnough(reference.dot(a.data(), b.data(), n), table->dot(a.data(), b.data(), n), TOLERANCE*n))
+                report(table, "dot", n);
+
+            std::copy(a.begin(), a.begin() + n, expected.begin());
+            for(size_t i = 0; i < n; i += 3) expected[i] = (i % 2) ? INFINITY : NAN;
+            std::copy(expected.begin(), expected.begin() + n, actual.begin());
+            reference.replaceNonFinite(expected.data(), n);
+            table->replaceNonFinite(actual.data(), n);
+            if(!compare(n, 0)) report(table, "replaceNonFinite", n);
+
+            checkOptimizer(table, "sgdStep", n, [&](const SimdKernelTable& t, std::vector<float>* s)
+            {
+                t.sgdStep(s[0].data(), s[1].data(), 0.1f, n);
+            });
+            for(bool nesterov : {false, true})
+            {
+                checkOptimizer(table, "momentumStep", n, [&](const SimdKernelTable& t, std::vector<float>* s)
+                {
+                    t.momentumStep(s[0].data(), s[1].data(), s[2].data(), 0.1f, 0.9f, nesterov, n);
+                });
+            }
+            checkOptimizer(table, "rmsPropStep", n, [&](const SimdKernelTable& t, std::vector<float>* s)
+            {
+                t.rmsPropStep(s[0].data(), s[1].data(), s[3].data(), 0.01f, 0.9f, 1e-8f, n);
+            });
+            checkOptimizer(table, "adamWStep", n, [&](const SimdKernelTable& t, std::vector<float>* s)
+            {
+                t.adamWStep(s[0].data(), s[1].data(), s[2].data(), s[3].data(), 0.9f, 0.999f, 1e-8f, 0.01f, 1.5f, 0.999f, n);
+            });
+        }
+
+        // Whole register tiles and edges, source and destination with row padding
+        for(unsigned int rows : {1u, 16u, 29u})
+        {
+            const unsigned int COLUMNS = 21, LD_IN = 24, LD_OUT = rows + 5;
+            std::fill(expected.begin(), expected.end(), 0.0f);
+            std::fill(actual.begin(), actual.end(), 0.0f);
+            reference.transpose(a.data(), LD_IN, expected.data(), LD_OUT, rows, COLUMNS);
+            table->transpose(a.data(), LD_IN, actual.data(), LD_OUT, rows, COLUMNS);
+            if(!compare(COLUMNS*LD_OUT, 0)) report(table, "transpose", rows);
+        }
+
+        // Full and partial register tiles, written over and accumulated into C
+        const unsigned int KC = 37;
+        const unsigned int LDC = GEMM_NR + 3;
+        for(unsigned int mr : {GEMM_MR, 1u})
+        {
+            for(unsigned int nr : {GEMM_NR, 5u})
+            {
+                for(bool accumulate : {false, true})
+                {
+                    std::copy(b.begin(), b.begin() + GEMM_MR*LDC, expected.begin());
+                    std::copy(b.begin(), b.begin() + GEMM_MR*LDC, actual.begin());
+                    reference.gemmMicroKernel(KC, a.data(), a.data() + GEMM_MR*KC, expected.data(), LDC, mr, nr, accumulate);
+                    table->gemmMicroKernel(KC, a.data(), a.data() + GEMM_MR*KC, actual.data(), LDC, mr, nr, accumulate);
+                    if(!compare(GEMM_MR*LDC, TOLERANCE*KC)) report(table, "gemmMicroKernel", KC);
+                }
+            }
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,507 @@
+// Width-generic bodies of the SIMD kernels. simdKernels.cpp includes this file once per
+// instruction set, inside its own namespace and target pragma, with SIMD_LANES set to
+// the number of floats held by a vector register of that instruction set.
+
+typedef float Vec __attribute__((vector_size(SIMD_LANES*sizeof(float))));
+typedef int IntVec __attribute__((vector_size(SIMD_LANES*sizeof(float))));
+typedef double DoubleVec __attribute__((vector_size(SIMD_LANES*sizeof(double))));
+typedef long long LongVec __attribute__((vector_size(SIMD_LANES*sizeof(double))));
+
+const size_t W = SIMD_LANES;
+
+inline Vec load(const float* p)
+{
+    Vec v;
+    __builtin_memcpy(&v, p, sizeof(Vec));
+    return v;
+}
+
+inline void store(float* p, Vec v)
+{
+    __builtin_memcpy(p, &v, sizeof(Vec));
+}
+
+inline Vec broadcast(float f)
+{
+    const Vec v = {f};
+    return __builtin_shuffle(v, IntVec{});
+}
+
+inline Vec select(IntVec mask, Vec a, Vec b)
+{
+    return (Vec)(((IntVec)a & mask) | ((IntVec)b & ~mask));
+}
+
+// Applies F to n values, the tail goes through the same vector code via a zero-padded register
+template<Vec (*F)(Vec)>
+inline void transform(const float* in, float* out, size_t n)
+{
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, F(load(in + i)));
+    if(i < n)
+    {
+        float tail[W] = {};
+        __builtin_memcpy(tail, in + i, (n - i)*sizeof(float));
+        const Vec result = F(load(tail));
+        __builtin_memcpy(out + i, &result, (n - i)*sizeof(float));
+    }
+}
+
+// e^x following Cephes expf: x = n*ln(2) + r with |r| <= ln(2)/2, e^r from a degree 6 polynomial
+// and 2^n assembled directly in the exponent bits. Only normal powers of 2 are assembled: below
+// x = -87.68 results flush to 0 instead of going subnormal, and above x = 88.38 they saturate
+// at 2.4e38 instead of overflowing to infinity
+inline Vec exp(Vec x)
+{
+    const Vec MAX_X = broadcast(88.3762626647949f);
+    const Vec ROUND = broadcast(12582912.0f); // 1.5 * 2^23, adding it rounds to an integer
+    x = select(x > MAX_X, MAX_X, x);
+    x = select(x < -MAX_X, -MAX_X, x);
+
+    const Vec shifted = x*broadcast(1.44269504088896341f) + ROUND;
+    const Vec n = shifted - ROUND;
+    const Vec r = (x - n*broadcast(0.693359375f)) - n*broadcast(-2.12194440e-4f);
+
+    Vec p = broadcast(1.9875691500e-4f);
+    p = p*r + broadcast(1.3981999507e-3f);
+    p = p*r + broadcast(8.3334519073e-3f);
+    p = p*r + broadcast(4.1665795894e-2f);
+    p = p*r + broadcast(1.6666665459e-1f);
+    p = p*r + broadcast(5.0000001201e-1f);
+    p = p*r*r + r + broadcast(1.0f);
+
+    const IntVec exponent = ((IntVec)shifted - (IntVec)ROUND + 127) << 23;
+    return p*(Vec)exponent;
+}
+
+// Exact tier: e^-x in double precision with about 3e-10 relative error from a degree 8 Taylor
+// polynomial, so the final rounding to float is the only visible error and results are within
+// 1 ulp (0.51 measured), subnormal results included
+inline Vec sigmoidOf(Vec x)
+{
+    const Vec LIMIT = broadcast(120.0f); // 1/(1 + e^120) rounds to 0 as a float
+    x = select(x > LIMIT, LIMIT, x);
+    x = select(x < -LIMIT, -LIMIT, x);
+
+    const DoubleVec ROUND = DoubleVec{} + 6755399441055744.0; // 1.5 * 2^52, adding it rounds to an integer
+    const DoubleVec minusX = __builtin_convertvector(-x, DoubleVec);
+    const DoubleVec shifted = minusX*1.4426950408889634 + ROUND;
+    const DoubleVec n = shifted - ROUND;
+    const DoubleVec r = minusX - n*0.6931471805599453;
+
+    DoubleVec p = r*(1.0/40320) + 1.0/5040;
+    p = p*r + 1.0/720;
+    p = p*r + 1.0/120;
+    p = p*r + 1.0/24;
+    p = p*r + 1.0/6;
+    p = p*r + 0.5;
+    p = p*r*r + r + 1.0;
+
+    const LongVec exponent = ((LongVec)shifted - (LongVec)ROUND + 1023) << 52;
+    return __builtin_convertvector(1.0/(1.0 + p*(DoubleVec)exponent), Vec);
+}
+
+// Derivatives take the output a of the activation, sigmoid'(z) = a(1 - a). The product of two
+// floats is exact in double precision, so the result is a correctly rounded float
+inline Vec sigmoidDerivativeOf(Vec a)
+{
+    const DoubleVec d = __builtin_convertvector(a, DoubleVec);
+    return __builtin_convertvector(d*(1.0 - d), Vec);
+}
+
+// Fast tier of e^x, about 7.5e-5 relative error: single-constant range reduction and a degree 3
+// minimax polynomial
+inline Vec fastExp(Vec x)
+{
+    const Vec MAX_X = broadcast(88.3762626647949f);
+    const Vec ROUND = broadcast(12582912.0f);
+    x = select(x > MAX_X, MAX_X, x);
+    x = select(x < -MAX_X, -MAX_X, x);
+
+    const Vec shifted = x*broadcast(1.44269504088896341f) + ROUND;
+    const Vec n = shifted - ROUND;
+    const Vec r = x - n*broadcast(0.693147180559945f);
+
+    Vec p = broadcast(0.16566835f);
+    p = p*r + broadcast(0.50496381f);
+    p = p*r + broadcast(1.00016422f);
+    p = p*r + broadcast(0.99992806f);
+
+    const IntVec exponent = ((IntVec)shifted - (IntVec)ROUND + 127) << 23;
+    return p*(Vec)exponent;
+}
+
+inline Vec fastSigmoidOf(Vec x)
+{
+    return broadcast(1.0f)/(broadcast(1.0f) + fastExp(-x));
+}
+
+inline Vec reluOf(Vec x)
+{
+    return select(x < Vec{}, Vec{}, x);
+}
+
+inline Vec reluDerivativeOf(Vec a)
+{
+    return select(a > Vec{}, broadcast(1.0f), Vec{});
+}
+
+void sigmoid(const float* in, float* out, size_t n)
+{
+    transform<sigmoidOf>(in, out, n);
+}
+
+void exponential(const float* in, float* out, size_t n)
+{
+    transform<exp>(in, out, n);
+}
+
+void sigmoidDerivative(const float* in, float* out, size_t n)
+{
+    transform<sigmoidDerivativeOf>(in, out, n);
+}
+
+void sigmoidFast(const float* in, float* out, size_t n)
+{
+    transform<fastSigmoidOf>(in, out, n);
+}
+
+void relu(const float* in, float* out, size_t n)
+{
+    transform<reluOf>(in, out, n);
+}
+
+void reluDerivative(const float* in, float* out, size_t n)
+{
+    transform<reluDerivativeOf>(in, out, n);
+}
+
+void add(const float* a, const float* b, float* out, size_t n)
+{
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, load(a + i) + load(b + i));
+    for(; i < n; ++i) out[i] = a[i] + b[i];
+}
+
+void subtract(const float* a, const float* b, float* out, size_t n)
+{
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, load(a + i) - load(b + i));
+    for(; i < n; ++i) out[i] = a[i] - b[i];
+}
+
+void multiply(const float* a, const float* b, float* out, size_t n)
+{
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, load(a + i) * load(b + i));
+    for(; i < n; ++i) out[i] = a[i] * b[i];
+}
+
+void scale(const float* a, float f, float* out, size_t n)
+{
+    const Vec vf = broadcast(f);
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, load(a + i) * vf);
+    for(; i < n; ++i) out[i] = a[i] * f;
+}
+
+void axpy(float alpha, const float* x, float* y, size_t n)
+{
+    const Vec va = broadcast(alpha);
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(y + i, load(y + i) + va*load(x + i));
+    for(; i < n; ++i) y[i] += alpha*x[i];
+}
+
+void fill(float* out, float value, size_t n)
+{
+    const Vec v = broadcast(value);
+    size_t i = 0;
+    for(; i + W <= n; i += W) store(out + i, v);
+    for(; i < n; ++i) out[i] = value;
+}
+
+float sum(const float* a, size_t n)
+{
+    // Four independent accumulators hide the latency of vector additions
+    Vec acc0 = {}, acc1 = {}, acc2 = {}, acc3 = {};
+    size_t i = 0;
+    for(; i + 4*W <= n; i += 4*W)
+    {
+        acc0 += load(a + i);
+        acc1 += load(a + i + W);
+        acc2 += load(a + i + 2*W);
+        acc3 += load(a + i + 3*W);
+    }
+    for(; i + W <= n; i += W) acc0 += load(a + i);
+
+    const Vec acc = (acc0 + acc1) + (acc2 + acc3);
+    float s = 0;
+    for(size_t l = 0; l < W; ++l) s += acc[l];
+    for(; i < n; ++i) s += a[i];
+    return s;
+}
+
+float dot(const float* a, const float* b, size_t n)
+{
+    Vec acc0 = {}, acc1 = {}, acc2 = {}, acc3 = {};
+    size_t i = 0;
+    for(; i + 4*W <= n; i += 4*W)
+    {
+        acc0 += load(a + i)*load(b + i);
+        acc1 += load(a + i + W)*load(b + i + W);
+        acc2 += load(a + i + 2*W)*load(b + i + 2*W);
+        acc3 += load(a + i + 3*W)*load(b + i + 3*W);
+    }
+    for(; i + W <= n; i += W) acc0 += load(a + i)*load(b + i);
+
+    const Vec acc = (acc0 + acc1) + (acc2 + acc3);
+    float s = 0;
+    for(size_t l = 0; l < W; ++l) s += acc[l];
+    for(; i < n; ++i) s += a[i]*b[i];
+    return s;
+}
+
+void replaceNonFinite(float* data, size_t n)
+{
+    // x - x is zero for finite x and NaN otherwise, and NaN never compares equal
+    size_t i = 0;
+    for(; i + W <= n; i += W)
+    {
+        const Vec x = load(data + i);
+        const IntVec finite = (x - x) == Vec{};
+        store(data + i, (Vec)((IntVec)x & finite));
+    }
+    for(; i < n; ++i)
+    {
+        if(data[i] - data[i] != 0.0f) data[i] = 0.0f;
+    }
+}
+
+// Shuffle masks of transposeStage<D>, built at compile time
+template<unsigned int D, size_t... L>
+inline IntVec lowerMask(std::index_sequence<L...>)
+{
+    return IntVec{(int)((L & D) ? W + L - D : L)...};
+}
+
+template<unsigned int D, size_t... L>
+inline IntVec upperMask(std::index_sequence<L...>)
+{
+    return IntVec{(int)((L & D) ? W + L : L + D)...};
+}
+
+// Swaps the off-diagonal D x D blocks inside every 2D x 2D block of a W x W tile held one row
+// per register. Applying it for D = W/2, ..., 2, 1 transposes the tile
+template<unsigned int D>
+inline void transposeStage(Vec* rows)
+{
+    if constexpr(D > 0)
+    {
+        const IntVec lower = lowerMask<D>(std::make_index_sequence<W>());
+        const IntVec upper = upperMask<D>(std::make_index_sequence<W>());
+        for(unsigned int i = 0; i < W; ++i)
+        {
+            if(i & D) continue;
+            const Vec a = rows[i];
+            const Vec b = rows[i + D];
+            rows[i] = __builtin_shuffle(a, b, lower);
+            rows[i + D] = __builtin_shuffle(a, b, upper);
+        }
+        transposeStage<D/2>(rows);
+    }
+}
+
+void transpose(const float* in, unsigned int ldIn, float* out, unsigned int ldOut,
+               unsigned int rows, unsigned int columns)
+{
+    for(unsigned int ib = 0; ib < rows; ib += TRANSPOSE_BLOCK)
+    {
+        for(unsigned int jb = 0; jb < columns; jb += TRANSPOSE_BLOCK)
+        {
+            const unsigned int ie = std::min(ib + TRANSPOSE_BLOCK, rows);
+            const unsigned int je = std::min(jb + TRANSPOSE_BLOCK, columns);
+            unsigned int i = ib;
+            for(; i + W <= ie; i += W)
+            {
+                // W x W tiles are transposed in registers
+                unsigned int j = jb;
+                for(; j + W <= je; j += W)
+                {
+                    Vec tile[W];
+                    for(unsigned int r = 0; r < W; ++r) tile[r] = load(in + (i + r)*ldIn + j);
+                    transposeStage<W/2>(tile);
+                    for(unsigned int r = 0; r < W; ++r) store(out + (j + r)*ldOut + i, tile[r]);
+                }
+                for(; j < je; ++j)
+                {
+                    for(unsigned int r = i; r < i + W; ++r) out[j*ldOut + r] = in[r*ldIn + j];
+                }
+            }
+            for(; i < ie; ++i)
+            {
+                for(unsigned int j = jb; j < je; ++j) out[j*ldOut + i] = in[i*ldIn + j];
+            }
+        }
+    }
+}
+
+void gemmMicroKernel(unsigned int kc, const float* a, const float* b,
+                     float* c, unsigned int ldc,
+                     unsigned int mr, unsigned int nr, bool accumulate)
+{
+    const unsigned int VECS = GEMM_NR/W;
+    Vec acc[GEMM_MR][VECS] = {};
+    for(unsigned int p = 0; p < kc; ++p, a += GEMM_MR, b += GEMM_NR)
+    {
+        Vec bp[VECS];
+        for(unsigned int v = 0; v < VECS; ++v) bp[v] = load(b + v*W);
+        for(unsigned int i = 0; i < GEMM_MR; ++i)
+        {
+            const Vec ai = broadcast(a[i]);
+            for(unsigned int v = 0; v < VECS; ++v) acc[i][v] += ai*bp[v];
+        }
+    }
+
+    for(unsigned int i = 0; i < mr; ++i)
+    {
+        float* ci = c + i*ldc;
+        if(nr == GEMM_NR)
+        {
+            for(unsigned int v = 0; v < VECS; ++v)
+            {
+                store(ci + v*W, accumulate ? load(ci + v*W) + acc[i][v] : acc[i][v]);
+            }
+        }
+        else
+        {
+            for(unsigned int j = 0; j < nr; ++j)
+            {
+                const float value = acc[i][j/W][j%W];
+                ci[j] = accumulate ? ci[j] + value : value;
+            }
+        }
+    }
+}
+
+// Optimizer updates are written once, as generic lambdas applied to whole registers and then
+// to the single values of the tail. Every value is read and written exactly once per step
+// Vector extensions have no square root, the instruction of the register width is called directly
+inline Vec sqrtOf(Vec x)
+{
+#if SIMD_LANES == 16
+    // the masked form with every lane set, the plain one trips -Wmaybe-uninitialized in GCC 12
+    return (Vec)_mm512_mask_sqrt_ps((__m512)x, (__mmask16)0xFFFF, (__m512)x);
+#elif SIMD_LANES == 8
+    return (Vec)_mm256_sqrt_ps((__m256)x);
+#else
+    return (Vec)_mm_sqrt_ps((__m128)x);
+#endif
+}
+
+inline float sqrtOf(float x)
+{
+    return __builtin_sqrtf(x);
+}
+
+void sgdStep(float* w, float* g, float learningRate, size_t n)
+{
+    size_t i = 0;
+    for(; i + W <= n; i += W)
+    {
+        store(w + i, load(w + i) - learningRate*load(g + i));
+        store(g + i, Vec{});
+    }
+    for(; i < n; ++i)
+    {
+        w[i] -= learningRate*g[i];
+        g[i] = 0.0f;
+    }
+}
+
+void momentumStep(float* w, float* g, float* v, float learningRate, float momentum, bool nesterov, size_t n)
+{
+    // w -= a*g + b*v covers both variants without a branch in the loop
+    const float a = nesterov ? learningRate : 0.0f;
+    const float b = nesterov ? learningRate*momentum : learningRate;
+    auto update = [&](auto& wi, auto gi, auto& vi)
+    {
+        vi = momentum*vi + gi;
+        wi -= a*gi + b*vi;
+    };
+
+    size_t i = 0;
+    for(; i + W <= n; i += W)
+    {
+        Vec wi = load(w + i), vi = load(v + i);
+        update(wi, load(g + i), vi);
+        store(w + i, wi);
+        store(v + i, vi);
+        store(g + i, Vec{});
+    }
+    for(; i < n; ++i)
+    {
+        update(w[i], g[i], v[i]);
+        g[i] = 0.0f;
+    }
+}
+
+void rmsPropStep(float* w, float* g, float* s, float learningRate, float decay, float epsilon, size_t n)
+{
+    auto update = [&](auto& wi, auto gi, auto& si)
+    {
+        si = decay*si + (1.0f - decay)*gi*gi;
+        wi -= learningRate*gi/(sqrtOf(si) + epsilon);
+    };
+
+    size_t i = 0;
+    for(; i + W <= n; i += W)
+    {
+        Vec wi = load(w + i), si = load(s + i);
+        update(wi, load(g + i), si);
+        store(w + i, wi);
+        store(s + i, si);
+        store(g + i, Vec{});
+    }
+    for(; i < n; ++i)
+    {
+        update(w[i], g[i], s[i]);
+        g[i] = 0.0f;
+    }
+}
+
+void adamWStep(float* w, float* g, float* m, float* v, float beta1, float beta2, float epsilon,
+               float stepSize, float vScale, float decay, size_t n)
+{
+    auto update = [&](auto& wi, auto gi, auto& mi, auto& vi)
+    {
+        mi = beta1*mi + (1.0f - beta1)*gi;
+        vi = beta2*vi + (1.0f - beta2)*gi*gi;
+        wi = decay*wi - stepSize*mi/(sqrtOf(vScale*vi) + epsilon);
+    };
+
+    size_t i = 0;
+    for(; i + W <= n; i += W)
+    {
+        Vec wi = load(w + i), mi = load(m + i), vi = load(v + i);
+        update(wi, load(g + i), mi, vi);
+        store(w + i, wi);
+        store(m + i, mi);
+        store(v + i, vi);
+        store(g + i, Vec{});
+    }
+    for(; i < n; ++i)
+    {
+        update(w[i], g[i], m[i], v[i]);
+        g[i] = 0.0f;
+    }
+}
+
+const SimdKernelTable table = {
+    SIMD_NAME,
+    add, subtract, multiply, scale, axpy, fill, sum, dot, replaceNonFinite,
+    sigmoid, sigmoidFast, relu, exponential, sigmoidDerivative, reluDerivative,
+    transpose,
+    gemmMicroKernel,
+    sgdStep, momentumStep, rmsPropStep, adamWStep
+};
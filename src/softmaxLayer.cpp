@@ -0,0 +1,131 @@
+#include "softmaxLayer.hpp"
+
+#include "costFunctionStrategy.hpp"
+#include "simdKernels.hpp"
+
+void SoftmaxLayer::activateDerivative(const NNDataType*, NNDataType*, unsigned int) const
+{
+    throw std::runtime_error("ERROR: Softmax has no element-wise derivative!\n");
+}
+
+NNMatrixType SoftmaxLayer::feedforward(NNMatrixViewType input, NNMatrixType& weightedInput)
+{
+    // backpropagation needs only the output
+    weightedInput = NNMatrixType();
+    return feedforward(input);
+}
+
+NNMatrixType SoftmaxLayer::feedforward(NNMatrixViewType input) const
+{
+    NNMatrixType output = calculateWeightedInput(input);
+    softmaxColumns(output);
+    return output;
+}
+
+void SoftmaxLayer::softmaxColumns(NNMatrixType& z)
+{
+    // Samples are columns, so the column maxima and sums are gathered row by row and every
+    // kernel runs over a whole contiguous row
+    const SimdKernelTable& kernels = SimdKernels::get();
+    const unsigned int rows = z.getRows();
+    const unsigned int columns = z.getColumns();
+    MatrixView<NNDataType> values = z.view();
+
+    NNMatrixType maxima(1, columns, uninitialized);
+    NNDataType* maximum = maxima.begin();
+    std::copy(&values(0, 0), &values(0, 0) + columns, maximum);
+    for(unsigned int i = 1; i < rows; ++i)
+    {
+        const NNDataType* zi = &values(i, 0);
+        for(unsigned int j = 0; j < columns; ++j)
+        {
+            maximum[j] = std::max(maximum[j], zi[j]);
+        }
+    }
+
+    // e^(z - max) is at most 1 and the largest entry of a column is exactly 1, so the sum is in [1, rows]
+    NNMatrixType sums(1, columns, zeros);
+    NNDataType* sum = sums.begin();
+    for(unsigned int i = 0; i < rows; ++i)
+    {
+        NNDataType* zi = &values(i, 0);
+        kernels.subtract(zi, maximum, zi, columns);
+        kernels.exp(zi, zi, columns);
+        kernels.add(sum, zi, sum, columns);
+    }
+
+    for(unsigned int j = 0; j < columns; ++j)
+    {
+        sum[j] = 1.0f/sum[j];
+    }
+    for(unsigned int i = 0; i < rows; ++i)
+    {
+        kernels.multiply(&values(i, 0), sum, &values(i, 0), columns);
+    }
+}
+
+NNMatrixType SoftmaxLayer::backpropagate(const NNMatrixType& error,
+                                         const NNMatrixType&,
+                                         const NNMatrixType& output,
+                                         NNMatrixViewType prevOutput,
+                                         NNMatrixType& nablaW,
+                                         NNMatrixType& nablaB)
+{
+    const unsigned int rows = output.getRows();
+    const unsigned int columns = output.getColumns();
+    NNMatrixViewType a = output.view();
+    NNMatrixViewType g = error.view();
+
+    // sum(a * dC/da) of every sample
+    NNMatrixType dots(1, columns, zeros);
+    NNDataType* dot = dots.begin();
+    for(unsigned int i = 0; i < rows; ++i)
+    {
+        for(unsigned int j = 0; j < columns; ++j)
+        {
+            dot[j] += a(i, j)*g(i, j);
+        }
+    }
+
+    NNMatrixType delta(rows, columns, uninitialized);
+    MatrixView<NNDataType> d = delta.view();
+    for(unsigned int i = 0; i < rows; ++i)
+    {
+        for(unsigned int j = 0; j < columns; ++j)
+        {
+            d(i, j) = a(i, j)*(g(i, j) - dot[j]);
+        }
+    }
+
+    return propagateDelta(delta, prevOutput, nablaW, nablaB);
+}
+
+bool SoftmaxLayer::outputDelta(const CostFunctionStrategy& cost, NNMatrixViewType output, NNMatrixViewType target,
+                               NNMatrixType& delta) const
+{
+    if(!cost.simplifiesWithSoftmax())
+    {
+        return false;
+    }
+
+    delta = NNMatrixType(output.getRows(), output.getColumns(), uninitialized);
+    MatrixView<NNDataType> d = delta.view();
+    for(unsigned int i = 0; i < output.getRows(); ++i)
+    {
+        for(unsigned int j = 0; j < output.getColumns(); ++j)
+        {
+            d(i, j) = output(i, j) - target(i, j);
+        }
+    }
+    return true;
+}
+
+void SoftmaxLayer::serialize(std::ofstream& ofile) const
+{
+    const char* id = "SMX";
+    const unsigned int ID_LEN = 3;
+    ofile.write((char*)&ID_LEN, sizeof(ID_LEN));
+    ofile.write(id, ID_LEN*sizeof(char));
+
+    serializeMatricies(ofile);
+}
@@ -1,15 +1,41 @@
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 
 #include <catch2/catch.hpp>
+#include <atomic>
+#include <filesystem>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include "adamWOptimizer.hpp"
+#include "conv2DLayer.hpp"
+#include "crossEntropyCost.hpp"
+#include "depthwiseConv2DLayer.hpp"
 #include "matrix.hpp"
+#include "maxPool2DLayer.hpp"
 #include "meanSquereErrorCost.hpp"
 #include "mnistDataLoader.hpp"
+#include "momentumOptimizer.hpp"
 #include "neuralnetwork.hpp"
 #include "reluLayer.hpp"
+#include "rmsPropOptimizer.hpp"
+#include "sgdOptimizer.hpp"
 #include "sigmoidLayer.hpp"
+#include "simdKernels.hpp"
+#include "softmaxLayer.hpp"
+#include "threadPool.hpp"
 #include "userInterface.hpp"
+#include "workspace.hpp"
+
+// Heap allocations of the test binary, counted by src/allocationCounter.cpp
+extern std::atomic<size_t> heapAllocations;
+
+// Path of a model file in the temporary directory, so that tests leave nothing in the working directory
+std::string temporaryModelPath(const char* name)
+{
+    return (std::filesystem::temp_directory_path()/name).string();
+}
 
 TEST_CASE("matrix operations can be performed", "[matrix]") 
 {
@@ -78,6 +104,1157 @@ TEST_CASE("matrix operations can be performed", "[matrix]")
         REQUIRE(result.get(1, 0) == 12);
         REQUIRE(result.get(1, 1) == 3);
     }
+
+    SECTION("tagged constructors")
+    {
+        Matrix<int> z(3, 2, zeros);
+        Matrix<int> o(3, 2);
+        Matrix<int> u(3, 2, uninitialized);
+
+        REQUIRE(u.getRows() == 3);
+        REQUIRE(u.getColumns() == 2);
+        REQUIRE(z.sum() == 0);
+        REQUIRE(o.sum() == 6);
+    }
+
+    SECTION("copy assignment between different sizes")
+    {
+        Matrix<int> result(1, 1);
+        result = a.hadamard(b);
+        Matrix<int> copy(5, 3);
+        copy = result;
+
+        REQUIRE(copy.getRows() == 2);
+        REQUIRE(copy.getColumns() == 2);
+        REQUIRE(copy.get(1, 0) == 12);
+    }
+
+    SECTION("compound expression evaluated in one pass")
+    {
+        Matrix<int> result = (a + b).hadamard(a) - (a*b)*2;
+
+        REQUIRE(result.get(0, 0) == -15);
+        REQUIRE(result.get(0, 1) == 0);
+        REQUIRE(result.get(1, 0) == -22);
+        REQUIRE(result.get(1, 1) == -10);
+    }
+
+    SECTION("scaled matrix accumulated in place")
+    {
+        a -= b*2;
+        a += 3*b;
+
+        REQUIRE(a.get(0, 0) == 5);
+        REQUIRE(a.get(0, 1) == 4);
+        REQUIRE(a.get(1, 0) == 7);
+        REQUIRE(a.get(1, 1) == 4);
+    }
+}
+
+TEST_CASE("blocked matrix multiplication matches naive product", "[matrix]")
+{
+    const unsigned int m = 70, k = 300, n = 45;
+    Matrix<int> a(m, k);
+    Matrix<int> b(k, n);
+    for(unsigned int i = 0; i < m*k; ++i) a[i] = i % 7 - 3;
+    for(unsigned int i = 0; i < k*n; ++i) b[i] = i % 5 - 2;
+
+    auto result = a*b;
+
+    REQUIRE(result.getRows() == m);
+    REQUIRE(result.getColumns() == n);
+    for(unsigned int i = 0; i < m; ++i)
+    {
+        for(unsigned int j = 0; j < n; ++j)
+        {
+            int s = 0;
+            for(unsigned int r = 0; r < k; ++r) s += a.get(i, r)*b.get(r, j);
+            REQUIRE(result.get(i, j) == s);
+        }
+    }
+}
+
+TEST_CASE("BLAS-style routines accumulate in place", "[matrix]")
+{
+    // integer-valued floats keep every sum exact
+    auto filled = [](unsigned int rows, unsigned int columns, int seed)
+    {
+        NNMatrixType m(rows, columns, uninitialized);
+        for(unsigned int i = 0; i < rows; ++i)
+            for(unsigned int j = 0; j < columns; ++j)
+                m.view()(i, j) = (float)((i*7 + j*3 + seed) % 9) - 4.0f;
+        return m;
+    };
+
+    SECTION("gemm with every combination of transposition flags")
+    {
+        const unsigned int sizes[][3] = {{5, 7, 3}, {70, 45, 300}, {33, 1, 20}};
+        const MatrixOp ops[] = {MatrixOp::Normal, MatrixOp::Transpose};
+        for(auto& size : sizes)
+        {
+            const unsigned int m = size[0], n = size[1], k = size[2];
+            for(MatrixOp opA : ops)
+            {
+                for(MatrixOp opB : ops)
+                {
+                    NNMatrixType a = opA == MatrixOp::Normal ? filled(m, k, 1) : filled(k, m, 1);
+                    NNMatrixType b = opB == MatrixOp::Normal ? filled(k, n, 2) : filled(n, k, 2);
+                    NNMatrixType c = filled(m, n, 3);
+                    NNMatrixType expected(c);
+
+                    NNMatrixType::gemm(2.0f, a, opA, b, opB, -1.0f, c);
+
+                    for(unsigned int i = 0; i < m; ++i)
+                    {
+                        for(unsigned int j = 0; j < n; ++j)
+                        {
+                            float sum = 0;
+                            for(unsigned int p = 0; p < k; ++p)
+                            {
+                                const float aip = opA == MatrixOp::Normal ? a.get(i, p) : a.get(p, i);
+                                const float bpj = opB == MatrixOp::Normal ? b.get(p, j) : b.get(j, p);
+                                sum += aip*bpj;
+                            }
+                            REQUIRE(c.get(i, j) == 2.0f*sum - expected.get(i, j));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    SECTION("gemv, ger and axpy")
+    {
+        NNMatrixType a = filled(4, 3, 1);
+        NNMatrixType x = filled(3, 1, 2);
+        NNMatrixType y = filled(4, 1, 3);
+
+        NNMatrixType ax(4, 1, zeros);
+        NNMatrixType::gemv(1.0f, a, MatrixOp::Normal, x, 0.0f, ax);
+        NNMatrixType aty(3, 1, zeros);
+        NNMatrixType::gemv(1.0f, a, MatrixOp::Transpose, y, 0.0f, aty);
+        for(unsigned int i = 0; i < 4; ++i)
+            REQUIRE(ax.get(i, 0) == a.get(i, 0)*x[0] + a.get(i, 1)*x[1] + a.get(i, 2)*x[2]);
+        for(unsigned int j = 0; j < 3; ++j)
+            REQUIRE(aty.get(j, 0) == a.get(0, j)*y[0] + a.get(1, j)*y[1] + a.get(2, j)*y[2] + a.get(3, j)*y[3]);
+
+        NNMatrixType updated(a);
+        NNMatrixType::ger(0.5f, y, x, updated);
+        for(unsigned int i = 0; i < 4; ++i)
+            for(unsigned int j = 0; j < 3; ++j)
+                REQUIRE(updated.get(i, j) == a.get(i, j) + 0.5f*y[i]*x[j]);
+
+        NNMatrixType::axpy(-1.0f, a, updated);
+        REQUIRE(updated.get(3, 2) == 0.5f*y[3]*x[2]);
+        REQUIRE_THROWS(NNMatrixType::axpy(1.0f, x, updated));
+    }
+
+    SECTION("epilogue adds the bias and activates every tile")
+    {
+        // small, vector and blocked paths
+        const unsigned int sizes[][3] = {{5, 7, 3}, {70, 45, 300}, {33, 1, 20}};
+        for(auto& size : sizes)
+        {
+            const unsigned int m = size[0], n = size[1], k = size[2];
+            NNMatrixType a = filled(m, k, 1), b = filled(k, n, 2), bias = filled(m, 1, 3);
+            NNMatrixType z(m, n, uninitialized), activated(m, n, uninitialized), inPlace(m, n, uninitialized);
+            NNMatrixType::gemm(1.0f, a, MatrixOp::Normal, b, MatrixOp::Normal, 0.0f, z,
+                               GemmEpilogue<float>(bias.getData(), SimdKernels::get().relu, activated.begin(), activated.getLeadingDimension()));
+            NNMatrixType::gemm(1.0f, a, MatrixOp::Normal, b, MatrixOp::Normal, 0.0f, inPlace,
+                               GemmEpilogue<float>(bias.getData(), SimdKernels::get().relu, inPlace.begin(), inPlace.getLeadingDimension()));
+
+            NNMatrixType product = a*b;
+            for(unsigned int i = 0; i < m; ++i)
+            {
+                for(unsigned int j = 0; j < n; ++j)
+                {
+                    const float expected = product.get(i, j) + bias[i];
+                    REQUIRE(z.get(i, j) == expected);
+                    REQUIRE(activated.get(i, j) == std::max(expected, 0.0f));
+                    REQUIRE(inPlace.get(i, j) == std::max(expected, 0.0f));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("cache-blocked transpose", "[matrix]")
+{
+    // sizes cover whole blocks, partial blocks, register tiles and their edges
+    const unsigned int sizes[][2] = {{1, 7}, {37, 53}, {64, 64}, {130, 70}, {150, 150}};
+    for(auto& size : sizes)
+    {
+        const unsigned int rows = size[0], columns = size[1];
+        NNMatrixType m(rows, columns, uninitialized);
+        Matrix<int> mi(rows, columns, uninitialized);
+        for(unsigned int i = 0; i < rows; ++i)
+        {
+            for(unsigned int j = 0; j < columns; ++j)
+            {
+                m.view()(i, j) = (float)(i*1000 + j);
+                mi.view()(i, j) = i*1000 + j;
+            }
+        }
+
+        NNMatrixType t = NNMatrixType::transpose(m);
+        Matrix<int> ti = Matrix<int>::transpose(mi);
+        NNMatrixType inPlace(m);
+        inPlace.transposeInPlace();
+        REQUIRE(inPlace.getRows() == columns);
+        REQUIRE(inPlace.getColumns() == rows);
+        for(unsigned int i = 0; i < rows; ++i)
+        {
+            for(unsigned int j = 0; j < columns; ++j)
+            {
+                REQUIRE(t.get(j, i) == m.get(i, j));
+                REQUIRE(ti.get(j, i) == mi.get(i, j));
+                REQUIRE(inPlace.get(j, i) == m.get(i, j));
+            }
+        }
+    }
+}
+
+TEST_CASE("thread pool splits work without changing results", "[matrix]")
+{
+    const unsigned int previousThreads = ThreadPool::getThreadCount();
+    ThreadPool::setThreadCount(4);
+
+    SECTION("every task and every entry is visited once")
+    {
+        std::vector<std::atomic<int>> visits(37);
+        ThreadPool::parallelFor(37, [&](unsigned int task) { ++visits[task]; });
+        for(auto& v : visits) REQUIRE(v == 1);
+
+        const size_t n = 5*ThreadPool::ELEMENTWISE_GRAIN + 3;
+        std::vector<int> entries(n, 0);
+        ThreadPool::parallelRanges(n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i) ++entries[i];
+        });
+        for(int e : entries) REQUIRE(e == 1);
+    }
+
+    SECTION("products and element-wise operations match a single thread")
+    {
+        // big enough to be split into tiles, integer-valued floats keep every sum exact
+        NNMatrixType a(300, 200, uninitialized), b(200, 250, uninitialized);
+        for(unsigned int i = 0; i < a.getStorageSize(); ++i) a[i] = (float)(i % 7) - 3;
+        for(unsigned int i = 0; i < b.getStorageSize(); ++i) b[i] = (float)(i % 5) - 2;
+
+        NNMatrixType parallel = a*b;
+        parallel += parallel*2.0f;
+        ThreadPool::setThreadCount(1);
+        NNMatrixType serial = a*b;
+        serial += serial*2.0f;
+
+        for(unsigned int i = 0; i < serial.getRows(); ++i)
+        {
+            for(unsigned int j = 0; j < serial.getColumns(); ++j)
+            {
+                REQUIRE(parallel.get(i, j) == serial.get(i, j));
+            }
+        }
+    }
+
+    SECTION("products of non-integer values are bit for bit the same on any number of threads")
+    {
+        // on 32 threads the tiles of this product are small enough for the unpacked kernel,
+        // while the whole product goes through the packed one
+        RandomService::seed(13);
+        NNMatrixType a(6, 100, uninitialized), b(100, 2048, uninitialized);
+        a.randomize(-1.0f, 1.0f, RandomService::nextStream());
+        b.randomize(-1.0f, 1.0f, RandomService::nextStream());
+
+        ThreadPool::setThreadCount(32);
+        NNMatrixType parallel = a*b;
+        ThreadPool::setThreadCount(1);
+        NNMatrixType serial = a*b;
+
+        unsigned int mismatches = 0;
+        for(unsigned int i = 0; i < serial.getRows(); ++i)
+        {
+            for(unsigned int j = 0; j < serial.getColumns(); ++j)
+            {
+                mismatches += parallel.get(i, j) != serial.get(i, j);
+            }
+        }
+        REQUIRE(mismatches == 0);
+    }
+
+    ThreadPool::setThreadCount(previousThreads);
+}
+
+TEST_CASE("every SIMD kernel variant matches the scalar reference", "[matrix]")
+{
+    std::stringstream report;
+    REQUIRE(SimdKernels::selfCheck(report));
+    REQUIRE(report.str().empty());
+}
+
+TEST_CASE("sigmoid kernels stay within 1 ulp of the exact value", "[matrix]")
+{
+    // Error of a float against a double reference, in units in the last place of the rounded reference
+    auto ulpError = [](float actual, double expected)
+    {
+        const float rounded = (float)expected;
+        const float ulp = std::nextafter(rounded, INFINITY) - rounded;
+        return std::fabs(actual - expected)/ulp;
+    };
+
+    // From subnormal outputs, below x = -87.3, up to outputs that round to 1
+    const size_t N = 1 << 20;
+    std::vector<float> in(N), out(N), derivative(N);
+    for(size_t i = 0; i < N; ++i) in[i] = -110.0f + 130.0f*i/N;
+
+    for(auto table : SimdKernels::available())
+    {
+        double sigmoidUlps = 0.0, derivativeUlps = 0.0;
+        table->sigmoid(in.data(), out.data(), N);
+        table->sigmoidDerivative(out.data(), derivative.data(), N);
+        for(size_t i = 0; i < N; ++i)
+        {
+            const double s = 1.0/(1.0 + std::exp(-(double)in[i]));
+            sigmoidUlps = std::max(sigmoidUlps, ulpError(out[i], s));
+            derivativeUlps = std::max(derivativeUlps, ulpError(derivative[i], (double)out[i]*(1.0 - out[i])));
+        }
+
+        INFO(table->name);
+        REQUIRE(sigmoidUlps <= 1.0);
+        REQUIRE(derivativeUlps <= 1.0);
+    }
+}
+
+TEST_CASE("philox generator and reproducible initialisation", "[random]")
+{
+    SECTION("known answers of Philox4x32-10")
+    {
+        auto zero = Philox(0, 0).block(0);
+        REQUIRE(zero[0] == 0x6627e8d5);
+        REQUIRE(zero[1] == 0xe169c58d);
+        REQUIRE(zero[2] == 0xbc57ac4c);
+        REQUIRE(zero[3] == 0x9b00dbd8);
+
+        auto ones = Philox(0xffffffffffffffff, 0xffffffffffffffff).block(0xffffffffffffffff);
+        REQUIRE(ones[0] == 0x408f276d);
+        REQUIRE(ones[1] == 0x41c83b0e);
+        REQUIRE(ones[2] == 0xa20bc7c6);
+        REQUIRE(ones[3] == 0x6d5451fd);
+    }
+
+    SECTION("sequential draws match random access")
+    {
+        Philox generator(7, 3);
+        generator.discard(5);
+        for(uint64_t i = 5; i < 20; ++i)
+        {
+            REQUIRE(generator() == Philox(7, 3).at(i));
+        }
+    }
+
+    SECTION("randomize depends only on the stream")
+    {
+        Matrix<float> a(13, 7);
+        Matrix<float> b(13, 7);
+        Matrix<float> c(13, 7);
+        a.randomize(-1.0f, 1.0f, Philox(42, 1));
+        b.randomize(-1.0f, 1.0f, Philox(42, 1));
+        c.randomize(-1.0f, 1.0f, Philox(42, 2));
+
+        bool differs = false;
+        for(unsigned int i = 0; i < 13*7; ++i)
+        {
+            REQUIRE(a[i] == b[i]);
+            REQUIRE(a[i] >= -1.0f);
+            REQUIRE(a[i] < 1.0f);
+            differs = differs || a[i] != c[i];
+        }
+        REQUIRE(differs);
+    }
+
+    SECTION("seeded service reproduces networks")
+    {
+        float matrixData[] = {1, 2, 3, 1, 2, 3, 6, 3, 1, 2};
+        NNMatrixType input(matrixData, 10, 1);
+
+        RandomService::seed(2024);
+        NeuralNetwork nn = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
+        nn.addLayer<SigmoidLayer>(5);
+        NNMatrixType result = nn.feedforward(input);
+
+        RandomService::seed(2024);
+        NeuralNetwork nn2 = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
+        nn2.addLayer<SigmoidLayer>(5);
+        NNMatrixType result2 = nn2.feedforward(input);
+
+        for(unsigned int i = 0; i < 5; ++i)
+        {
+            REQUIRE(result[i] == result2[i]);
+        }
+    }
+}
+
+TEST_CASE("map, sanitize and batch activations", "[matrix]")
+{
+    float data[] = {-3.0f, -0.5f, 0.0f, 0.25f, 2.0f, 40.0f, -40.0f};
+    NNMatrixType m(data, 7, 1);
+
+    SECTION("map inlines the function and keeps its results")
+    {
+        auto result = m.map([](float x) { return 1.0f/x; });
+
+        REQUIRE(std::isinf(result[2]));
+        REQUIRE(result.sanitize()[2] == 0.0f);
+        REQUIRE(result[4] == 0.5f);
+    }
+
+    SECTION("vectorized activations match per-value functions")
+    {
+        SigmoidLayer sigmoid(7, 1);
+        ReLULayer relu(7, 1);
+        float out[7];
+
+        float derivative[7];
+
+        sigmoid.activate(data, out, 7);
+        for(unsigned int i = 0; i < 7; ++i) REQUIRE(out[i] == Approx(sigmoid.activationFunction(data[i])).margin(1e-6));
+        // derivatives are taken from the outputs, sigmoid'(z) = s(z)(1 - s(z))
+        REQUIRE(sigmoid.derivativeFromOutput());
+        sigmoid.activateDerivative(out, derivative, 7);
+        for(unsigned int i = 0; i < 7; ++i)
+        {
+            const float s = 1.0f/(1.0f + std::exp(-data[i]));
+            REQUIRE(derivative[i] == Approx(s*(1.0f - s)).margin(1e-6));
+            REQUIRE(derivative[i] == sigmoid.activationDerivative(out[i]));
+        }
+
+        relu.activate(data, out, 7);
+        for(unsigned int i = 0; i < 7; ++i) REQUIRE(out[i] == relu.activationFunction(data[i]));
+        relu.activateDerivative(out, derivative, 7);
+        for(unsigned int i = 0; i < 7; ++i) REQUIRE(derivative[i] == (data[i] > 0.0f ? 1.0f : 0.0f));
+
+        sigmoid.setActivationAccuracy(ActivationAccuracy::Fast);
+        sigmoid.activate(data, out, 7);
+        for(unsigned int i = 0; i < 7; ++i) REQUIRE(out[i] == Approx(sigmoid.activationFunction(data[i])).epsilon(2e-4));
+    }
+}
+
+TEST_CASE("aligned allocation and padded rows", "[matrix]")
+{
+    // rows of 20 floats are padded to 32, so every row starts on a cache line
+    std::vector<float> data(3*20);
+    for(unsigned int i = 0; i < data.size(); ++i) data[i] = (float)i;
+    NNMatrixType m(data.data(), 3, 20);
+
+    REQUIRE(m.getLeadingDimension() == 32);
+    REQUIRE(NNMatrixType(5, 1).getLeadingDimension() == 1);
+    for(unsigned int i = 0; i < m.getRows(); ++i)
+    {
+        REQUIRE((uintptr_t)(m.getData() + i*m.getLeadingDimension()) % 64 == 0);
+    }
+
+    SECTION("entries keep their logical positions")
+    {
+        REQUIRE(m.get(2, 19) == 59.0f);
+        REQUIRE(m.sum() == Approx(59.0f*60.0f/2.0f));
+        NNMatrixType t = NNMatrixType::transpose(m);
+        REQUIRE(t.get(19, 2) == 59.0f);
+
+        NNMatrixType product = t*m;
+        float expected = 0;
+        for(unsigned int k = 0; k < 3; ++k) expected += m.get(k, 4)*m.get(k, 7);
+        REQUIRE(product.get(4, 7) == Approx(expected));
+    }
+
+    SECTION("element-wise operations and padding")
+    {
+        NNMatrixType twice = m + m*2.0f;
+        REQUIRE(twice.get(1, 5) == 75.0f);
+        twice -= m;
+        REQUIRE(twice.sum() == Approx(2.0f*59.0f*60.0f/2.0f));
+    }
+
+    SECTION("the default fill leaves the padding zero")
+    {
+        NNMatrixType ones(3, 20);
+        REQUIRE(ones.sum() == 60.0f);
+        for(unsigned int i = 0; i < ones.getRows(); ++i)
+        {
+            for(unsigned int j = ones.getColumns(); j < ones.getLeadingDimension(); ++j)
+            {
+                REQUIRE(ones.getData()[i*ones.getLeadingDimension() + j] == 0.0f);
+            }
+        }
+    }
+
+    SECTION("map leaves the padding zero")
+    {
+        NNMatrixType inverse = m.map([](float x) { return 1.0f/x; });
+        REQUIRE(std::isinf(inverse.get(0, 0)));
+        for(unsigned int i = 0; i < inverse.getRows(); ++i)
+        {
+            for(unsigned int j = inverse.getColumns(); j < inverse.getLeadingDimension(); ++j)
+            {
+                REQUIRE(inverse.getData()[i*inverse.getLeadingDimension() + j] == 0.0f);
+            }
+        }
+    }
+
+    SECTION("randomize does not depend on padding")
+    {
+        NNMatrixType packed(3*20, 1, uninitialized);
+        Philox stream(5, 6);
+        m.randomize(-1.0f, 1.0f, stream);
+        packed.randomize(-1.0f, 1.0f, stream);
+        REQUIRE(m.get(2, 3) == packed[43]);
+    }
+
+    SECTION("matrices with another allocator interoperate")
+    {
+        Matrix<float, std::allocator<float>> other(m);
+        REQUIRE(other.get(2, 19) == 59.0f);
+        NNMatrixType back(m.getRows(), m.getColumns(), zeros);
+        back += other;
+        REQUIRE(back.get(1, 1) == 21.0f);
+    }
+}
+
+TEST_CASE("matrix views read data in place", "[matrix]")
+{
+    // three samples of four values, one sample per row
+    float data[] = {1, 2, 3, 4,
+                    5, 6, 7, 8,
+                    9, 10, 11, 12};
+    NNMatrixType samples(data, 3, 4);
+    NNMatrixViewType all = samples.view();
+
+    SECTION("rows and blocks share the matrix storage")
+    {
+        NNMatrixViewType block = all.block(1, 1, 2, 2);
+        REQUIRE(block.getLeadingDimension() == 4);
+        REQUIRE_FALSE(block.isContiguous());
+        REQUIRE(block(1, 0) == 10);
+        REQUIRE(&block(0, 0) == samples.getData() + 5);
+        REQUIRE_THROWS(all.rows(2, 2));
+
+        NNMatrixType copy(block);
+        REQUIRE(copy.getRows() == 2);
+        REQUIRE(copy.get(1, 1) == 11);
+    }
+
+    SECTION("row seen as a column vector")
+    {
+        NNMatrixViewType sample = all.rowAsColumn(2);
+        REQUIRE(sample.getRows() == 4);
+        REQUIRE(sample.getColumns() == 1);
+        REQUIRE(sample.get(3, 0) == 12);
+    }
+
+    SECTION("product with a strided view")
+    {
+        float wData[] = {1, 0, 2, 1};
+        NNMatrixType w(wData, 2, 2);
+        NNMatrixType result = w*all.block(0, 2, 2, 2);
+        NNMatrixType expected = w*NNMatrixType(all.block(0, 2, 2, 2));
+        for(unsigned int i = 0; i < 4; ++i) REQUIRE(result[i] == expected[i]);
+    }
+
+    SECTION("network evaluates a sample without copying it")
+    {
+        NeuralNetwork nn = NeuralNetwork(4, 0.1, std::make_unique<MeanSquereErrorCost>());
+        nn.addLayer<SigmoidLayer>(3);
+        NNMatrixType fromView = nn.feedforward(all.rowAsColumn(1));
+        NNMatrixType fromMatrix = nn.feedforward(NNMatrixType(data + 4, 4, 1));
+        for(unsigned int i = 0; i < 3; ++i) REQUIRE(fromView[i] == fromMatrix[i]);
+    }
+}
+
+TEST_CASE("batches go through the network as matrices", "[nn]")
+{
+    float data[] = {1, 2, 3, 1, 2, 3, 6, 3, 1, 2,
+                    0, 1, 0, 1, 0, 1, 0, 1, 0, 1,
+                    5, 4, 3, 2, 1, 0, 1, 2, 3, 4};
+    NNMatrixType samples(data, 3, 10);
+    NNMatrixViewType all = samples.view();
+
+    SECTION("batch feedforward matches single samples")
+    {
+        NeuralNetwork nn = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
+        nn.addLayer<ReLULayer>(20);
+        nn.addLayer<SigmoidLayer>(5);
+
+        NNMatrixType batch = NNMatrixType::transpose(all);
+        NNMatrixType result = nn.feedforward(batch);
+        REQUIRE(result.getColumns() == 3);
+        for(unsigned int j = 0; j < 3; ++j)
+        {
+            NNMatrixType single = nn.feedforward(all.rowAsColumn(j));
+            for(unsigned int i = 0; i < 5; ++i) REQUIRE(result.get(i, j) == Approx(single[i]).margin(1e-6));
+        }
+    }
+
+    SECTION("gradients of a batch are summed")
+    {
+        std::vector<NNMatrixViewType> inputs{all.rowAsColumn(0), all.rowAsColumn(0)};
+        NNMatrixType target(5, 1, zeros);
+        std::vector<NNMatrixViewType> targets{target, target};
+
+        RandomService::seed(7);
+        NeuralNetwork twice = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
+        twice.addLayer<SigmoidLayer>(5);
+        twice.train(1, 2, inputs, targets);
+
+        RandomService::seed(7);
+        NeuralNetwork once = NeuralNetwork(10, 0.2, std::make_unique<MeanSquereErrorCost>());
+        once.addLayer<SigmoidLayer>(5);
+        inputs.pop_back();
+        targets.pop_back();
+        once.train(1, 1, inputs, targets);
+
+        NNMatrixType a = twice.feedforward(all.rowAsColumn(2));
+        NNMatrixType b = once.feedforward(all.rowAsColumn(2));
+        for(unsigned int i = 0; i < 5; ++i) REQUIRE(a[i] == Approx(b[i]).margin(1e-6));
+    }
+
+    SECTION("batch split across workers matches the whole batch, bit for bit on any number of threads")
+    {
+        // the hidden layer is wide enough for the products of a part to be split into tiles
+        RandomService::seed(11);
+        NNMatrixType data(100, 48, uninitialized), labels(10, 48, uninitialized);
+        data.randomize(0.0f, 1.0f, RandomService::nextStream());
+        labels.randomize(0.0f, 1.0f, RandomService::nextStream());
+        std::vector<NNMatrixViewType> inputs, targets;
+        for(unsigned int n = 0; n < 48; ++n)
+        {
+            inputs.push_back(data.view().block(0, n, 100, 1));
+            targets.push_back(labels.view().block(0, n, 10, 1));
+        }
+
+        const unsigned int previousThreads = ThreadPool::getThreadCount();
+        auto trained = [&](unsigned int workers, unsigned int threads)
+        {
+            ThreadPool::setThreadCount(threads);
+            RandomService::seed(3);
+            NeuralNetwork nn(100, 0.001f, std::make_unique<MeanSquereErrorCost>());
+            nn.addLayer<ReLULayer>(2048);
+            nn.addLayer<SigmoidLayer>(10);
+            nn.setTrainingWorkers(workers);
+            nn.train(2, 24, inputs, targets);
+            return nn.feedforward(data);
+        };
+        NNMatrixType whole = trained(1, 1);
+        NNMatrixType serial = trained(4, 1);
+        NNMatrixType parallel = trained(4, 32);
+        ThreadPool::setThreadCount(previousThreads);
+
+        for(unsigned int i = 0; i < 10; ++i)
+        {
+            for(unsigned int j = 0; j < 48; ++j)
+            {
+                REQUIRE(serial.get(i, j) == parallel.get(i, j));
+                REQUIRE(serial.get(i, j) == Approx(whole.get(i, j)).margin(1e-5));
+            }
+        }
+    }
+}
+
+TEST_CASE("training steps allocate from the arena", "[nn]")
+{
+    SECTION("arena grows to a whole round and then stops allocating")
+    {
+        Arena arena(64);
+        {
+            ArenaScope scope(arena);
+            NNMatrixType a(4, 4, zeros);
+            NNMatrixType b(20, 20, zeros);
+            REQUIRE((uintptr_t)b.getData() % 64 == 0);
+        }
+        REQUIRE(arena.getCapacity() >= 64 + 20*32*sizeof(float));
+
+        const size_t before = heapAllocations;
+        {
+            ArenaScope scope(arena);
+            NNMatrixType a(4, 4, zeros);
+            NNMatrixType b(20, 20, zeros);
+        }
+        REQUIRE(heapAllocations == before);
+        REQUIRE(Arena::current() == nullptr);
+    }
+
+    SECTION("matrices made outside of a scope keep heap storage when resized inside one")
+    {
+        Arena arena(1 << 16);
+        NNMatrixType copied(2, 2, zeros);
+        NNMatrixType moved(2, 2, zeros);
+        {
+            ArenaScope scope(arena);
+            NNMatrixType temporary(3, 20);
+            NNMatrixType other(5, 7);
+            const size_t used = arena.getUsed();
+            copied = temporary;
+            moved = std::move(other);
+            REQUIRE(arena.getUsed() == used);
+        }
+
+        // the next round reuses the arena's memory, which the matrices must not be pointing into
+        {
+            ArenaScope scope(arena);
+            NNMatrixType overwrite(64, 64, zeros);
+        }
+        REQUIRE(copied.getRows() == 3);
+        REQUIRE(copied.sum() == 60.0f);
+        REQUIRE(moved.getColumns() == 7);
+        REQUIRE(moved.sum() == 35.0f);
+    }
+
+    SECTION("steady-state training step makes no heap allocations")
+    {
+        NeuralNetwork nn = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
+        nn.addLayer<ReLULayer>(30);
+        nn.addLayer<SigmoidLayer>(5);
+
+        std::vector<NNMatrixType> inputs, targets;
+        for(unsigned int i = 0; i < 20; ++i)
+        {
+            inputs.emplace_back(10, 1);
+            targets.emplace_back(5, 1, zeros);
+        }
+        std::vector<NNMatrixType> fewInputs(inputs.begin(), inputs.begin() + 5);
+        std::vector<NNMatrixType> fewTargets(targets.begin(), targets.begin() + 5);
+
+        // warm-up sizes the arena for batches of 5
+        nn.train(1, 5, inputs, targets);
+
+        // per-call allocations (views, shuffle table) are the same for 5 and 20 samples,
+        // so the 3 extra batches must not allocate at all
+        size_t before = heapAllocations;
+        nn.train(1, 5, fewInputs, fewTargets);
+        const size_t fewSamples = heapAllocations - before;
+
+        before = heapAllocations;
+        nn.train(1, 5, inputs, targets);
+        const size_t manySamples = heapAllocations - before;
+
+        REQUIRE(manySamples == fewSamples);
+    }
+
+    SECTION("inference through a workspace sized from the topology makes no heap allocations")
+    {
+        NeuralNetwork nn = NeuralNetwork(36, 0.1, std::make_unique<CrossEntropyCost>());
+        nn.addLayer(std::make_shared<ReLUConv2DLayer>(TensorShape{1, 6, 6}, 4, 3, 1));
+        nn.addLayer(std::make_shared<MaxPool2DLayer>(TensorShape{4, 6, 6}, 2));
+        nn.addLayer<SoftmaxLayer>(3);
+
+        NNMatrixType batch(36, 8, uninitialized);
+        batch.randomize(0.0f, 1.0f, RandomService::nextStream());
+        NNMatrixType expected = nn.feedforward(batch);
+
+        Workspace workspace(nn.getWorkspaceSize(8));
+        const size_t capacity = workspace.getCapacity();
+        nn.feedforward(batch, workspace);
+
+        const size_t before = heapAllocations;
+        NNMatrixViewType result = nn.feedforward(batch, workspace);
+        REQUIRE(heapAllocations == before);
+        REQUIRE(workspace.getCapacity() == capacity);
+        for(unsigned int i = 0; i < 3; ++i)
+            for(unsigned int j = 0; j < 8; ++j)
+                REQUIRE(result.get(i, j) == expected.get(i, j));
+    }
+}
+
+TEST_CASE("softmax output layer", "[nn]")
+{
+    SECTION("every column becomes a distribution, even for huge inputs")
+    {
+        SoftmaxLayer softmax(4, 3);
+        float inputData[] = {1000, -1000, 0.5f,
+                             2000, 3, -0.5f,
+                             -50, 4, 1};
+        NNMatrixType input(inputData, 3, 3);
+        NNMatrixType output = softmax.feedforward(input);
+        for(unsigned int j = 0; j < 3; ++j)
+        {
+            float sum = 0;
+            for(unsigned int i = 0; i < 4; ++i)
+            {
+                REQUIRE(std::isfinite(output.get(i, j)));
+                REQUIRE(output.get(i, j) >= 0.0f);
+                sum += output.get(i, j);
+            }
+            REQUIRE(sum == Approx(1.0f));
+        }
+    }
+
+    SECTION("cross-entropy gradient is a - y")
+    {
+        SoftmaxLayer softmax(3, 2);
+        float outputData[] = {0.2f, 0.7f, 0.1f};
+        float targetData[] = {0, 1, 0};
+        NNMatrixType output(outputData, 3, 1), target(targetData, 3, 1), delta;
+        REQUIRE(softmax.outputDelta(CrossEntropyCost(), output, target, delta));
+        REQUIRE(delta[0] == Approx(0.2f));
+        REQUIRE(delta[1] == Approx(-0.3f));
+        REQUIRE(delta[2] == Approx(0.1f));
+        REQUIRE_FALSE(softmax.outputDelta(MeanSquereErrorCost(), output, target, delta));
+    }
+
+    SECTION("large learning rate trains without NaN")
+    {
+        RandomService::seed(7);
+        NeuralNetwork nn = NeuralNetwork(10, 5.0, std::make_unique<CrossEntropyCost>());
+        nn.addLayer<ReLULayer>(16);
+        nn.addLayer<SoftmaxLayer>(4);
+        std::vector<NNMatrixType> inputs, targets;
+        for(unsigned int i = 0; i < 40; ++i)
+        {
+            inputs.emplace_back(10, 1, uninitialized);
+            inputs.back().randomize(0.0f, 1.0f, RandomService::nextStream());
+            targets.emplace_back(4, 1, zeros);
+            targets.back()[i % 4] = 1.0f;
+        }
+        nn.train(5, 8, inputs, targets);
+        NNMatrixType result = nn.feedforward(inputs[0]);
+        for(unsigned int i = 0; i < 4; ++i) REQUIRE(std::isfinite(result[i]));
+    }
+}
+
+// Exposes the parameters of a layer to the tests
+template<typename L>
+struct ParameterAccess : L
+{
+    using L::L;
+    using L::weights_;
+    using L::bias_;
+    using L::nablaW_;
+};
+
+// Compares dC/da of the input and dC/dw backpropagated by a layer with finite differences
+// of cost = sum(error * output), whose derivative w.r.t. the output is error
+template<typename L>
+void checkGradients(ParameterAccess<L>& layer, unsigned int samples)
+{
+    NNMatrixType input(layer.getInputNodesCount(), samples, uninitialized);
+    NNMatrixType error(layer.getNodesCount(), samples, uninitialized);
+    input.randomize(-1.0f, 1.0f, RandomService::nextStream());
+    error.randomize(-1.0f, 1.0f, RandomService::nextStream());
+
+    auto cost = [&]()
+    {
+        NNMatrixType output = layer.feedforward(input);
+        double sum = 0;
+        for(unsigned int i = 0; i < output.getRows(); ++i)
+            for(unsigned int j = 0; j < output.getColumns(); ++j)
+                sum += (double)output.get(i, j)*error.get(i, j);
+        return sum;
+    };
+
+    NNMatrixType z;
+    NNMatrixType output = layer.feedforward(input, z);
+    // gradient buffers are training state, created on request
+    REQUIRE_FALSE(layer.hasGradients());
+    REQUIRE_THROWS_AS(layer.backpropagate(error, z, output, input), std::runtime_error);
+    layer.allocateGradients();
+    NNMatrixType prevError = layer.backpropagate(error, z, output, input);
+
+    const float EPS = 1e-2f;
+    for(unsigned int i = 0; i < input.getRows(); i += 5)
+    {
+        const float original = input.get(i, 1);
+        input.view()(i, 1) = original + EPS;
+        const double plus = cost();
+        input.view()(i, 1) = original - EPS;
+        const double minus = cost();
+        input.view()(i, 1) = original;
+        REQUIRE(prevError.get(i, 1) == Approx((plus - minus)/(2*EPS)).margin(2e-3));
+    }
+    for(unsigned int j = 0; j < layer.weights_.getColumns(); j += 2)
+    {
+        const float original = layer.weights_.get(1, j);
+        layer.weights_.view()(1, j) = original + EPS;
+        const double plus = cost();
+        layer.weights_.view()(1, j) = original - EPS;
+        const double minus = cost();
+        layer.weights_.view()(1, j) = original;
+        REQUIRE(layer.nablaW_.get(1, j) == Approx((plus - minus)/(2*EPS)).margin(2e-3));
+    }
+}
+
+TEST_CASE("convolution and pooling layers", "[nn]")
+{
+    RandomService::seed(11);
+
+    SECTION("im2col and direct convolution match the definition")
+    {
+        // {channels, size, filters, kernel, padding}: 3x3 on one channel is convolved directly,
+        // 1x1 multiplies the input without im2col
+        const unsigned int configs[][5] = {{1, 7, 4, 3, 1}, {5, 6, 3, 3, 1}, {2, 9, 3, 5, 0}, {4, 5, 6, 1, 0}};
+        for(const auto& config : configs)
+        {
+            const TensorShape shape{config[0], config[1], config[1]};
+            ParameterAccess<SigmoidConv2DLayer> conv(shape, config[2], config[3], config[4]);
+            conv.bias_.randomize(-1.0f, 1.0f, RandomService::nextStream());
+            const TensorShape out = conv.getOutputShape();
+            const int k = config[3], pad = config[4];
+
+            // 20 samples have padded rows, 3 do not
+            for(unsigned int samples : {3u, 20u})
+            {
+                NNMatrixType input(shape.size(), samples, uninitialized);
+                input.randomize(-1.0f, 1.0f, RandomService::nextStream());
+                NNMatrixType output = conv.feedforward(input);
+                REQUIRE(output.getRows() == out.size());
+
+                for(unsigned int f = 0; f < out.channels; ++f)
+                for(unsigned int y = 0; y < out.height; ++y)
+                for(unsigned int x = 0; x < out.width; ++x)
+                for(unsigned int n = 0; n < samples; ++n)
+                {
+                    float z = conv.bias_.get(f, 0);
+                    for(unsigned int c = 0; c < shape.channels; ++c)
+                    for(int ky = 0; ky < k; ++ky)
+                    for(int kx = 0; kx < k; ++kx)
+                    {
+                        const int iy = y + ky - pad, ix = x + kx - pad;
+                        if(iy < 0 || ix < 0 || iy >= (int)shape.height || ix >= (int)shape.width) continue;
+                        z += conv.weights_.get(f, (c*k + ky)*k + kx)*input.get((c*shape.height + iy)*shape.width + ix, n);
+                    }
+                    REQUIRE(output.get((f*out.height + y)*out.width + x, n) == Approx(SigmoidActivation::value(z)).margin(1e-5));
+                }
+            }
+        }
+    }
+
+    SECTION("convolution gradients match finite differences")
+    {
+        // 17 samples have padded rows, 2 do not
+        for(unsigned int samples : {2u, 17u})
+        {
+            ParameterAccess<SigmoidConv2DLayer> conv(TensorShape{2, 6, 6}, 3, 3, 1);
+            checkGradients(conv, samples);
+            ParameterAccess<SigmoidConv2DLayer> pointwise(TensorShape{4, 3, 3}, 5, 1);
+            checkGradients(pointwise, samples);
+            ParameterAccess<SigmoidDepthwiseConv2DLayer> depthwise(TensorShape{3, 5, 5}, 3, 1);
+            checkGradients(depthwise, samples);
+        }
+    }
+
+    SECTION("depthwise convolution matches the definition")
+    {
+        const TensorShape shape{3, 7, 6};
+        ParameterAccess<SigmoidDepthwiseConv2DLayer> depthwise(shape, 3, 1);
+        depthwise.bias_.randomize(-1.0f, 1.0f, RandomService::nextStream());
+        const TensorShape out = depthwise.getOutputShape();
+        REQUIRE(out.channels == 3);
+        REQUIRE(out.height == 7);
+        REQUIRE(out.width == 6);
+
+        for(unsigned int samples : {1u, 20u})
+        {
+            NNMatrixType input(shape.size(), samples, uninitialized);
+            input.randomize(-1.0f, 1.0f, RandomService::nextStream());
+            NNMatrixType output = depthwise.feedforward(input);
+
+            for(unsigned int c = 0; c < out.channels; ++c)
+            for(unsigned int y = 0; y < out.height; ++y)
+            for(unsigned int x = 0; x < out.width; ++x)
+            for(unsigned int n = 0; n < samples; ++n)
+            {
+                float z = depthwise.bias_.get(c, 0);
+                for(int ky = 0; ky < 3; ++ky)
+                for(int kx = 0; kx < 3; ++kx)
+                {
+                    const int iy = y + ky - 1, ix = x + kx - 1;
+                    if(iy < 0 || ix < 0 || iy >= (int)shape.height || ix >= (int)shape.width) continue;
+                    z += depthwise.weights_.get(c, ky*3 + kx)*input.get((c*shape.height + iy)*shape.width + ix, n);
+                }
+                REQUIRE(output.get((c*out.height + y)*out.width + x, n) == Approx(SigmoidActivation::value(z)).margin(1e-5));
+            }
+        }
+    }
+
+    SECTION("pooling takes window maxima and routes the error to them")
+    {
+        // one 4x5 map of two samples, the last column falls outside the 2x2 windows
+        MaxPool2DLayer pool(TensorShape{1, 4, 5}, 2);
+        REQUIRE(pool.getNodesCount() == 4);
+        NNMatrixType input(20, 2, uninitialized);
+        for(unsigned int i = 0; i < 20; ++i)
+        {
+            input.view()(i, 0) = (float)i;
+            input.view()(i, 1) = -(float)i;
+        }
+        NNMatrixType z;
+        NNMatrixType output = pool.feedforward(input, z);
+        const float maxima[] = {6, 8, 16, 18};
+        const float minima[] = {0, 2, 10, 12};
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            REQUIRE(output.get(i, 0) == maxima[i]);
+            REQUIRE(output.get(i, 1) == -minima[i]);
+        }
+
+        NNMatrixType error(4, 2, uninitialized);
+        error.randomize(1.0f, 2.0f, RandomService::nextStream());
+        NNMatrixType prevError = pool.backpropagate(error, z, output, input);
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            REQUIRE(prevError.get((unsigned int)maxima[i], 0) == error.get(i, 0));
+            REQUIRE(prevError.get((unsigned int)minima[i], 1) == error.get(i, 1));
+        }
+        REQUIRE(prevError.sum() == Approx(error.sum()));
+    }
+
+    SECTION("a small conv network learns and survives saving")
+    {
+        // 8x8 images of a horizontal or a vertical bar
+        const TensorShape image{1, 8, 8};
+        NeuralNetwork nn = NeuralNetwork(image.size(), 0.1, std::make_unique<CrossEntropyCost>());
+        std::shared_ptr<ReLUConv2DLayer> conv = std::make_shared<ReLUConv2DLayer>(image, 4, 3, 1);
+        nn.addLayer(conv);
+        std::shared_ptr<MaxPool2DLayer> pool = std::make_shared<MaxPool2DLayer>(conv->getOutputShape(), 2);
+        nn.addLayer(pool);
+        nn.addLayer(std::make_shared<SigmoidDepthwiseConv2DLayer>(pool->getOutputShape(), 3, 1));
+        nn.addLayer(std::make_shared<SigmoidConv2DLayer>(pool->getOutputShape(), 6, 1));
+        nn.addLayer<SoftmaxLayer>(2);
+        REQUIRE_THROWS(nn.addLayer(std::make_shared<MaxPool2DLayer>(image, 2)));
+
+        std::vector<NNMatrixType> inputs, targets;
+        for(unsigned int i = 0; i < 64; ++i)
+        {
+            const bool vertical = i % 2;
+            const unsigned int position = (i/2) % 8;
+            inputs.emplace_back(image.size(), 1, zeros);
+            for(unsigned int j = 0; j < 8; ++j)
+            {
+                inputs.back()[vertical ? j*8 + position : position*8 + j] = 1.0f;
+            }
+            targets.emplace_back(2, 1, zeros);
+            targets.back()[vertical] = 1.0f;
+        }
+        nn.train(30, 8, inputs, targets);
+        REQUIRE(nn.test(inputs, targets) > 90.0f);
+
+        const std::string path = temporaryModelPath("conv_test.model");
+        nn.save(path.c_str());
+        NeuralNetwork nn2 = NeuralNetwork::load(path.c_str());
+        std::filesystem::remove(path);
+        REQUIRE(nn2.getLayersCount() == 5);
+        for(unsigned int i = 0; i < 8; ++i)
+        {
+            NNMatrixType result = nn.feedforward(inputs[i]);
+            NNMatrixType result2 = nn2.feedforward(inputs[i]);
+            REQUIRE(result.get(0, 0) == Approx(result2.get(0, 0)).margin(1e-6));
+            REQUIRE(result.get(1, 0) == Approx(result2.get(1, 0)).margin(1e-6));
+        }
+    }
+}
+
+TEST_CASE("optimizers", "[nn]")
+{
+    SECTION("AdamW step follows the bias-corrected moments and clears the gradient")
+    {
+        ParameterAccess<SigmoidLayer> layer(3, 4);
+        layer.allocateGradients();
+        AdamWOptimizer adam(0.9f, 0.999f, 1e-8f, 0.1f);
+        layer.allocateOptimizerState(adam.getStateCount());
+
+        double w = layer.weights_.get(1, 2), m = 0, v = 0;
+        const double LR = 0.01;
+        for(unsigned int t = 1; t <= 3; ++t)
+        {
+            const float g = 0.5f*t - 1.2f;
+            layer.nablaW_.view()(1, 2) = g;
+            adam.beginStep();
+            layer.applyGradients(adam, LR);
+
+            m = 0.9*m + 0.1*g;
+            v = 0.999*v + 0.001*g*g;
+            w = w*(1 - LR*0.1) - LR*(m/(1 - std::pow(0.9, t)))/(std::sqrt(v/(1 - std::pow(0.999, t))) + 1e-8);
+            REQUIRE(layer.weights_.get(1, 2) == Approx(w).epsilon(1e-5));
+            REQUIRE(layer.nablaW_.get(1, 2) == 0.0f);
+        }
+        REQUIRE(adam.getSteps() == 3);
+    }
+
+    // two clusters of points in 8 dimensions, told apart by their first 4 coordinates
+    RandomService::seed(3);
+    NNMatrixType noise(64, 8, uninitialized);
+    noise.randomize(0.0f, 1.0f, RandomService::nextStream());
+    std::vector<NNMatrixType> inputs, targets;
+    for(unsigned int n = 0; n < 64; ++n)
+    {
+        inputs.emplace_back(8, 1, uninitialized);
+        for(unsigned int i = 0; i < 8; ++i) inputs.back()[i] = noise.get(n, i) + (i < 4 && n % 2 ? 1.0f : 0.0f);
+        targets.emplace_back(2, 1, zeros);
+        targets.back()[n % 2] = 1.0f;
+    }
+    auto network = [](float learningRate, std::unique_ptr<Optimizer> optimizer)
+    {
+        NeuralNetwork nn(8, learningRate, std::make_unique<CrossEntropyCost>());
+        nn.addLayer<ReLULayer>(16);
+        nn.addLayer<SoftmaxLayer>(2);
+        nn.setOptimizer(std::move(optimizer));
+        return nn;
+    };
+
+    SECTION("every optimizer learns to separate the clusters")
+    {
+        std::vector<std::pair<float, std::unique_ptr<Optimizer>>> optimizers;
+        optimizers.emplace_back(0.1f, std::make_unique<SGDOptimizer>());
+        optimizers.emplace_back(0.02f, std::make_unique<MomentumOptimizer>(0.9f));
+        optimizers.emplace_back(0.02f, std::make_unique<MomentumOptimizer>(0.9f, true));
+        optimizers.emplace_back(0.01f, std::make_unique<RMSPropOptimizer>());
+        optimizers.emplace_back(0.01f, std::make_unique<AdamWOptimizer>());
+        for(auto& optimizer : optimizers)
+        {
+            RandomService::seed(5);
+            NeuralNetwork nn = network(optimizer.first, std::move(optimizer.second));
+            nn.train(20, 8, inputs, targets);
+            REQUIRE(nn.test(inputs, targets) > 95.0f);
+        }
+    }
+
+    SECTION("lock-free training on several threads learns the clusters")
+    {
+        const unsigned int previousThreads = ThreadPool::getThreadCount();
+        ThreadPool::setThreadCount(4);
+        for(float learningRate : {0.1f, 0.01f})
+        {
+            RandomService::seed(5);
+            NeuralNetwork nn = learningRate > 0.05f ? network(learningRate, std::make_unique<SGDOptimizer>())
+                                                    : network(learningRate, std::make_unique<AdamWOptimizer>());
+            nn.trainAsync(4, 20, 2, inputs, targets);
+            REQUIRE(nn.test(inputs, targets) > 95.0f);
+        }
+        ThreadPool::setThreadCount(previousThreads);
+    }
+
+    SECTION("training resumes from the optimizer state saved with the model")
+    {
+        RandomService::seed(5);
+        NeuralNetwork nn = network(0.01f, std::make_unique<AdamWOptimizer>());
+        nn.train(2, 8, inputs, targets);
+        const std::string path = temporaryModelPath("optimizer_test.model");
+        nn.save(path.c_str());
+
+        NeuralNetwork resumed = NeuralNetwork::load(path.c_str(), true);
+        REQUIRE(dynamic_cast<const AdamWOptimizer&>(resumed.getOptimizer()).getSteps() == 16);
+        NeuralNetwork inference = NeuralNetwork::load(path.c_str());
+        std::filesystem::remove(path);
+        REQUIRE(dynamic_cast<const AdamWOptimizer&>(inference.getOptimizer()).getSteps() == 0);
+
+        RandomService::seed(9);
+        nn.train(1, 8, inputs, targets);
+        RandomService::seed(9);
+        resumed.train(1, 8, inputs, targets);
+        for(unsigned int n = 0; n < 4; ++n)
+        {
+            NNMatrixType a = nn.feedforward(inputs[n]);
+            NNMatrixType b = resumed.feedforward(inputs[n]);
+            REQUIRE(a[0] == b[0]);
+            REQUIRE(a[1] == b[1]);
+        }
+    }
 }
 
 TEST_CASE("saving and loading neural network", "[nn]")
@@ -85,15 +1262,20 @@ TEST_CASE("saving and loading neural network", "[nn]")
     NeuralNetwork nn = NeuralNetwork(10, 0.1, std::make_unique<MeanSquereErrorCost>());
     nn.addLayer<ReLULayer>(10);
     nn.addLayer<SigmoidLayer>(20);
+    // weights of 20 columns have padded rows
+    nn.addLayer<SigmoidLayer>(5);
+    nn.addLayer<SoftmaxLayer>(5);
 
     float matrixData[] = {1, 2, 3, 1, 2, 3, 6, 3, 1, 2};
     NNMatrixType input(matrixData, 10, 1);
 
     NNMatrixType result = nn.feedforward(input);
 
-    nn.save("nn_test.model");
+    const std::string path = temporaryModelPath("nn_test.model");
+    nn.save(path.c_str());
 
-    NeuralNetwork nn2 = NeuralNetwork::load("nn_test.model");
+    NeuralNetwork nn2 = NeuralNetwork::load(path.c_str());
+    std::filesystem::remove(path);
     NNMatrixType result2 = nn2.feedforward(input);
 
     const float EPS = 0.00001;
@@ -103,4 +1285,10 @@ TEST_CASE("saving and loading neural network", "[nn]")
     REQUIRE(fabs(result.get(2, 0) - result2.get(2, 0)) < EPS);
     REQUIRE(fabs(result.get(3, 0) - result2.get(3, 0)) < EPS);
     REQUIRE(fabs(result.get(4, 0) - result2.get(4, 0)) < EPS);
+
+    // gradients of a loaded model are created by the first training run
+    std::vector<NNMatrixType> inputs(1, input);
+    std::vector<NNMatrixType> targets(1, NNMatrixType(5, 1, zeros));
+    nn2.train(1, 1, inputs, targets);
+    REQUIRE(nn2.feedforward(input).get(0, 0) != result.get(0, 0));
 }
@@ -0,0 +1,134 @@
+#include "threadPool.hpp"
+
+#include <cstdlib>
+
+thread_local bool ThreadPool::insideTask_ = false;
+
+namespace
+{
+unsigned int defaultThreadCount()
+{
+    const char* requested = std::getenv("NN_THREADS");
+    if(requested)
+    {
+        const int threads = std::atoi(requested);
+        if(threads > 0) return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+}
+
+ThreadPool::ThreadPool(unsigned int threads):
+    generation_(0), activeWorkers_(0), stop_(false),
+    invoke_(nullptr), context_(nullptr), tasks_(0), nextTask_(0)
+{
+    startWorkers(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopWorkers();
+}
+
+ThreadPool& ThreadPool::instance()
+{
+    static ThreadPool pool(defaultThreadCount());
+    return pool;
+}
+
+unsigned int ThreadPool::getThreadCount()
+{
+    return instance().workers_.size() + 1;
+}
+
+void ThreadPool::setThreadCount(unsigned int threads)
+{
+    if(threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    ThreadPool& pool = instance();
+    std::lock_guard<std::mutex> job(pool.jobMutex_);
+    pool.stopWorkers();
+    pool.startWorkers(threads);
+}
+
+void ThreadPool::run(unsigned int tasks, void (*invoke)(void*, unsigned int), void* context)
+{
+    if(tasks == 0) return;
+    if(tasks == 1 || workers_.empty() || insideTask_)
+    {
+        for(unsigned int task = 0; task < tasks; ++task) invoke(context, task);
+        return;
+    }
+
+    std::lock_guard<std::mutex> job(jobMutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        invoke_ = invoke;
+        context_ = context;
+        tasks_ = tasks;
+        nextTask_ = 0;
+        activeWorkers_ = workers_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return activeWorkers_ == 0; });
+}
+
+void ThreadPool::work()
+{
+    insideTask_ = true;
+    for(unsigned int task = nextTask_++; task < tasks_; task = nextTask_++)
+    {
+        invoke_(context_, task);
+    }
+    insideTask_ = false;
+}
+
+void ThreadPool::workerLoop(uint64_t seenGeneration)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true)
+    {
+        wake_.wait(lock, [&] { return stop_ || generation_ != seenGeneration; });
+        if(stop_) return;
+        seenGeneration = generation_;
+
+        lock.unlock();
+        work();
+        lock.lock();
+
+        if(--activeWorkers_ == 0) done_.notify_one();
+    }
+}
+
+void ThreadPool::startWorkers(unsigned int threads)
+{
+    stop_ = false;
+    workers_.reserve(threads - 1);
+    for(unsigned int i = 1; i < threads; ++i)
+    {
+        // workers join with the jobs posted after they were created
+        workers_.emplace_back(&ThreadPool::workerLoop, this, generation_);
+    }
+}
+
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for(auto it = workers_.begin(); it < workers_.end(); ++it)
+    {
+        it->join();
+    }
+    workers_.clear();
+}
@@ -4,13 +4,18 @@
 #include <limits>
 #include <memory>
 
+#include "adamWOptimizer.hpp"
 #include "crossEntropyCost.hpp"
 #include "data_load_failure.hpp"
 #include "image.hpp"
 #include "meanSquereErrorCost.hpp"
 #include "mnistDataLoader.hpp"
+#include "momentumOptimizer.hpp"
 #include "reluLayer.hpp"
+#include "rmsPropOptimizer.hpp"
+#include "sgdOptimizer.hpp"
 #include "sigmoidLayer.hpp"
+#include "softmaxLayer.hpp"
 #include "userInterface.hpp"
 
 void UserInterface::clearInputBuffer()
@@ -109,12 +114,13 @@ void UserInterface::handleStateLayersAddition(std::optional<MNISTData>& data, st
         std::cout << "What type of layer do you want to add?\n";
         std::cout << "1. relu\n";
         std::cout << "2. sigmoid\n";
-        std::cout << "3. none\n";
+        std::cout << "3. softmax (output layer)\n";
+        std::cout << "4. none\n";
         std::cout << ">>>";
 
         std::cin >> choice;
         if(!std::cin) clearInputBuffer();
-    } while(choice < 1 || choice > 3);
+    } while(choice < 1 || choice > 4);
 
     std::cout << "\n";
 
@@ -127,6 +133,9 @@ void UserInterface::handleStateLayersAddition(std::optional<MNISTData>& data, st
             addLayer<SigmoidLayer>(nn);
             break;
         case 3:
+            addLayer<SoftmaxLayer>(nn);
+            break;
+        case 4:
             if(nn->getLayersCount() == 0)
             {
                 std::cout << "Please add at least one layer.\n\n";
@@ -306,7 +315,42 @@ void UserInterface::handleModelCreation(std::optional<MNISTData>& data, std::opt
             costFunction = std::make_unique<CrossEntropyCost>();
     }
 
+    std::unique_ptr<Optimizer> optimizer = nullptr;
+
+    do
+    {
+        std::cout << "Choose one of the listed optimizers:\n";
+        std::cout << "1. SGD\n";
+        std::cout << "2. SGD with momentum\n";
+        std::cout << "3. SGD with Nesterov momentum\n";
+        std::cout << "4. RMSProp\n";
+        std::cout << "5. AdamW\n";
+        std::cout << ">>>";
+
+        std::cin >> choice;
+        if(!std::cin) clearInputBuffer();
+    } while(choice < 1 || choice > 5);
+
+    switch(choice)
+    {
+        case 1:
+            optimizer = std::make_unique<SGDOptimizer>();
+            break;
+        case 2:
+            optimizer = std::make_unique<MomentumOptimizer>();
+            break;
+        case 3:
+            optimizer = std::make_unique<MomentumOptimizer>(0.9f, true);
+            break;
+        case 4:
+            optimizer = std::make_unique<RMSPropOptimizer>();
+            break;
+        case 5:
+            optimizer = std::make_unique<AdamWOptimizer>();
+    }
+
     nn = NeuralNetwork(784, learingRate, std::move(costFunction));
+    nn->setOptimizer(std::move(optimizer));
 
     state = State::LayersAddition;
 
@@ -337,7 +381,7 @@ void UserInterface::handleDigitRecognition(std::optional<NeuralNetwork>& nn)
             matrixData[i] = ((unsigned char)img[3*i])/255.0f;
         }
 
-        NNMatrixType inputMatrix = NNMatrixType(matrixData, IMAGE_PIXELS, 1);
+        NNMatrixViewType inputMatrix(matrixData, IMAGE_PIXELS, 1);
         NNMatrixType resultMatrix = nn->feedforward(inputMatrix);
 
         unsigned int predictedLabel = 0;
@@ -0,0 +1,21 @@
+#include "workspace.hpp"
+
+Workspace::Workspace(size_t bytes): arena_(bytes), output_(0, 0, uninitialized)
+{
+}
+
+void Workspace::reserve(size_t bytes)
+{
+    arena_.reserve(bytes);
+}
+
+size_t Workspace::getCapacity() const
+{
+    return arena_.getCapacity();
+}
+
+size_t Workspace::matrixBytes(unsigned int rows, unsigned int columns)
+{
+    const size_t bytes = (size_t)rows*NNMatrixType::leadingDimensionFor(columns)*sizeof(NNDataType);
+    return (bytes + Arena::ALIGNMENT - 1)/Arena::ALIGNMENT*Arena::ALIGNMENT;
+}